@@ -1,5 +1,7 @@
 #!/bin/sh
 
-gcc -g src/main.c -o visage.out \
-    -lavcodec -lavformat -lavutil -lswscale -lswresample -lSDL3 \
-    -Wall -Wextra
+# configure and build into build/, taking the build type as the first argument
+BUILD_TYPE="${1:-Release}"
+if [ $# -gt 0 ]; then shift; fi
+
+cmake -S . -B build -DCMAKE_BUILD_TYPE="$BUILD_TYPE" "$@" && cmake --build build -j
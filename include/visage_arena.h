@@ -0,0 +1,92 @@
+#ifndef VISAGE_ARENA_H
+#define VISAGE_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Default number of objects an arena allocates memory for at once. */
+#define VISAGE_ARENA_CHUNK 256
+
+/**
+ * Arena of fixed-size objects, such as the nodes of a queue.
+ *
+ * Objects are carved out of chunks of memory holding many of them, so that
+ * handing out an object rarely allocates anything, and all of them are
+ * released at once when the arena is freed. Objects are never given back
+ * one by one: their owner keeps unused objects on a free list of its own and
+ * hands them out again, so that in steady state no memory is allocated.
+ *
+ * The structure must be allocated using visage_alloc_arena() and initialized
+ * with visage_init_arena(). When no longer needed, it should be freed using
+ * visage_free_arena(), which invalidates all objects taken from it.
+ *
+ * Thread safety: must only be used from one thread at a time, usually under
+ * the lock of the owner.
+ */
+typedef struct VisageArena {
+    /**
+     * Size of every object in bytes, rounded up to keep them aligned.
+     */
+    size_t object_size;
+
+    /**
+     * Number of objects one chunk holds.
+     */
+    int chunk_objects;
+
+    /**
+     * Chunks allocated so far, the last one being handed out from.
+     */
+    uint8_t** chunks;
+
+    /**
+     * Number of chunks allocated.
+     */
+    int nb_chunks;
+
+    /**
+     * Number of chunks the array has room for.
+     */
+    int chunks_capacity;
+
+    /**
+     * Number of objects handed out of the last chunk.
+     */
+    int chunk_used;
+} VisageArena;
+
+/**
+ * Allocates a new, uninitialized arena.
+ *
+ * @return Newly allocated VisageArena, or NULL on allocation failure
+ */
+VisageArena* visage_alloc_arena();
+
+/**
+ * Initializes the arena for objects of the given size.
+ *
+ * @param arena Arena to initialize
+ * @param object_size Size of every object in bytes
+ * @param chunk_objects Number of objects to allocate memory for at once,
+ *        0 for VISAGE_ARENA_CHUNK
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_init_arena(VisageArena* arena, size_t object_size, int chunk_objects);
+
+/**
+ * Hands out a new object from the arena.
+ *
+ * @param arena Initialized arena
+ * @return Zeroed object, valid until the arena is freed, or NULL on
+ *         allocation failure
+ */
+void* visage_arena_get(VisageArena* arena);
+
+/**
+ * Frees an arena and every object taken from it.
+ *
+ * @param arena Pointer to the arena pointer, will be set to NULL
+ */
+void visage_free_arena(VisageArena** arena);
+
+#endif // VISAGE_ARENA_H
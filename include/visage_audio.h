@@ -0,0 +1,220 @@
+#ifndef VISAGE_AUDIO_H
+#define VISAGE_AUDIO_H
+
+#include <SDL3/SDL_audio.h>
+#include <libavcodec/codec.h>
+#include <libavformat/avformat.h>
+#include <stdatomic.h>
+#include "visage_clock.h"
+#include "visage_packet_queue.h"
+
+struct SwrContext;
+struct AVCodecContext;
+struct AVCodecParameters;
+
+/**
+ * Main structure for handling audio playback.
+ *
+ * This structure contains all the necessary contexts and parameters for
+ * decoding an audio stream, converting it to a format SDL can play, and
+ * feeding it to an SDL audio stream.
+ *
+ * The structure must be allocated using visage_alloc_audio() and initialized
+ * with visage_init_audio(). Before processing, the caller opens an SDL audio
+ * stream using the spec filled in by initialization and stores it in the
+ * stream field. When no longer needed, it should be freed using
+ * visage_free_audio().
+ *
+ * Thread safety: the packet queue has its own lock for the demuxer thread,
+ * and SDL audio streams may be fed from any thread. All other fields should
+ * only be accessed from the audio decoding thread once processing starts.
+ */
+typedef struct VisageAudio {
+    /**
+     * Format context containing the opened file information.
+     * Set during initialization and used to look up the stream time base.
+     */
+    AVFormatContext* format_ctx;
+
+    /**
+     * Codec used for decoding the audio stream.
+     * Found automatically based on the audio stream's codec ID.
+     */
+    const AVCodec* codec;
+
+    /**
+     * Parameters describing the audio codec's properties.
+     * Contains information like sample rate, channel layout, etc.
+     */
+    AVCodecParameters* codecpar;
+
+    /**
+     * Context for the initialized audio codec.
+     * Contains the state of the decoder during audio processing.
+     */
+    struct AVCodecContext* codec_ctx;
+
+    /**
+     * Resampling context for sample format conversion.
+     * Used to convert decoded samples SDL cannot take as they are to the
+     * sample format handed to SDL.
+     */
+    struct SwrContext* swr_ctx;
+
+    /**
+     * Interleaved sample format handed to SDL.
+     * The decoder's own format when SDL supports it (float, signed 32-bit
+     * or signed 16-bit), signed 16-bit otherwise.
+     */
+    enum AVSampleFormat sample_fmt;
+
+    /**
+     * Format of the samples handed to SDL.
+     * Filled in during initialization and used to open the SDL stream.
+     */
+    SDL_AudioSpec spec;
+
+    /**
+     * Buffer receiving converted or interleaved samples.
+     * Reused across frames and only grown when a frame needs more room.
+     */
+    uint8_t* buffer;
+
+    /**
+     * Size of the buffer in bytes.
+     */
+    unsigned int buffer_size;
+
+    /**
+     * SDL audio stream that receives the converted samples.
+     * Opened and owned by the caller, must be set before processing.
+     */
+    SDL_AudioStream* stream;
+
+    /**
+     * Playback clock driven by the position of the SDL audio stream.
+     * Owned by the caller, may be NULL. Set before processing.
+     */
+    VisageClock* clock;
+
+    /**
+     * Presentation time of the end of the samples put into the SDL stream,
+     * in milliseconds. Only used by the audio decoding thread.
+     */
+    int64_t end_pts;
+
+    /**
+     * Serial of the packets being decoded.
+     * Only used by the audio decoding thread.
+     */
+    int serial;
+
+    /**
+     * Target of the last accurate seek in milliseconds, INT64_MIN after a
+     * fast seek. Frames ending before it are decoded but not played. Set by
+     * the demuxer before flushing the packet queue.
+     */
+    atomic_llong seek_pts;
+
+    /**
+     * Queue of demuxed packets waiting to be decoded.
+     * Filled by the demuxer thread and drained by visage_process_audio().
+     */
+    VisagePacketQueue* packets;
+
+    /**
+     * Index of the audio stream in the format context.
+     * Used to identify audio packets during processing.
+     */
+    int stream_idx;
+
+    /**
+     * Set to keep the audio queued in the SDL stream short, for live
+     * sources. Instead of waiting while enough is queued, the decoder plays
+     * the stream slightly faster while more than a few tens of
+     * milliseconds are queued, making up for the drift between the clocks
+     * of the source and the audio device, and drops what is queued when a
+     * backlog builds up anyway. May be set before processing.
+     */
+    int low_latency;
+
+    /**
+     * Set while the SDL stream is played faster to catch up in low-latency
+     * mode. Only used by the audio decoding thread.
+     */
+    int catching_up;
+} VisageAudio;
+
+/**
+ * Allocates and initializes a new audio context.
+ *
+ * The allocated context has all fields initialized to NULL/0.
+ *
+ * @return Newly allocated VisageAudio context, or NULL on allocation failure
+ */
+VisageAudio* visage_alloc_audio();
+
+/**
+ * Initializes an audio context for playback.
+ *
+ * This function:
+ * - Locates the audio stream in the format context
+ * - Sets up the appropriate decoder
+ * - Picks the decoder's sample format for SDL if SDL supports it, and
+ *   otherwise initializes the resampling context for S16 conversion
+ * - Fills in the SDL audio spec and allocates the packet queue
+ *
+ * @param format_ctx Opened format context containing the audio stream
+ * @param audio Audio context to initialize
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_init_audio(AVFormatContext* format_ctx, VisageAudio* audio);
+
+/**
+ * Frees all resources associated with an audio context.
+ *
+ * The SDL audio stream is owned by the caller and is not destroyed.
+ *
+ * @param audio Pointer to the audio context pointer, will be set to NULL
+ */
+void visage_free_audio(VisageAudio** audio);
+
+/**
+ * Processes the audio stream and feeds the SDL audio stream.
+ *
+ * This function:
+ * - Takes packets from the packet queue filled by the demuxer
+ * - Decodes them into raw samples
+ * - Hands interleaved samples in the SDL audio spec to SDL as they are,
+ *   interleaves planar ones, and converts the samples in other formats
+ * - Puts them into the SDL audio stream, waiting while enough is queued, or
+ *   trimming and catching up on what is queued in low-latency mode
+ * - Updates the playback clock with the time of the samples being played,
+ *   which is the end of the queued samples minus the amount still queued
+ *
+ * When the serial of the packets changes after a seek, the decoder and the
+ * SDL stream are flushed first. The function is meant to run on its own
+ * decoding thread and keeps waiting for seeks once the stream has been
+ * drained, returning when the packet queue is aborted or decoding fails.
+ *
+ * @param audio Initialized audio context with an open SDL stream
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_process_audio(VisageAudio* audio);
+
+/**
+ * Returns how much audio is queued in the SDL stream, waiting to be played.
+ *
+ * @param audio Audio context with an open SDL stream
+ * @return Duration of the queued audio in milliseconds
+ */
+int64_t visage_queued_audio(VisageAudio* audio);
+
+/**
+ * Stops audio processing, waking up a decoding thread blocked on packets.
+ *
+ * @param audio Audio context to abort
+ */
+void visage_abort_audio(VisageAudio* audio);
+
+#endif // VISAGE_AUDIO_H
@@ -0,0 +1,124 @@
+#ifndef VISAGE_CLOCK_H
+#define VISAGE_CLOCK_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+/** Value returned by visage_get_clock() before the clock has been started. */
+#define VISAGE_CLOCK_UNSET INT64_MIN
+
+/**
+ * Playback clock shared by the audio and video contexts.
+ *
+ * The clock holds the presentation time, in milliseconds, of what is being
+ * played right now. It is updated from time to time and extrapolated with
+ * the system clock in between, so reading it is accurate at any moment.
+ *
+ * The audio decoder drives the clock from the position of the SDL audio
+ * stream, making audio the master that video is synchronized to. Until
+ * audio playback starts, or when there is no audio, the first presented
+ * video frame starts the clock, which then follows the system clock.
+ *
+ * The clock runs at a playback speed, 1.0 by default. Faster speeds fast
+ * forward, negative speeds play backwards and a speed of 0 pauses playback,
+ * with the presentation time extrapolated accordingly.
+ *
+ * The structure must be allocated using visage_alloc_clock() and freed with
+ * visage_free_clock().
+ *
+ * Thread safety: all fields are protected by the mutex and must only be
+ * accessed through the functions below.
+ */
+typedef struct VisageClock {
+    /**
+     * Presentation time at the last update, in milliseconds.
+     */
+    int64_t pts;
+
+    /**
+     * System time of the last update, in microseconds.
+     * Taken from av_gettime_relative().
+     */
+    int64_t updated;
+
+    /**
+     * Set once the clock has been started.
+     */
+    int started;
+
+    /**
+     * Presentation milliseconds the clock advances by per millisecond of
+     * system time.
+     */
+    double speed;
+
+    /**
+     * Mutex protecting the clock.
+     */
+    pthread_mutex_t mutex;
+} VisageClock;
+
+/**
+ * Allocates a new, unstarted clock.
+ *
+ * @return Newly allocated VisageClock, or NULL on allocation failure
+ */
+VisageClock* visage_alloc_clock();
+
+/**
+ * Frees a clock.
+ *
+ * @param clock Pointer to the clock pointer, will be set to NULL
+ */
+void visage_free_clock(VisageClock** clock);
+
+/**
+ * Sets the presentation time being played right now.
+ *
+ * @param clock Clock to update
+ * @param pts Presentation time in milliseconds
+ */
+void visage_set_clock(VisageClock* clock, int64_t pts);
+
+/**
+ * Sets the presentation time only if the clock has not been started yet.
+ *
+ * @param clock Clock to start
+ * @param pts Presentation time in milliseconds
+ */
+void visage_start_clock(VisageClock* clock, int64_t pts);
+
+/**
+ * Stops the clock until it is set or started again, e.g. after seeking.
+ *
+ * @param clock Clock to reset
+ */
+void visage_reset_clock(VisageClock* clock);
+
+/**
+ * Returns the presentation time being played right now.
+ *
+ * @param clock Clock to read
+ * @return Presentation time in milliseconds, or VISAGE_CLOCK_UNSET if the
+ *         clock has not been started
+ */
+int64_t visage_get_clock(VisageClock* clock);
+
+/**
+ * Changes the playback speed from now on, keeping the current presentation
+ * time.
+ *
+ * @param clock Clock to change
+ * @param speed New speed, negative to play backwards and 0 to pause
+ */
+void visage_set_clock_speed(VisageClock* clock, double speed);
+
+/**
+ * Returns the playback speed.
+ *
+ * @param clock Clock to read
+ * @return Speed the clock runs at
+ */
+double visage_get_clock_speed(VisageClock* clock);
+
+#endif // VISAGE_CLOCK_H
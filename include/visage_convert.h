@@ -0,0 +1,45 @@
+#ifndef VISAGE_CONVERT_H
+#define VISAGE_CONVERT_H
+
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+/**
+ * Hand-vectorized kernels converting decoded frames to YUV420P.
+ *
+ * Only the format pairs that playback actually runs into are covered:
+ * YUV422P, YUV420P10 and YUV422P10 to 8-bit YUV420P at the same size. Chroma
+ * lines are averaged and 10-bit samples are rounded to 8 bits. The kernels
+ * come in SSE4.1, AVX2 and NEON variants, picked at runtime from the flags
+ * of the CPU, with plain C for everything else. Conversions not covered
+ * here are left to swscale.
+ *
+ * Thread safety: all functions may be called from any thread.
+ */
+
+/**
+ * Returns whether a frame of the format can be converted by the kernels.
+ *
+ * @param format Pixel format of the source frame
+ * @return 1 if visage_convert_frame() handles the format, 0 otherwise
+ */
+int visage_can_convert(enum AVPixelFormat format);
+
+/**
+ * Converts a frame into YUV420P planes of the same size.
+ *
+ * @param src Frame to convert, in a format accepted by visage_can_convert()
+ * @param dst Planes of the destination picture
+ * @param dst_linesize Line sizes of the destination planes in bytes
+ * @return 0 on success, -1 if the format is not handled
+ */
+int visage_convert_frame(const AVFrame* src, uint8_t* const dst[3], const int dst_linesize[3]);
+
+/**
+ * Returns the name of the instruction set the kernels run on.
+ *
+ * @return "avx2", "sse4", "neon" or "c"
+ */
+const char* visage_convert_isa();
+
+#endif // VISAGE_CONVERT_H
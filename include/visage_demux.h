@@ -0,0 +1,169 @@
+#ifndef VISAGE_DEMUX_H
+#define VISAGE_DEMUX_H
+
+#include <libavformat/avformat.h>
+#include "visage_audio.h"
+#include "visage_video.h"
+
+/** Default playing time each packet queue is filled up to, in milliseconds. */
+#define VISAGE_DEMUX_QUEUE_MS 1000
+
+/** Default memory limit of all packet queues together, in bytes. */
+#define VISAGE_DEMUX_QUEUE_SIZE (16 * 1024 * 1024)
+
+/**
+ * Structure for reading packets out of an opened file.
+ *
+ * The demuxer reads packets from the format context and dispatches them to
+ * the packet queues of the video and audio contexts, so that reading from
+ * the file never waits on decoding. It reads ahead until both queues hold
+ * at least queue_duration milliseconds of packets, so the decoders ride out
+ * slow I/O, or until the queues hold max_queue_size bytes together, so that
+ * memory stays bounded whatever the bitrate.
+ *
+ * While reading, it records the timestamps and byte offsets of the video
+ * keyframes it passes in an index. Fast seeks snap to indexed keyframes
+ * where the demuxer read the keyframes around the target one after the
+ * other, since parts of the file skipped by seeks may hide others. Formats whose
+ * timestamps may jump, such as MPEG-TS, are seeked by the byte offset of the
+ * indexed keyframe, which needs no search through the file. The index can be
+ * restored from a sidecar written by an earlier playback, see
+ * visage_index.h. Seeks requested on the video
+ * context are carried out by the demuxer thread, which then flushes both
+ * packet queues so the decoders start over at the new position.
+ *
+ * After a VISAGE_SEEK_BACKWARD seek, the demuxer plays the file backwards:
+ * it seeks to the keyframe before the part already read, queues the video
+ * packets up to that part, and repeats from that keyframe on, until the
+ * start of the file is reached. Audio packets are discarded meanwhile.
+ *
+ * The structure must be allocated using visage_alloc_demuxer() and initialized
+ * with visage_init_demuxer(). When no longer needed, it should be freed using
+ * visage_free_demuxer().
+ */
+typedef struct VisageDemuxer {
+    /**
+     * Format context containing the opened file information.
+     * Only read from by the demuxer thread once processing starts.
+     */
+    AVFormatContext* format_ctx;
+
+    /**
+     * Video context receiving the video packets.
+     * Owned by the caller.
+     */
+    VisageVideo* video;
+
+    /**
+     * Audio context receiving the audio packets, or NULL to discard them.
+     * Owned by the caller.
+     */
+    VisageAudio* audio;
+
+    /**
+     * Playing time each packet queue should hold, in milliseconds.
+     * Defaults to VISAGE_DEMUX_QUEUE_MS, may be changed before processing.
+     */
+    int64_t queue_duration;
+
+    /**
+     * Memory all packet queues together may hold, in bytes.
+     * Defaults to VISAGE_DEMUX_QUEUE_SIZE, may be changed before processing.
+     */
+    int64_t max_queue_size;
+
+    /**
+     * Sorted timestamps of the video keyframes read so far, in the time
+     * base of the video stream. Only used by the demuxer thread.
+     */
+    int64_t* keyframes;
+
+    /**
+     * Byte offsets of the packets of the indexed keyframes, -1 where
+     * unknown, in the order of keyframes.
+     */
+    int64_t* keyframe_pos;
+
+    /**
+     * 1 where the next timestamp in the keyframe index is known to be the
+     * next keyframe of the file, because both were read one after the other,
+     * 0 where parts of the file between them may not have been read, in the
+     * order of keyframes. Fast seeks only snap between linked keyframes.
+     */
+    uint8_t* keyframe_next;
+
+    /**
+     * Number of timestamps in the keyframe index.
+     */
+    int nb_keyframes;
+
+    /**
+     * Number of timestamps the keyframe index has room for.
+     */
+    int keyframes_capacity;
+
+    /**
+     * 1 to seek to indexed keyframes by their byte offset, set from the
+     * format by visage_init_demuxer().
+     */
+    int seek_by_bytes;
+
+    /**
+     * Timestamp of the keyframe read last since the latest seek, or
+     * AV_NOPTS_VALUE, which the next keyframe read is linked to. Only used
+     * by the demuxer thread.
+     */
+    int64_t last_keyframe;
+
+    /**
+     * Timestamp the next GOP read backwards ends at, in the time base of the
+     * video stream, or AV_NOPTS_VALUE while reading forwards. Only used by
+     * the demuxer thread.
+     */
+    int64_t reverse_end;
+} VisageDemuxer;
+
+/**
+ * Allocates and initializes a new demuxer.
+ *
+ * @return Newly allocated VisageDemuxer, or NULL on allocation failure
+ */
+VisageDemuxer* visage_alloc_demuxer();
+
+/**
+ * Initializes a demuxer for the given file and decoding contexts.
+ *
+ * The video and audio contexts must already be initialized so that their
+ * stream indices and packet queues are set. Without an audio context, only
+ * the video is read, as for headless decoding.
+ *
+ * @param format_ctx Opened format context to read packets from
+ * @param video Initialized video context
+ * @param audio Initialized audio context, or NULL
+ * @param demuxer Demuxer to initialize
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_init_demuxer(AVFormatContext* format_ctx, VisageVideo* video, VisageAudio* audio,
+                        VisageDemuxer* demuxer);
+
+/**
+ * Reads the file and dispatches packets until an abort.
+ *
+ * This function is meant to run on its own thread. When the end of the file
+ * is reached, both packet queues are marked as finished so the decoders can
+ * drain, and the demuxer keeps waiting for seeks. It returns when either
+ * packet queue is aborted.
+ *
+ * @param demuxer Initialized demuxer
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_process_demux(VisageDemuxer* demuxer);
+
+/**
+ * Frees a demuxer. The format context and decoding contexts are not freed.
+ *
+ * @param demuxer Pointer to the demuxer pointer, will be set to NULL
+ */
+void visage_free_demuxer(VisageDemuxer** demuxer);
+
+#endif // VISAGE_DEMUX_H
@@ -0,0 +1,173 @@
+#ifndef VISAGE_FRAME_CACHE_H
+#define VISAGE_FRAME_CACHE_H
+
+#include <libavutil/frame.h>
+#include <stdint.h>
+
+/** Default memory budget of the frame cache, in bytes. */
+#define VISAGE_FRAME_CACHE_SIZE (256 * 1024 * 1024)
+
+/**
+ * Structure representing one frame held by the frame cache.
+ */
+typedef struct VisageCachedFrame {
+    /**
+     * Reference to the frame, in a format SDL can upload.
+     */
+    AVFrame* frame;
+
+    /**
+     * Presentation timestamp of the frame in milliseconds.
+     */
+    int64_t pts;
+
+    /**
+     * Duration of the frame in milliseconds, 0 if unknown.
+     */
+    int64_t duration;
+
+    /**
+     * Bytes of picture memory the frame holds on to.
+     */
+    int64_t size;
+
+    /**
+     * Run of frames the frame was decoded in, and its position within it.
+     * Frames of the same run with consecutive positions were decoded one
+     * right after the other, with nothing in between.
+     */
+    unsigned int run;
+    unsigned int seq;
+
+    /**
+     * Value of the use counter when the frame was last added or looked up.
+     */
+    uint64_t used;
+} VisageCachedFrame;
+
+/**
+ * Least recently used cache of converted video frames, keyed by their
+ * presentation timestamps.
+ *
+ * The cache keeps references to frames as they are queued for display, so
+ * that their picture buffers stay alive without any copy. Frames decoded
+ * one after the other form a run, which lets a seek back into a cached
+ * range be presented frame by frame straight from the cache. Once the
+ * memory held by the frames exceeds the budget, the frames looked at
+ * longest ago are dropped first.
+ *
+ * The structure must be allocated using visage_alloc_frame_cache(). When no
+ * longer needed, it should be freed using visage_free_frame_cache().
+ *
+ * Thread safety: must only be used from one thread, frames handed out may
+ * be referenced and released from any thread.
+ */
+typedef struct VisageFrameCache {
+    /**
+     * Cached frames sorted by presentation timestamp. The slots past the
+     * cached frames hold blank frames, or NULL, reused for the frames added
+     * later so that caching a frame does not allocate one.
+     */
+    VisageCachedFrame* entries;
+
+    /**
+     * Number of cached frames.
+     */
+    int nb_entries;
+
+    /**
+     * Number of frames the entries have room for.
+     */
+    int entries_capacity;
+
+    /**
+     * Bytes of picture memory held by the cached frames.
+     */
+    int64_t size;
+
+    /**
+     * Memory budget of the cache in bytes. Defaults to
+     * VISAGE_FRAME_CACHE_SIZE and may be changed at any time, taking effect
+     * when the next frame is added.
+     */
+    int64_t max_size;
+
+    /**
+     * Counter incremented on every use, ordering the frames by recency.
+     */
+    uint64_t uses;
+
+    /**
+     * Run the next added frame belongs to, and its position within it.
+     */
+    unsigned int run;
+    unsigned int seq;
+} VisageFrameCache;
+
+/**
+ * Allocates a new, empty frame cache.
+ *
+ * @return Newly allocated VisageFrameCache, or NULL on allocation failure
+ */
+VisageFrameCache* visage_alloc_frame_cache();
+
+/**
+ * Adds a reference to a frame, continuing the current run.
+ *
+ * A frame already cached with the same timestamp is replaced. The frames
+ * used longest ago are dropped until the cache fits its budget again, and
+ * a frame larger than the whole budget is not added at all.
+ *
+ * @param cache Cache to add to
+ * @param frame Converted software frame
+ * @param pts Presentation timestamp in milliseconds
+ * @param duration Duration in milliseconds, 0 if unknown
+ * @return 0 on success, -1 on allocation failure
+ */
+int visage_put_cached_frame(VisageFrameCache* cache, const AVFrame* frame, int64_t pts,
+                            int64_t duration);
+
+/**
+ * Ends the current run, so that the next frame added does not count as
+ * following the last one, e.g. after a seek or a frame left out.
+ *
+ * @param cache Cache to break the run of
+ */
+void visage_break_frame_cache(VisageFrameCache* cache);
+
+/**
+ * Looks up the frame on display at a presentation time.
+ *
+ * @param cache Cache to look in
+ * @param pts Presentation time in milliseconds
+ * @return Cached frame starting at or before the time and lasting until
+ *         after it, or NULL if the cache does not cover the time. Valid
+ *         until the next frame is added.
+ */
+VisageCachedFrame* visage_find_cached_frame(VisageFrameCache* cache, int64_t pts);
+
+/**
+ * Looks up the frame decoded right after a cached one.
+ *
+ * @param cache Cache to look in
+ * @param pts Presentation timestamp of a cached frame in milliseconds
+ * @return Frame of the same run that comes next, or NULL if it is not
+ *         cached. Valid until the next frame is added.
+ */
+VisageCachedFrame* visage_next_cached_frame(VisageFrameCache* cache, int64_t pts);
+
+/**
+ * Drops all cached frames.
+ *
+ * @param cache Cache to empty
+ */
+void visage_clear_frame_cache(VisageFrameCache* cache);
+
+/**
+ * Frees a frame cache and releases the frames it holds.
+ *
+ * @param cache Pointer to the cache pointer, will be set to NULL
+ */
+void visage_free_frame_cache(VisageFrameCache** cache);
+
+#endif // VISAGE_FRAME_CACHE_H
@@ -0,0 +1,96 @@
+#ifndef VISAGE_FRAME_POOL_H
+#define VISAGE_FRAME_POOL_H
+
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+/**
+ * Pool of recycled picture buffers for converted video frames.
+ *
+ * Every frame handed out by the pool gets its own buffer, so frames can be
+ * queued while later frames are being converted. Buffers go back to the pool
+ * once the last reference to a frame is released, so that in steady state no
+ * picture memory is allocated per frame.
+ *
+ * The structure must be allocated using visage_alloc_frame_pool() and
+ * initialized with visage_init_frame_pool(). When no longer needed, it should
+ * be freed using visage_free_frame_pool(). Buffers still referenced by frames
+ * stay valid after the pool is reinitialized or freed.
+ *
+ * Thread safety: visage_get_pool_frame() may only be called from one thread
+ * at a time, frames may be released from any thread.
+ */
+typedef struct VisageFramePool {
+    /**
+     * Pool of buffers, each large enough for one whole picture.
+     * NULL until the pool is initialized.
+     */
+    AVBufferPool* pool;
+
+    /**
+     * Pixel format of the pictures stored in the buffers.
+     */
+    enum AVPixelFormat format;
+
+    /**
+     * Width of the pictures in pixels.
+     */
+    int width;
+
+    /**
+     * Height of the pictures in pixels.
+     */
+    int height;
+
+    /**
+     * Line sizes of the picture planes in bytes.
+     * Aligned so that every line starts on a SIMD-friendly boundary.
+     */
+    int linesize[4];
+} VisageFramePool;
+
+/**
+ * Allocates a new, uninitialized frame pool.
+ *
+ * @return Newly allocated VisageFramePool, or NULL on allocation failure
+ */
+VisageFramePool* visage_alloc_frame_pool();
+
+/**
+ * Initializes the pool for pictures of the given format and size.
+ *
+ * Any previous buffers are released back to the system once the frames
+ * using them are freed. The pool is warmed up with the given number of
+ * buffers, which should match the number of frames that can be in flight.
+ *
+ * @param pool Pool to initialize
+ * @param format Pixel format of the pictures
+ * @param width Width of the pictures in pixels
+ * @param height Height of the pictures in pixels
+ * @param nb_buffers Number of buffers to allocate up front
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_init_frame_pool(VisageFramePool* pool, enum AVPixelFormat format,
+                           int width, int height, int nb_buffers);
+
+/**
+ * Attaches a pooled picture buffer to a blank frame.
+ *
+ * Sets the format, dimensions, data pointers and line sizes of the frame.
+ * Unreferencing the frame returns the buffer to the pool.
+ *
+ * @param pool Initialized pool
+ * @param frame Blank frame to fill
+ * @return 0 on success, -1 on allocation failure
+ */
+int visage_get_pool_frame(VisageFramePool* pool, AVFrame* frame);
+
+/**
+ * Frees a frame pool.
+ *
+ * @param pool Pointer to the pool pointer, will be set to NULL
+ */
+void visage_free_frame_pool(VisageFramePool** pool);
+
+#endif // VISAGE_FRAME_POOL_H
@@ -0,0 +1,116 @@
+#ifndef VISAGE_GPU_H
+#define VISAGE_GPU_H
+
+#include <SDL3/SDL_render.h>
+#include <libavutil/frame.h>
+#include <libavutil/hwcontext.h>
+#include "visage_video.h"
+
+/**
+ * Structure for presenting hardware decoded surfaces without downloading them.
+ *
+ * Depending on the platform and the SDL renderer in use, decoded surfaces are
+ * turned into SDL textures directly on the GPU:
+ * - VideoToolbox CVPixelBuffers are wrapped by the Metal renderer
+ * - VAAPI surfaces are exported as DRM-PRIME dmabufs and imported as EGL
+ *   images into the OpenGL ES renderer
+ * - D3D11 decoder surfaces are copied on the GPU into a texture of the
+ *   Direct3D 11 renderer, which shares its device with the decoder
+ *
+ * In all cases the picture never passes through system memory. NV12 frames
+ * are supported on every path, P010 frames on the Metal and Direct3D paths.
+ *
+ * The structure must be allocated using visage_alloc_gpu() and initialized
+ * with visage_init_gpu() before the video context is initialized. When no
+ * longer needed, it should be freed using visage_free_gpu().
+ *
+ * Thread safety: must only be used from the rendering thread.
+ */
+typedef struct VisageGpu {
+    /**
+     * Renderer the textures are created for.
+     */
+    SDL_Renderer* renderer;
+
+    /**
+     * Type of hardware surfaces the renderer can present directly.
+     * AV_HWDEVICE_TYPE_NONE when zero-copy presentation is not available.
+     */
+    enum AVHWDeviceType device_type;
+
+    /**
+     * Texture showing the most recently imported frame.
+     * Owned by this structure, valid until the next import.
+     */
+    SDL_Texture* texture;
+
+    /**
+     * Reference to the most recently imported frame.
+     * Keeps the underlying surface alive while its texture is in use.
+     */
+    AVFrame* frame;
+
+#if defined(__linux__)
+    /**
+     * DRM-PRIME mapping of the most recently imported VAAPI surface.
+     */
+    AVFrame* drm_frame;
+
+    /**
+     * EGL images wrapping the luma and chroma layers of the surface.
+     */
+    void* images[2];
+
+    /**
+     * OpenGL ES textures bound to the EGL images.
+     */
+    unsigned int textures[2];
+#endif
+} VisageGpu;
+
+/**
+ * Allocates a new gpu presentation context.
+ *
+ * @return Newly allocated VisageGpu, or NULL on allocation failure
+ */
+VisageGpu* visage_alloc_gpu();
+
+/**
+ * Initializes zero-copy presentation for a renderer and video context.
+ *
+ * Checks whether the renderer can present hardware surfaces directly. If it
+ * can, and hardware decoding is not disabled, the video context is set up to
+ * queue hardware frames instead of downloading them, and is given a device
+ * that matches the renderer where the platform requires sharing one. The
+ * video context then refers to this context to present its frames. If it
+ * cannot, the video context is left untouched.
+ *
+ * Must be called before visage_init_video().
+ *
+ * @param renderer Renderer the video will be presented with
+ * @param video Allocated, uninitialized video context
+ * @param gpu Context to initialize
+ * @return 0 on success, including when zero-copy is unavailable
+ */
+int visage_init_gpu(SDL_Renderer* renderer, VisageVideo* video, VisageGpu* gpu);
+
+/**
+ * Creates a texture showing a hardware frame, without copying it to the CPU.
+ *
+ * The previous texture returned by this function is destroyed, so it must no
+ * longer be used once the frame it shows has been presented.
+ *
+ * @param gpu Initialized gpu presentation context
+ * @param frame Hardware frame produced by the decoder
+ * @return Texture showing the frame, or NULL if the frame cannot be imported
+ */
+SDL_Texture* visage_gpu_texture(VisageGpu* gpu, const AVFrame* frame);
+
+/**
+ * Frees a gpu presentation context and the last imported texture.
+ *
+ * @param gpu Pointer to the context pointer, will be set to NULL
+ */
+void visage_free_gpu(VisageGpu** gpu);
+
+#endif // VISAGE_GPU_H
@@ -0,0 +1,62 @@
+#ifndef VISAGE_HWACCEL_H
+#define VISAGE_HWACCEL_H
+
+#include <libavutil/frame.h>
+#include "visage_video.h"
+
+/**
+ * Sets up hardware accelerated decoding for a video context.
+ *
+ * Must be called after the codec context has been allocated and filled with
+ * the stream parameters, and before it is opened. Depending on the hwaccel
+ * field of the video context, this function:
+ * - Does nothing when it is "none"
+ * - Uses the device already set on the video context, if any and if the
+ *   codec supports it, as done by visage_init_gpu()
+ * - Creates a device of the named type when it names a device type
+ * - Probes the device types of the current platform in order of preference
+ *   when it is NULL or "auto"
+ *
+ * On success the device is attached to the codec context together with a
+ * get_format callback selecting the hardware pixel format. When no device
+ * works, the context is left untouched so decoding happens in software.
+ *
+ * @param video Video context with an allocated, unopened codec context
+ * @return 0 on success, including software fallback, -1 if the requested
+ *         device type is unknown
+ */
+int visage_init_hwaccel(VisageVideo* video);
+
+/**
+ * Releases the hardware device of a video context.
+ *
+ * Used to fall back to software decoding when the codec fails to open with
+ * the device attached, and when the video context is freed.
+ *
+ * @param video Video context to release the device of
+ */
+void visage_uninit_hwaccel(VisageVideo* video);
+
+/**
+ * Returns whether a decoded frame lives in hardware memory.
+ *
+ * @param video Video context the frame was decoded with
+ * @param frame Decoded frame
+ * @return 1 if the frame is a hardware surface, 0 otherwise
+ */
+int visage_is_hw_frame(VisageVideo* video, const AVFrame* frame);
+
+/**
+ * Downloads a hardware surface into system memory.
+ *
+ * The destination frame gets a buffer from the hardware download pool of
+ * the video context, so downloading does not allocate in steady state.
+ *
+ * @param video Video context the frame was decoded with
+ * @param hw_frame Decoded hardware frame
+ * @param sw_frame Blank frame that receives the downloaded picture
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_download_video(VisageVideo* video, const AVFrame* hw_frame, AVFrame* sw_frame);
+
+#endif // VISAGE_HWACCEL_H
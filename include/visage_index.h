@@ -0,0 +1,152 @@
+#ifndef VISAGE_INDEX_H
+#define VISAGE_INDEX_H
+
+#include <libavformat/avformat.h>
+#include <stdint.h>
+#include "visage_demux.h"
+
+/** Version of the sidecar layout, files of other versions are ignored. */
+#define VISAGE_INDEX_VERSION 2
+
+/** Suffix appended to the name of the file to name its sidecar. */
+#define VISAGE_INDEX_SUFFIX ".vsidx"
+
+/**
+ * Structure for the sidecar index of a local file.
+ *
+ * The sidecar is written next to the file after it has been played, and
+ * holds what opening and seeking would otherwise have to find out again: the
+ * parameters of every stream, the duration, and the timestamps and byte
+ * offsets of the video keyframes the demuxer passed, with which of them it
+ * read one after the other, so that gaps left by seeks stay known as such
+ * (see VisageDemuxer). When the file is opened
+ * again, the stream parameters are filled in from the sidecar so that
+ * avformat_find_stream_info() need not decode the start of the file, and the
+ * keyframe index is handed to the demuxer so that the first fast seeks land
+ * on keyframes directly.
+ *
+ * The sidecar is a header followed by fixed-size stream records, the
+ * keyframe timestamps, the keyframe byte offsets, one byte per keyframe
+ * linking it to the next, and the extradata of the streams, all in native
+ * byte order and aligned to 8 bytes, so that it is
+ * read in place from a mapping. A sidecar whose version, byte order, streams,
+ * or the size and modification time of the file it was written for do not
+ * match is ignored, and rewritten after playback.
+ *
+ * The structure must be allocated using visage_alloc_index() and initialized
+ * with visage_init_index(). When no longer needed, it should be freed using
+ * visage_free_index().
+ *
+ * Thread safety: must only be used from one thread at a time.
+ */
+typedef struct VisageIndex {
+    /**
+     * Path of the sidecar.
+     */
+    char* path;
+
+    /**
+     * Size of the indexed file in bytes.
+     */
+    int64_t file_size;
+
+    /**
+     * Modification time of the indexed file, in nanoseconds since the epoch.
+     */
+    int64_t file_mtime;
+
+    /**
+     * Sorted timestamps of the keyframes read from the sidecar, in the time
+     * base of the video stream, until handed to the demuxer.
+     */
+    int64_t* keyframes;
+
+    /**
+     * Byte offsets of the keyframes read from the sidecar, -1 where unknown.
+     */
+    int64_t* keyframe_pos;
+
+    /**
+     * Links of the keyframes read from the sidecar to the next one, as in
+     * VisageDemuxer.keyframe_next.
+     */
+    uint8_t* keyframe_next;
+
+    /**
+     * Number of keyframes read from the sidecar, kept after they have been
+     * handed to the demuxer to tell whether it indexed any new ones.
+     */
+    int nb_keyframes;
+
+    /**
+     * Number of keyframes read from the sidecar that are linked to the next,
+     * to tell whether the demuxer linked any more.
+     */
+    int nb_links;
+
+    /**
+     * Index of the video stream the keyframes belong to, or -1.
+     */
+    int stream_idx;
+} VisageIndex;
+
+/**
+ * Allocates a new, uninitialized index.
+ *
+ * @return Newly allocated VisageIndex, or NULL on allocation failure
+ */
+VisageIndex* visage_alloc_index();
+
+/**
+ * Initializes the index for the given local file.
+ *
+ * @param file Path of the file to index
+ * @param index Index to initialize
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_init_index(const char* file, VisageIndex* index);
+
+/**
+ * Reads the sidecar and fills in the stream parameters of the opened file.
+ *
+ * Only parameters the format has left unknown are filled in. The keyframes
+ * are kept in the index until visage_restore_index() hands them over.
+ *
+ * @param format_ctx Format context the file has been opened with
+ * @param index Initialized index
+ * @return 1 if the stream parameters are complete and
+ *         avformat_find_stream_info() can be skipped, 0 if there is no
+ *         matching sidecar
+ */
+int visage_read_index(AVFormatContext* format_ctx, VisageIndex* index);
+
+/**
+ * Hands the keyframes read from the sidecar to the demuxer.
+ *
+ * @param index Index the sidecar has been read into
+ * @param demuxer Initialized demuxer that has not started reading
+ */
+void visage_restore_index(VisageIndex* index, VisageDemuxer* demuxer);
+
+/**
+ * Writes the sidecar from the streams and the keyframes the demuxer indexed.
+ *
+ * Nothing is written if the demuxer indexed or linked no keyframes beyond
+ * those read from the sidecar. The sidecar is written to a temporary file first and
+ * renamed, so that a sidecar is never read half written.
+ *
+ * @param format_ctx Format context of the file
+ * @param demuxer Demuxer that has stopped reading
+ * @param index Initialized index
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_write_index(AVFormatContext* format_ctx, VisageDemuxer* demuxer, VisageIndex* index);
+
+/**
+ * Frees an index.
+ *
+ * @param index Pointer to the index pointer, will be set to NULL
+ */
+void visage_free_index(VisageIndex** index);
+
+#endif // VISAGE_INDEX_H
@@ -0,0 +1,192 @@
+#ifndef VISAGE_INPUT_H
+#define VISAGE_INPUT_H
+
+#include <libavformat/avio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/** Default size of the read-ahead cache for network input, in bytes. */
+#define VISAGE_INPUT_CACHE_SIZE (8 * 1024 * 1024)
+
+/** Amount of a mapped file the kernel is asked to read ahead, in bytes. */
+#define VISAGE_INPUT_READAHEAD (4 * 1024 * 1024)
+
+/**
+ * Structure for reading an input through a read-ahead cache.
+ *
+ * The input opens the url with its own I/O context, the source, and fills a
+ * ring buffer from it on a background thread, so that the demuxer keeps
+ * reading from memory while the network stalls. The demuxer reads through
+ * the avio context, which must be handed to the format context as custom
+ * I/O. Seeks that land inside the cached data are served from the buffer,
+ * other seeks are carried out on the source by the background thread.
+ *
+ * Regular local files are instead mapped into memory, and the demuxer reads
+ * straight from the page cache without a system call per buffer. The kernel
+ * is told that the file is read sequentially, and asked to read ahead of the
+ * position as playback and seeks move it.
+ *
+ * The structure must be allocated using visage_alloc_input() and initialized
+ * with visage_init_input() or visage_map_input(). When no longer needed, it
+ * should be freed using visage_free_input(), after the format context has
+ * been closed.
+ *
+ * Thread safety: the buffer positions are protected by the mutex. The source
+ * is only used by the background thread once initialized.
+ */
+typedef struct VisageInput {
+    /**
+     * I/O context reading from the cache, for the format context.
+     */
+    AVIOContext* avio;
+
+    /**
+     * I/O context reading from the url, used by the background thread.
+     */
+    AVIOContext* source;
+
+    /**
+     * Ring buffer holding the cached data.
+     */
+    uint8_t* buffer;
+
+    /**
+     * Size of the ring buffer in bytes.
+     */
+    int64_t capacity;
+
+    /**
+     * Mapping of a local file, or NULL when reading through the cache.
+     */
+    uint8_t* map;
+
+    /**
+     * Input position up to which the kernel has been asked to read ahead
+     * in the mapping.
+     */
+    int64_t advised_pos;
+
+    /**
+     * Size of the input in bytes, or negative if unknown.
+     */
+    int64_t size;
+
+    /**
+     * Input position the demuxer reads from next.
+     */
+    int64_t read_pos;
+
+    /**
+     * Input position up to which the buffer has been filled.
+     */
+    int64_t fill_pos;
+
+    /**
+     * Input position from which the buffer still holds data, which bounds
+     * the seeks back that are served from the buffer.
+     */
+    int64_t valid_pos;
+
+    /**
+     * Input position the background thread should seek the source to,
+     * or -1 when no seek is pending.
+     */
+    int64_t seek_pos;
+
+    /**
+     * Result of the last seek carried out by the background thread.
+     */
+    int64_t seek_ret;
+
+    /**
+     * Set when the source has reached its end or failed.
+     */
+    int eof;
+
+    /**
+     * Error the source failed with, or 0.
+     */
+    int error;
+
+    /**
+     * Number of times the demuxer had to wait for data to arrive.
+     */
+    atomic_uint underruns;
+
+    /**
+     * Set to stop the background thread and any blocked reads.
+     */
+    atomic_int abort;
+
+    /**
+     * Background thread filling the buffer.
+     */
+    pthread_t thread;
+
+    /**
+     * Set once the background thread has been started.
+     */
+    int thread_started;
+
+    /**
+     * Mutex protecting the buffer positions.
+     */
+    pthread_mutex_t mutex;
+
+    /**
+     * Condition signaled whenever the buffer positions change.
+     */
+    pthread_cond_t cond;
+} VisageInput;
+
+/**
+ * Allocates and initializes a new input.
+ *
+ * @return Newly allocated VisageInput, or NULL on allocation failure
+ */
+VisageInput* visage_alloc_input();
+
+/**
+ * Opens the url and starts filling the read-ahead cache.
+ *
+ * @param url Url of the input to open
+ * @param cache_size Size of the read-ahead cache in bytes
+ * @param input Input to initialize
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_init_input(const char* url, int64_t cache_size, VisageInput* input);
+
+/**
+ * Maps a regular local file into memory for reading.
+ *
+ * @param path Path of the file to map
+ * @param input Input to initialize
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_map_input(const char* path, VisageInput* input);
+
+/**
+ * Returns how much data is cached ahead of the demuxer.
+ *
+ * @param input Initialized input
+ * @return Number of bytes read ahead of the demuxer, 0 for a mapped file
+ */
+int64_t visage_input_fill(VisageInput* input);
+
+/**
+ * Stops the background thread and wakes the demuxer if it waits for data,
+ * making its reads fail.
+ *
+ * @param input Initialized input
+ */
+void visage_abort_input(VisageInput* input);
+
+/**
+ * Frees an input, stopping the background thread and closing the source.
+ *
+ * @param input Pointer to the input pointer, will be set to NULL
+ */
+void visage_free_input(VisageInput** input);
+
+#endif // VISAGE_INPUT_H
@@ -0,0 +1,258 @@
+#ifndef VISAGE_PACKET_QUEUE_H
+#define VISAGE_PACKET_QUEUE_H
+
+#include <libavcodec/packet.h>
+#include <libavutil/rational.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "visage_arena.h"
+
+/** Returned by visage_poll_packet() when there is no packet to take yet. */
+#define VISAGE_PACKET_EMPTY -2
+
+/**
+ * Structure representing a node in a packet queue.
+ *
+ * Each node owns a single demuxed packet. Nodes are taken from the arena of
+ * the queue together with a packet allocated with av_packet_alloc(), and
+ * are put on its free list with their packet blank once taken out of the
+ * queue, so that both are reused for later packets.
+ */
+typedef struct VisagePacketNode {
+    /**
+     * Pointer to the demuxed packet.
+     * Holds the reference moved in from the demuxer.
+     */
+    AVPacket* packet;
+
+    /**
+     * Pointer to the next packet in the queue, or the next free node.
+     * NULL if this is the last packet in the queue.
+     */
+    struct VisagePacketNode* next;
+} VisagePacketNode;
+
+/**
+ * Thread-safe queue of packets between the demuxer and a decoder.
+ *
+ * The demuxer thread puts packets into the queue and a single decoder thread
+ * takes them out. Taking a packet blocks until one is available, the end of
+ * the stream has been signalled, or the queue has been aborted.
+ *
+ * Every flush, done when seeking, discards the queued packets and starts a
+ * new serial. Decoders compare the serial of the packets they take with the
+ * one they decoded last to know when to flush their own state, and tag
+ * their output with it so that stale frames can be told apart.
+ *
+ * Once the queue has grown to the largest number of packets it holds, moving
+ * packets through it allocates no memory besides the packet data itself.
+ *
+ * The structure must be allocated using visage_alloc_packet_queue() and freed
+ * with visage_free_packet_queue().
+ *
+ * Thread safety: all fields are protected by the mutex and must only be
+ * accessed through the functions below.
+ */
+typedef struct VisagePacketQueue {
+    /**
+     * First packet in the queue, the next one to be decoded.
+     * NULL if the queue is empty.
+     */
+    VisagePacketNode* first;
+
+    /**
+     * Last packet in the queue, where new packets are appended.
+     * NULL if the queue is empty.
+     */
+    VisagePacketNode* last;
+
+    /**
+     * Number of packets currently in the queue.
+     */
+    int nb_packets;
+
+    /**
+     * Memory held by the queued packets and their nodes, in bytes.
+     */
+    int64_t size;
+
+    /**
+     * Sum of the durations of the queued packets, in the stream time base.
+     */
+    int64_t duration;
+
+    /**
+     * Time base of the stream the packets belong to.
+     * Set by the owner of the queue, used to convert the duration.
+     */
+    AVRational time_base;
+
+    /**
+     * Set once the demuxer has reached the end of the stream.
+     * Decoders drain the remaining packets and then wait for a flush.
+     */
+    int finished;
+
+    /**
+     * Set once the end of the stream has been reported to the decoder.
+     * Cleared by a flush.
+     */
+    int drained;
+
+    /**
+     * Serial of the packets in the queue, incremented by every flush.
+     */
+    int serial;
+
+    /**
+     * Set when the queue is shutting down.
+     * Wakes up and fails all blocked and future operations.
+     */
+    int abort;
+
+    /**
+     * Arena the nodes are allocated from, freed with the queue.
+     */
+    VisageArena* nodes;
+
+    /**
+     * Nodes no longer in the queue, with blank packets, handed out again
+     * before the arena allocates new ones.
+     */
+    VisagePacketNode* free_nodes;
+
+    /**
+     * Mutex protecting all fields of the queue.
+     */
+    pthread_mutex_t mutex;
+
+    /**
+     * Condition signalled when packets are added or the queue state changes.
+     */
+    pthread_cond_t cond;
+} VisagePacketQueue;
+
+/**
+ * Allocates and initializes a new, empty packet queue.
+ *
+ * @return Newly allocated VisagePacketQueue, or NULL on allocation failure
+ */
+VisagePacketQueue* visage_alloc_packet_queue();
+
+/**
+ * Frees a packet queue and all packets still held in it.
+ *
+ * No thread may be using the queue when it is freed.
+ *
+ * @param queue Pointer to the queue pointer, will be set to NULL
+ */
+void visage_free_packet_queue(VisagePacketQueue** queue);
+
+/**
+ * Appends a packet to the end of the queue.
+ *
+ * The reference held by the packet is moved into the queue without copying
+ * the packet data, leaving the given packet blank.
+ *
+ * @param queue Queue to append to
+ * @param packet Packet to move into the queue
+ * @return 0 on success, -1 if the queue was aborted or allocation failed
+ */
+int visage_put_packet(VisagePacketQueue* queue, AVPacket* packet);
+
+/**
+ * Takes the next packet out of the queue, blocking until one is available.
+ *
+ * The end of the stream is reported once per serial. After that, the call
+ * blocks until the queue is flushed or aborted, so that a decoder can keep
+ * running and serve seeks after it has drained the stream.
+ *
+ * @param queue Queue to take the packet from
+ * @param packet Packet that receives the reference of the queued packet
+ * @param serial Set to the serial of the returned packet or end of stream
+ * @return 1 if a packet was returned, 0 if the stream has finished and the
+ *         queue is empty, -1 if the queue was aborted
+ */
+int visage_get_packet(VisagePacketQueue* queue, AVPacket* packet, int* serial);
+
+/**
+ * Takes the next packet out of the queue if there is one, without blocking.
+ *
+ * Behaves like visage_get_packet(), except that it returns right away when
+ * the call would block, for decoders run as tasks of a worker pool.
+ *
+ * @param queue Queue to take the packet from
+ * @param packet Packet that receives the reference of the queued packet
+ * @param serial Set to the serial of the returned packet or end of stream
+ * @return 1 if a packet was returned, 0 if the stream has finished and the
+ *         queue is empty, -1 if the queue was aborted, VISAGE_PACKET_EMPTY
+ *         if there is nothing to take yet
+ */
+int visage_poll_packet(VisagePacketQueue* queue, AVPacket* packet, int* serial);
+
+/**
+ * Discards all queued packets and starts a new serial.
+ *
+ * Also clears the end of stream, so that the demuxer can fill the queue
+ * again after seeking.
+ *
+ * @param queue Queue to flush
+ */
+void visage_flush_packet_queue(VisagePacketQueue* queue);
+
+/**
+ * Returns the current serial of the queue.
+ *
+ * @param queue Queue to inspect
+ * @return Serial of the packets being queued
+ */
+int visage_packet_queue_serial(VisagePacketQueue* queue);
+
+/**
+ * Returns the number of packets currently in the queue.
+ *
+ * @param queue Queue to inspect
+ * @return Number of queued packets
+ */
+int visage_count_packets(VisagePacketQueue* queue);
+
+/**
+ * Returns the memory held by the packets in the queue.
+ *
+ * @param queue Queue to inspect
+ * @return Size of the queued packets and their nodes in bytes
+ */
+int64_t visage_packet_queue_size(VisagePacketQueue* queue);
+
+/**
+ * Returns the playing time of the packets in the queue.
+ *
+ * @param queue Queue to inspect, with its time base set
+ * @return Sum of the packet durations in milliseconds, 0 if the packets do
+ *         not carry durations
+ */
+int64_t visage_packet_queue_duration(VisagePacketQueue* queue);
+
+/**
+ * Signals that no more packets will be added to the queue.
+ *
+ * @param queue Queue to finish
+ */
+void visage_finish_packet_queue(VisagePacketQueue* queue);
+
+/**
+ * Aborts the queue, waking up any thread blocked on it.
+ *
+ * @param queue Queue to abort
+ */
+void visage_abort_packet_queue(VisagePacketQueue* queue);
+
+/**
+ * Returns whether the queue has been aborted.
+ *
+ * @param queue Queue to inspect
+ * @return 1 if aborted, 0 otherwise
+ */
+int visage_packet_queue_aborted(VisagePacketQueue* queue);
+
+#endif // VISAGE_PACKET_QUEUE_H
@@ -0,0 +1,237 @@
+#ifndef VISAGE_STATS_H
+#define VISAGE_STATS_H
+
+#include <SDL3/SDL_render.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "visage_audio.h"
+#include "visage_input.h"
+#include "visage_video.h"
+
+/** Reading a packet from the input, on the demuxer thread. */
+#define VISAGE_STAGE_DEMUX 0
+
+/** Sending packets to and receiving frames from the decoder. */
+#define VISAGE_STAGE_DECODE 1
+
+/** Downloading and converting a frame for the texture. */
+#define VISAGE_STAGE_CONVERT 2
+
+/** Uploading or importing a frame into a texture, on the rendering thread. */
+#define VISAGE_STAGE_UPLOAD 3
+
+/** Drawing and presenting, including the wait for vsync. */
+#define VISAGE_STAGE_PRESENT 4
+
+/** Number of timed pipeline stages. */
+#define VISAGE_STAGES 5
+
+/** Milliseconds between two reports. */
+#define VISAGE_STATS_INTERVAL_MS 1000
+
+/** Width of the buckets of the timing histograms, in microseconds. */
+#define VISAGE_STATS_BUCKET_US 10
+
+/** Number of buckets per histogram, the last one holding all longer timings. */
+#define VISAGE_STATS_BUCKETS 20001
+
+/**
+ * Timings of one pipeline stage accumulated since the last report.
+ *
+ * Each stage is timed by a single thread, and the rendering thread takes
+ * the values when it reports.
+ */
+typedef struct VisageStageTimes {
+    /**
+     * Sum of the timings in microseconds.
+     */
+    atomic_llong total;
+
+    /**
+     * Longest timing in microseconds.
+     */
+    atomic_llong max;
+
+    /**
+     * Number of timings.
+     */
+    atomic_uint count;
+} VisageStageTimes;
+
+/**
+ * Structure collecting playback statistics.
+ *
+ * The threads of the pipeline record how long each stage takes, and the
+ * rendering thread records frames presented again and the drift between
+ * the video and the audio driven clock, and how long after their capture
+ * frames of live sources show up. Once per interval the rendering
+ * thread turns these into a report, together with the depths of the
+ * queues, which can be drawn over the video and written as a JSON line.
+ *
+ * The structure must be allocated using visage_alloc_stats() and freed with
+ * visage_free_stats(). Functions taking NULL for the stats do nothing, so
+ * contexts without stats need no checks.
+ *
+ * Thread safety: visage_record_stage() may be called from any thread. All
+ * other functions must only be called from the rendering thread.
+ */
+typedef struct VisageStats {
+    /**
+     * Timings of the stages since the last report.
+     */
+    VisageStageTimes stages[VISAGE_STAGES];
+
+    /**
+     * Histograms of all stage timings, VISAGE_STATS_BUCKETS per stage, or
+     * NULL when only the timings of the interval are kept. Allocated by
+     * visage_alloc_histograms().
+     */
+    atomic_uint* histograms;
+
+    /**
+     * Number of vblanks the previous frame was presented again on.
+     */
+    unsigned int frames_repeated;
+
+    /**
+     * Latest presentation time of a frame minus the clock when it showed
+     * up, in milliseconds. Positive when video is ahead of audio.
+     */
+    int64_t drift;
+
+    /**
+     * Time from the capture of the latest presented frame to the vblank it
+     * shows up on, and the longest such time over the current interval, in
+     * milliseconds. -1 for sources that do not report capture times. Relies
+     * on the clocks of the source and the machine being synchronized, e.g.
+     * through NTP.
+     */
+    int64_t latency;
+    int64_t latency_peak;
+
+    /**
+     * Longest capture to present latency over the last interval, in
+     * milliseconds, -1 if none was measured.
+     */
+    int64_t latency_max;
+
+    /**
+     * Average and longest timings of the stages over the last interval,
+     * in microseconds.
+     */
+    int64_t stage_avg[VISAGE_STAGES];
+    int64_t stage_max[VISAGE_STAGES];
+
+    /**
+     * Frames uploaded per second over the last interval.
+     */
+    double fps;
+
+    /**
+     * Depths of the queues when the report was made: decoded frames,
+     * demuxed packets, milliseconds of audio in the SDL stream and bytes
+     * in the input cache.
+     */
+    unsigned int video_frames;
+    int video_packets;
+    int audio_packets;
+    int64_t audio_queued;
+    int64_t input_fill;
+
+    /**
+     * Frames dropped and repeated since playback started.
+     */
+    unsigned int dropped;
+    unsigned int repeated;
+
+    /**
+     * System time playback started and the last report was made, in
+     * microseconds.
+     */
+    int64_t started;
+    int64_t updated;
+
+    /**
+     * Set to draw the report over the video.
+     */
+    int overlay;
+
+    /**
+     * File the reports are written to as JSON lines, NULL for none.
+     * Owned by the caller.
+     */
+    FILE* output;
+} VisageStats;
+
+/**
+ * Allocates new, empty statistics.
+ *
+ * @return Newly allocated VisageStats, or NULL on allocation failure
+ */
+VisageStats* visage_alloc_stats();
+
+/**
+ * Frees statistics. The output file is not closed.
+ *
+ * @param stats Pointer to the stats pointer, will be set to NULL
+ */
+void visage_free_stats(VisageStats** stats);
+
+/**
+ * Starts keeping histograms of the stage timings, for percentiles.
+ *
+ * @param stats Stats to keep histograms in
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_alloc_histograms(VisageStats* stats);
+
+/**
+ * Returns a percentile of the timings recorded for a stage.
+ *
+ * @param stats Stats with histograms
+ * @param stage One of the VISAGE_STAGE_* values
+ * @param percentile Percentile between 0 and 100
+ * @return Upper bound of the bucket holding the percentile in microseconds,
+ *         or 0 if nothing has been recorded
+ */
+int64_t visage_stage_percentile(VisageStats* stats, int stage, double percentile);
+
+/**
+ * Records how long a stage took, up to now.
+ *
+ * @param stats Stats to record into, or NULL
+ * @param stage One of the VISAGE_STAGE_* values
+ * @param start System time the stage started, from av_gettime_relative()
+ */
+void visage_record_stage(VisageStats* stats, int stage, int64_t start);
+
+/**
+ * Records the latency of a frame from its capture to its presentation.
+ *
+ * @param stats Stats to record into, or NULL
+ * @param latency Time from capture to presentation in microseconds
+ */
+void visage_record_latency(VisageStats* stats, int64_t latency);
+
+/**
+ * Makes a new report once the interval has passed, writing it to the output.
+ *
+ * @param stats Stats to report, or NULL
+ * @param video Video context to take the frame queue depth and drops from
+ * @param audio Audio context to take the SDL queue depth from, or NULL
+ * @param input Input to take the cache fill from, or NULL
+ * @return 1 if a new report was made, 0 otherwise
+ */
+int visage_update_stats(VisageStats* stats, VisageVideo* video, VisageAudio* audio,
+                        VisageInput* input);
+
+/**
+ * Draws the last report in the corner of the window, if the overlay is on.
+ *
+ * @param stats Stats to draw, or NULL
+ * @param renderer Renderer to draw with, before presenting
+ */
+void visage_draw_stats(VisageStats* stats, SDL_Renderer* renderer);
+
+#endif // VISAGE_STATS_H
@@ -0,0 +1,46 @@
+#ifndef VISAGE_THREADS_H
+#define VISAGE_THREADS_H
+
+#include <libavcodec/avcodec.h>
+
+/** Lets visage_init_threads() pick the number or type of decoder threads. */
+#define VISAGE_THREADS_AUTO 0
+
+/**
+ * Returns the number of physical cores of the machine.
+ *
+ * Hyperthreads of the same core are counted once, since decoder threads
+ * sharing a core mostly compete for the same execution units. Falls back to
+ * the number of online logical processors when the topology is unknown.
+ *
+ * @return Number of physical cores, at least 1
+ */
+int visage_physical_cores();
+
+/**
+ * Configures the threading of a decoder before it is opened.
+ *
+ * With VISAGE_THREADS_AUTO the thread count is the number of physical cores,
+ * and the threading type is chosen for the codec:
+ * - Slice threading for intra-only codecs such as ProRes or DNxHD that
+ *   support it, as it scales as well as frame threading there without
+ *   delaying every frame by the number of threads
+ * - Frame threading for inter-frame codecs such as H.264 or HEVC, as their
+ *   streams are often encoded with few slices
+ * - Slice threading otherwise, if the codec supports it
+ *
+ * @param codec_ctx Allocated, unopened codec context
+ * @param count Number of threads, or VISAGE_THREADS_AUTO
+ * @param type FF_THREAD_FRAME, FF_THREAD_SLICE, or VISAGE_THREADS_AUTO
+ */
+void visage_init_threads(AVCodecContext* codec_ctx, int count, int type);
+
+/**
+ * Returns the name of the threading type a decoder actually uses.
+ *
+ * @param codec_ctx Opened codec context
+ * @return "frame", "slice", or "none" when decoding on a single thread
+ */
+const char* visage_thread_type_name(const AVCodecContext* codec_ctx);
+
+#endif // VISAGE_THREADS_H
@@ -4,45 +4,102 @@
 #include <SDL3/SDL_render.h>
 #include <libavcodec/codec.h>
 #include <libavformat/avformat.h>
+#include <stdatomic.h>
 #include <stdint.h>
-#include <pthread.h>
+#include "visage_clock.h"
+#include "visage_frame_cache.h"
+#include "visage_frame_pool.h"
+#include "visage_packet_queue.h"
+#include "visage_threads.h"
 
 struct SwsContext;
 struct AVCodecContext;
 struct AVCodecParameters;
 
+/** Default number of slots in the video frame queue. */
+#define VISAGE_VIDEO_FRAMES 8
+
+/** Number of slots the video frame queue is capped to in low-latency mode. */
+#define VISAGE_VIDEO_LIVE_FRAMES 2
+
+/** Value of finished_serial once the decoding thread has stopped for good. */
+#define VISAGE_VIDEO_STOPPED -2
+
+/** How late in milliseconds a decoded frame may be before it is dropped unconverted. */
+#define VISAGE_VIDEO_LATE_MS 100
+
+/** Milliseconds to wait for events while the frame queue is empty, woken up by frame events. */
+#define VISAGE_VIDEO_IDLE_MS 100
+
+/** Seek mode snapping to the nearest keyframe. */
+#define VISAGE_SEEK_FAST 0
+
+/** Seek mode decoding forward from the previous keyframe up to the exact target. */
+#define VISAGE_SEEK_ACCURATE 1
+
+/** Seek mode playing backwards from the target, one GOP after the other. */
+#define VISAGE_SEEK_BACKWARD 2
+
+/** Default number of frames of a GOP kept while playing backwards. */
+#define VISAGE_VIDEO_GOP_FRAMES 128
+
+/** Speed from which the loop filter of frames no other frame refers to is skipped. */
+#define VISAGE_SPEED_SKIP_FILTER 2.0
+
+/** Speed from which frames no other frame refers to are skipped, and the loop filter of all but keyframes. */
+#define VISAGE_SPEED_SKIP_FRAMES 4.0
+
+/** Refresh rate assumed when the display does not report one. */
+#define VISAGE_VIDEO_REFRESH_RATE 60.0f
+
+/** Number of streaming textures software frames are uploaded to in turn. */
+#define VISAGE_VIDEO_TEXTURES 3
+
+/** Number of steps between no and full size that adaptive scaling picks from. */
+#define VISAGE_VIDEO_SCALE_STEPS 8
+
+struct VisageGpu;
+struct VisageStats;
+
 /**
- * Structure representing a node in the video frame queue.
+ * Structure representing a slot in the video frame queue.
  * 
- * This structure holds decoded video frames in a linked list format, allowing
- * for frame-by-frame playback and synchronized video rendering. Each node
- * contains a single frame of video data, its presentation timestamp, and a
- * pointer to the next frame in the queue.
+ * The frame queue is a fixed-capacity ring of these slots, allocated once
+ * when the video context is initialized. Each slot holds a single frame of
+ * video data and its presentation timestamp while it is queued, and is
+ * reused for later frames once the consumer releases it.
  *
- * The frame data is stored in an AVFrame structure which must be allocated
- * using av_frame_alloc() and freed with av_frame_free(). The frame data
+ * The frame data is stored in an AVFrame structure which is allocated
+ * together with the ring and only unreferenced between uses. The frame data
  * itself is reference counted through the AVBuffer API.
  */
 typedef struct VisageVideoFrames {
     /**
      * Pointer to the actual video frame data.
-     * Contains the decoded video frame in YUV420P format.
-     * Must be allocated with av_frame_alloc() and freed with av_frame_free().
+     * Contains the decoded video frame while queued, in a format listed by
+     * visage_texture_format() or as a hardware surface when zero-copy
+     * presentation is enabled, and is blank while the slot is free.
      */
     AVFrame* frame;
 
     /**
-     * Pointer to the next frame in the queue.
-     * NULL if this is the last frame in the queue.
+     * Presentation timestamp in milliseconds.
+     * Represents when this frame should be displayed relative to the
+     * video start time, compared against the playback clock.
      */
-    struct VisageVideoFrames* next;
+    int64_t pts;
 
     /**
-     * Presentation timestamp in milliseconds.
-     * Represents when this frame should be displayed relative to the
-     * video start time.
+     * Serial of the packets the frame was decoded from.
+     * Frames from before the latest seek are discarded unpresented.
+     */
+    int serial;
+
+    /**
+     * Wall clock time the frame was captured at, in microseconds since the
+     * Unix epoch. AV_NOPTS_VALUE when the source does not report it.
      */
-    uint64_t pts;
+    int64_t captured;
 } VisageVideoFrames;
 
 /**
@@ -57,9 +114,11 @@ typedef struct VisageVideoFrames {
  * with visage_init_video(). When no longer needed, it should be freed using
  * visage_free_video().
  *
- * Thread safety: The frame queue is protected by a mutex to allow concurrent
- * access from decoding and rendering threads. All other fields should only
- * be accessed from a single thread.
+ * Thread safety: The frame queue is a lock-free single-producer,
+ * single-consumer ring. Only the decoding thread may add frames and only
+ * the rendering thread may peek and pop them. The packet queue has its own
+ * lock for the demuxer thread. All other fields should only be accessed
+ * from a single thread.
  */
 typedef struct VisageVideo {
     /**
@@ -82,10 +141,19 @@ typedef struct VisageVideo {
 
     /**
      * Software scaling context for pixel format conversion.
-     * Used to convert decoded frames to YUV420P format.
+     * Only used to convert decoded frames SDL cannot display as they are
+     * to YUV420P format, or to downscale them in adaptive mode, created
+     * when the first such frame arrives.
      */
     struct SwsContext* sws_ctx;
 
+    /**
+     * Pool of picture buffers that frames are converted into.
+     * Sized to the frame queue when the first frame is converted, buffers
+     * return to it when frames are popped.
+     */
+    VisageFramePool* frame_pool;
+
     /**
      * Context for the initialized video codec.
      * Contains the state of the decoder during video processing.
@@ -93,16 +161,330 @@ typedef struct VisageVideo {
     struct AVCodecContext* codec_ctx;
 
     /**
-     * Queue of decoded video frames ready for display.
-     * Protected by frame_mutex for thread-safe access.
+     * Requested hardware acceleration for decoding.
+     * NULL or "auto" probes the devices of the current platform, "none"
+     * disables hardware decoding, and any other value names an FFmpeg
+     * device type such as "vaapi" or "cuda". May be set before
+     * initialization.
+     */
+    const char* hwaccel;
+
+    /**
+     * Set to upload frames at a size picked from the window instead of the
+     * full size of the video. Frames much larger than the window are then
+     * downscaled during conversion, so that the texture upload no longer
+     * carries pixels the renderer throws away. May be set before processing.
+     */
+    int adaptive;
+
+    /**
+     * Size of the window in pixels, which adaptive mode scales frames
+     * down to. Set through visage_resize_video(), 0 while unknown.
+     */
+    atomic_int window_width;
+    atomic_int window_height;
+
+    /**
+     * Size in pixels frames are scaled down to fit into, keeping their
+     * aspect ratio, such as for thumbnails. Unlike adaptive mode the size is
+     * met exactly, scaling with area averaging. 0 leaves that direction
+     * unbounded, and 0 for both keeps the size of the video. May be set
+     * before processing, and takes precedence over adaptive mode.
+     */
+    int fit_width;
+    int fit_height;
+
+    /**
+     * Set to decode keyframes only, with the decoder skipping every other
+     * frame, for extracting stills far faster than full decoding. May be set
+     * before processing.
+     */
+    int keyframes_only;
+
+    /**
+     * Number of decoder threads.
+     * VISAGE_THREADS_AUTO uses one thread per physical core. May be set
+     * before initialization.
+     */
+    int thread_count;
+
+    /**
+     * Threading type of the decoder, FF_THREAD_FRAME or FF_THREAD_SLICE.
+     * VISAGE_THREADS_AUTO picks the type best suited to the codec. May be
+     * set before initialization.
+     */
+    int thread_type;
+
+    /**
+     * Set to trade smoothness for latency, for live sources. The decoder
+     * then outputs frames as soon as possible with AV_CODEC_FLAG_LOW_DELAY
+     * and without frame threading, the frame queue holds at most
+     * VISAGE_VIDEO_LIVE_FRAMES frames, the frame cache is disabled, and the
+     * newest queued frame is presented right away, dropping older ones.
+     * May be set before initialization.
+     */
+    int low_latency;
+
+    /**
+     * Device context used for hardware decoding.
+     * NULL when the video is decoded in software.
+     */
+    AVBufferRef* hw_device_ctx;
+
+    /**
+     * Pixel format of the hardware surfaces output by the decoder.
+     * AV_PIX_FMT_NONE when the video is decoded in software.
+     */
+    enum AVPixelFormat hw_pix_fmt;
+
+    /**
+     * Pool of buffers hardware surfaces are downloaded into.
+     * Reinitialized whenever the surface format or size changes.
+     */
+    VisageFramePool* hw_frame_pool;
+
+    /**
+     * Ring of slots holding decoded video frames ready for display.
+     * Allocated with frames_capacity slots during initialization.
      */
     VisageVideoFrames* frames;
 
     /**
-     * Mutex protecting access to the frames queue.
-     * Must be locked when modifying or accessing the frames field.
+     * Number of slots in the frame queue, always a power of two.
+     * Defaults to VISAGE_VIDEO_FRAMES and may be changed before
+     * initialization, bounding the memory used by decoded frames.
+     */
+    unsigned int frames_capacity;
+
+    /**
+     * Count of frames added to the queue.
+     * Only written by the decoding thread, the slot it writes next is
+     * frames_head modulo the capacity.
      */
-    pthread_mutex_t frame_mutex;
+    atomic_uint frames_head;
+
+    /**
+     * Count of frames removed from the queue.
+     * Only written by the rendering thread, the slot it reads next is
+     * frames_tail modulo the capacity.
+     */
+    atomic_uint frames_tail;
+
+    /**
+     * Set when hardware frames are queued as they are instead of downloaded.
+     * Enabled by visage_init_gpu() when the renderer can present hardware
+     * surfaces directly, and cleared by the rendering thread if importing a
+     * surface fails, so that later frames are downloaded again.
+     */
+    atomic_int zero_copy;
+
+    /**
+     * Queue of demuxed packets waiting to be decoded.
+     * Filled by the demuxer thread and drained by visage_process_video().
+     */
+    VisagePacketQueue* packets;
+
+    /**
+     * Playback clock the frames are presented against.
+     * Owned by the caller, usually driven by the audio context. Must be
+     * set before processing.
+     */
+    VisageClock* clock;
+
+    /**
+     * Wall clock time the start of the stream was captured at, in
+     * microseconds since the Unix epoch, or AV_NOPTS_VALUE while unknown.
+     * Published by the demuxer from the format context for sources that
+     * report it, such as RTSP through its RTCP sender reports, and used to
+     * tag frames with their capture time.
+     */
+    atomic_llong realtime_start;
+
+    /**
+     * Number of frames dropped for being late, by the decoder before
+     * conversion or by visage_display_frame() before upload.
+     */
+    atomic_uint frames_dropped;
+
+    /**
+     * Context turning hardware frames into textures.
+     * Set by visage_init_gpu() when zero-copy presentation is available,
+     * NULL otherwise. Only used by the rendering thread.
+     */
+    struct VisageGpu* gpu;
+
+    /**
+     * Statistics the decoding and rendering threads record into, and the
+     * demuxer feeding this context. NULL to record nothing. Owned by the
+     * caller, may be set before processing.
+     */
+    struct VisageStats* stats;
+
+    /**
+     * Refresh interval of the display in microseconds, 0 without vsync.
+     * Computed by the first visage_display_frame() call, and recomputed
+     * after it is set back to -1, e.g. when the window changes displays.
+     * Only used by the rendering thread.
+     */
+    int64_t refresh_interval;
+
+    /**
+     * Streaming textures software frames are uploaded to, one after the
+     * other, so that writing the next frame does not wait for the GPU to
+     * finish drawing the previous ones. Created to match the frames by
+     * visage_upload_video(), only used by the rendering thread.
+     */
+    SDL_Texture* textures[VISAGE_VIDEO_TEXTURES];
+
+    /**
+     * Index of the texture the next software frame is uploaded to.
+     */
+    int texture_idx;
+
+    /**
+     * Texture showing the last presented frame, presented again on vblanks
+     * without a new frame. Only used by the rendering thread.
+     */
+    SDL_Texture* shown_texture;
+
+    /**
+     * Set by the rendering thread when the window needs to be drawn again,
+     * such as after a resize, even if no new frame is due.
+     */
+    int redraw;
+
+    /**
+     * SDL event type pushed when a frame is added to an empty queue and
+     * when processing finishes, waking up a rendering thread waiting in
+     * SDL_WaitEventTimeout(). 0 to push no events. May be set before
+     * processing.
+     */
+    Uint32 frame_event;
+
+    /**
+     * Serial of the packets visage_process_video() has decoded the last
+     * frame of, -1 before that, or VISAGE_VIDEO_STOPPED once it returned.
+     * Lets the rendering thread tell an empty queue from the end of the
+     * video through visage_video_finished().
+     */
+    atomic_int finished_serial;
+
+    /**
+     * Serial of the packets being decoded.
+     * Only used by the decoding thread.
+     */
+    int serial;
+
+    /**
+     * Set by visage_seek_video() and cleared by the demuxer once the seek
+     * has been carried out.
+     */
+    atomic_int seek_request;
+
+    /**
+     * Target of the requested seek, in milliseconds.
+     */
+    atomic_llong seek_target;
+
+    /**
+     * Mode of the requested seek, VISAGE_SEEK_FAST, VISAGE_SEEK_ACCURATE or
+     * VISAGE_SEEK_BACKWARD.
+     */
+    atomic_int seek_mode;
+
+    /**
+     * Target of the last accurate seek in milliseconds, INT64_MIN after a
+     * fast seek. Frames before it are decoded but neither converted nor
+     * queued. Set by the demuxer before flushing the packet queue.
+     */
+    atomic_llong seek_pts;
+
+    /**
+     * Set while the packets since the latest seek are GOPs in reverse order,
+     * which the decoder turns into frames queued latest first. Set by the
+     * demuxer before flushing the packet queue, together with resume_pts,
+     * the target of the seek in milliseconds.
+     */
+    atomic_int reverse;
+    atomic_llong resume_pts;
+
+    /**
+     * Frames of the GOP being decoded backwards, in presentation order and
+     * ready to upload. Queued latest first once the GOP is complete, and
+     * handed out one by one as the frame queue drains, so that stepping back
+     * frame by frame decodes each GOP only once. Holds gop_count of
+     * gop_capacity slots, allocated during initialization. Only used by the
+     * decoding thread.
+     */
+    VisageVideoFrames* gop;
+    unsigned int gop_count;
+
+    /**
+     * Number of frames of a GOP kept while playing backwards. Defaults to
+     * VISAGE_VIDEO_GOP_FRAMES and may be changed before initialization,
+     * bounding the memory used in reverse. Only the latest frames of longer
+     * GOPs are played.
+     */
+    unsigned int gop_capacity;
+
+    /**
+     * Presentation time of the keyframe starting the GOP being decoded, and
+     * time from which frames are not queued anymore because they have been
+     * already, both in milliseconds. Only used by the decoding thread.
+     */
+    int64_t gop_start;
+    int64_t gop_end;
+
+    /**
+     * Value of reverse for the serial being decoded.
+     * Only used by the decoding thread.
+     */
+    int reversing;
+
+    /**
+     * Cache of the frames queued lately, so that a seek back into them
+     * presents them right away instead of waiting for the decoder to get
+     * there again. NULL when disabled. Only used by the decoding thread.
+     */
+    VisageFrameCache* cache;
+
+    /**
+     * Memory budget of the frame cache in bytes, 0 to disable it. Defaults
+     * to VISAGE_FRAME_CACHE_SIZE and may be changed before initialization.
+     */
+    int64_t cache_size;
+
+    /**
+     * Timestamp of the next cached frame to queue after a seek, INT64_MIN
+     * when the decoder is not behind the cache, and of the last one queued,
+     * up to which decoded frames are dropped unconverted. Both in
+     * milliseconds, only used by the decoding thread.
+     */
+    int64_t cache_next;
+    int64_t cache_pts;
+
+    /**
+     * Set when processing is aborted.
+     * Stops a decoding thread waiting for a free slot in the frame queue.
+     */
+    atomic_int abort;
+
+    /**
+     * Set while nobody watches the video, such as a tile outside of the
+     * window. As when fast forwarding at VISAGE_SPEED_SKIP_FRAMES, the
+     * decoder then skips frames no other frame refers to, and
+     * visage_update_video() keeps up with the clock without uploading.
+     * May be changed from any thread.
+     */
+    atomic_int hidden;
+
+    /**
+     * Packet and frames visage_step_video() decodes into, allocated by
+     * its first call. Only used by the task decoding the video.
+     */
+    AVPacket* task_packet;
+    AVFrame* task_frame;
+    AVFrame* task_sw_frame;
 
     /**
      * Index of the video stream in the format context.
@@ -112,40 +494,31 @@ typedef struct VisageVideo {
 } VisageVideo;
 
 /**
- * Allocates a new video frame queue node.
- *
- * The allocated node has all fields initialized to NULL/0. The caller is
- * responsible for setting the frame data and linking it into the queue.
- *
- * @return Newly allocated VisageVideoFrames node, or NULL on allocation failure
- */
-VisageVideoFrames* visage_alloc_frames();
-
-/**
- * Frees a single video frame queue node.
+ * Allocates the slots of a video frame queue.
  *
- * This function frees both the frame data (using av_frame_free) and the
- * node structure itself. Does not affect other nodes in the queue.
+ * Every slot gets a blank AVFrame, so that queueing frames later on does
+ * not need any further allocation.
  *
- * @param frames Node to free, must not be NULL
+ * @param capacity Number of slots to allocate
+ * @return Newly allocated array of slots, or NULL on allocation failure
  */
-void visage_free_frames(VisageVideoFrames* frames);
+VisageVideoFrames* visage_alloc_frames(unsigned int capacity);
 
 /**
- * Frees an entire queue of video frames.
+ * Frees the slots of a video frame queue and any frames still held in them.
  *
- * Traverses the linked list starting at the given node and frees all
- * subsequent nodes and their associated frame data.
- *
- * @param frames First node in the queue to free, can be NULL
+ * @param frames Pointer to the array of slots, will be set to NULL
+ * @param capacity Number of slots in the array
  */
-void visage_free_all_frames(VisageVideoFrames* frames);
+void visage_free_frames(VisageVideoFrames** frames, unsigned int capacity);
 
 /**
  * Allocates and initializes a new video context.
  *
  * The allocated context has all fields initialized to NULL/0 except for
- * the frame mutex which is initialized for immediate use.
+ * the frame queue and GOP capacities and the frame cache budget, which are
+ * set to VISAGE_VIDEO_FRAMES, VISAGE_VIDEO_GOP_FRAMES and
+ * VISAGE_FRAME_CACHE_SIZE.
  *
  * @return Newly allocated VisageVideo context, or NULL on allocation failure
  */
@@ -156,9 +529,16 @@ VisageVideo* visage_alloc_video();
  *
  * This function:
  * - Locates the video stream in the format context
- * - Sets up the appropriate decoder
- * - Initializes scaling context for YUV420P conversion
- * - Prepares the context for frame processing
+ * - Sets up the appropriate decoder, with hardware acceleration if requested
+ *   and available, falling back to software decoding otherwise
+ * - Configures the decoder threads as requested, printing the effective
+ *   thread count and type
+ * - Allocates the packet queue fed by the demuxer
+ * - Allocates the frame queue, rounding its capacity up to a power of two,
+ *   and the slots of the GOP cache for playing backwards
+ * - Allocates the frame cache unless its budget is 0 or in low-latency mode
+ * - Allocates the pool of buffers converted frames are stored in, which is
+ *   only filled if the decoder outputs a format SDL cannot display
  *
  * @param format_ctx Opened format context containing the video stream
  * @param video Video context to initialize
@@ -170,9 +550,9 @@ int visage_init_video(AVFormatContext* format_ctx, VisageVideo* video);
  * Frees all resources associated with a video context.
  *
  * This function:
- * - Frees all decoded frames in the queue
- * - Releases codec contexts and scaling contexts
- * - Destroys the frame mutex
+ * - Frees all decoded frames in the queue, the GOP cache and the frame cache
+ * - Frees all packets still waiting to be decoded
+ * - Releases codec contexts, hardware devices and scaling contexts
  * - Frees the video context structure itself
  *
  * @param video Pointer to the video context pointer, will be set to NULL
@@ -180,28 +560,190 @@ int visage_init_video(AVFormatContext* format_ctx, VisageVideo* video);
 void visage_free_video(VisageVideo** video);
 
 /**
- * Removes and returns the next frame from the video queue.
+ * Stops video processing, waking up a decoding thread blocked on packets
+ * or on a full frame queue.
+ *
+ * @param video Video context to abort
+ */
+void visage_abort_video(VisageVideo* video);
+
+/**
+ * Borrows the oldest frame in the video queue without removing it.
+ *
+ * The returned slot stays valid and unchanged until visage_pop_video() is
+ * called, so the frame can be uploaded without cloning it first. Must only
+ * be called from the rendering thread.
+ *
+ * @param video Video context containing the frame queue
+ * @return Oldest slot in the queue, or NULL if queue is empty
+ */
+VisageVideoFrames* visage_peek_video(VisageVideo* video);
+
+/**
+ * Removes the oldest frame from the video queue.
+ *
+ * Releases the frame held by the slot returned from visage_peek_video(),
+ * returning its picture buffer to the frame pool, and hands the slot back
+ * to the decoding thread. Must only be called from the
+ * rendering thread, and only when the queue is not empty.
+ *
+ * @param video Video context containing the frame queue
+ */
+void visage_pop_video(VisageVideo* video);
+
+/**
+ * Borrows the queued frame that is due a given time from now.
  *
- * This function is thread-safe and will lock the frame mutex while
- * accessing the queue. The returned frame must be freed by the caller
- * using av_frame_free().
+ * Picks the frame like visage_display_frame() does, dropping the frames it
+ * replaces, but leaves it in the queue for the caller to pop, for callers
+ * that present frames without a renderer. Must only be called from the
+ * rendering thread.
  *
  * @param video Video context containing the frame queue
- * @return Copy of the next frame in the queue, or NULL if queue is empty
+ * @param ahead Milliseconds from now the frame will be presented
+ * @param delay Set to the milliseconds until the next frame is due, 0 when
+ *        it is unknown
+ * @return Slot of the due frame, or NULL if none is due yet
  */
-AVFrame* visage_pop_video(VisageVideo* video);
+VisageVideoFrames* visage_due_video(VisageVideo* video, int64_t ahead, int64_t* delay);
+
+/**
+ * Requests a seek, carried out asynchronously by the demuxer thread.
+ *
+ * In VISAGE_SEEK_FAST mode, playback resumes at the keyframe nearest to the
+ * target, using the keyframe index built while demuxing when it covers the
+ * target. In VISAGE_SEEK_ACCURATE mode, playback resumes at the target
+ * itself: decoding starts at the previous keyframe and frames before the
+ * target are skipped without being converted or uploaded.
+ *
+ * In VISAGE_SEEK_BACKWARD mode, playback goes backwards from the target,
+ * for a clock with a negative or zero speed: the demuxer reads one GOP
+ * after the other towards the start of the file, and the decoder queues
+ * the frames of each one from the latest to the earliest. Any other mode
+ * plays forwards again.
+ *
+ * A later request replaces one that has not been carried out yet.
+ *
+ * @param video Initialized video context
+ * @param target Target presentation time in milliseconds
+ * @param mode VISAGE_SEEK_FAST, VISAGE_SEEK_ACCURATE or VISAGE_SEEK_BACKWARD
+ */
+void visage_seek_video(VisageVideo* video, int64_t target, int mode);
+
+/**
+ * Makes the next queued frame due, for stepping frame by frame while the
+ * clock is paused. Frames come in the direction of playback, so stepping
+ * backwards needs a VISAGE_SEEK_BACKWARD seek first. Must only be called
+ * from the rendering thread.
+ *
+ * @param video Initialized video context
+ * @return 1 if the clock was moved to the next frame, 0 if none is queued yet
+ */
+int visage_next_frame(VisageVideo* video);
+
+/**
+ * Tells the decoder the size in pixels of the window the video is shown in.
+ *
+ * In adaptive mode, frames decoded from then on are scaled down to the
+ * smallest of VISAGE_VIDEO_SCALE_STEPS fractions of the video size that
+ * still covers the window, so that resizing the window only changes the
+ * upload size once a step is crossed.
+ *
+ * @param video Video context
+ * @param width Width of the window in pixels
+ * @param height Height of the window in pixels
+ */
+void visage_resize_video(VisageVideo* video, int width, int height);
+
+/**
+ * Returns the current playback position, for seeking relative to it.
+ *
+ * @param video Initialized video context
+ * @return Target of a pending seek if there is one, the playback clock
+ *         otherwise, in milliseconds
+ */
+int64_t visage_video_position(VisageVideo* video);
+
+/**
+ * Returns whether the whole video has been presented.
+ *
+ * @param video Initialized video context
+ * @return 1 if the decoder has drained the stream since the latest seek, or
+ *         has stopped, and the frame queue is empty, 0 otherwise
+ */
+int visage_video_finished(VisageVideo* video);
+
+/**
+ * Returns the number of frames currently in the video queue.
+ *
+ * @param video Video context containing the frame queue
+ * @return Number of queued frames
+ */
+unsigned int visage_count_video(VisageVideo* video);
+
+/**
+ * Returns the SDL texture format with the same memory layout as a pixel format.
+ *
+ * Frames in these formats are uploaded to textures plane by plane without
+ * any conversion: YUV420P as IYUV, NV12, NV21 and P010.
+ *
+ * @param format Pixel format of a decoded frame
+ * @return Matching texture format, or SDL_PIXELFORMAT_UNKNOWN if the frame
+ *         must be converted first
+ */
+SDL_PixelFormat visage_texture_format(enum AVPixelFormat format);
+
+/**
+ * Uploads a queued software frame to a texture.
+ *
+ * The texture is (re)created with the format, size and colorspace of the
+ * frame whenever the current one does not match, so it may be NULL on the
+ * first call. The planes are copied straight into the memory returned by
+ * SDL_LockTexture(), at the pitch of the texture, which avoids staging the
+ * upload in a buffer of its own.
+ *
+ * @param renderer Renderer the texture belongs to
+ * @param texture Pointer to the texture, replaced when recreated
+ * @param frame Frame taken from the video queue
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_upload_video(SDL_Renderer* renderer, SDL_Texture** texture, const AVFrame* frame);
+
+/**
+ * Returns the SDL colorspace matching the color properties of a frame.
+ *
+ * @param frame Decoded frame
+ * @return Colorspace to create textures showing the frame with
+ */
+SDL_Colorspace visage_video_colorspace(const AVFrame* frame);
 
 /**
  * Processes the video stream and fills the frame queue.
  *
  * This function:
- * - Reads packets from the video stream
- * - Decodes them into raw frames
- * - Converts frames to YUV420P format
- * - Adds them to the frame queue in a thread-safe manner
+ * - Takes packets from the packet queue filled by the demuxer
+ * - Decodes them into raw frames, dropping frames already late on the
+ *   playback clock by more than VISAGE_VIDEO_LATE_MS unless in low-latency
+ *   mode, and skipping frames
+ *   and loop filtering as set out by VISAGE_SPEED_SKIP_FILTER and
+ *   VISAGE_SPEED_SKIP_FRAMES while fast forwarding
+ * - Downloads hardware surfaces unless
+ *   zero-copy presentation is enabled
+ * - Queues frames SDL can display as they are by reference
+ * - Converts other frames to YUV420P format into buffers from the frame pool
+ * - Adds them to the frame queue, waiting while it is full
  *
  * The frames are added to the queue with proper PTS values for
- * synchronized playback.
+ * synchronized playback, tagged with the serial of their packets. When the
+ * serial changes after a seek, the decoder is flushed first. Once the stream
+ * has been drained, the finished serial is set and the function waits for
+ * a seek. When playing backwards, the frames of every GOP are collected in
+ * the GOP cache and queued latest first once the keyframe of the GOP before
+ * arrives. Queued frames are kept in the frame cache, and when a seek lands
+ * in a run of cached frames, those are queued straight away while the
+ * decoder catches up, dropping what it decodes of them unconverted. It is
+ * meant to run on its own decoding thread and returns when
+ * the packet queue is aborted or decoding fails.
  *
  * @param video Initialized video context
  * @return 0 on success, -1 on error with error message printed to stdout
@@ -209,25 +751,72 @@ AVFrame* visage_pop_video(VisageVideo* video);
 int visage_process_video(VisageVideo *video);
 
 /**
- * Displays the next frame from the video queue using SDL.
+ * Decodes the next packet of the queue, as a task of a worker pool.
  *
- * This function:
- * - Retrieves the next frame from the video queue
- * - Updates the SDL texture with the YUV data from the frame
- * - Renders the updated texture to the window
+ * Does the same as one round of the loop of visage_process_video(), but
+ * returns instead of blocking when there is no packet to decode or no room
+ * in the frame queue, so that one pool of threads can take turns decoding
+ * many videos. Calls for the same video must not overlap.
+ *
+ * @param video Initialized video context
+ * @return 1 if a packet was decoded, 0 if there was nothing to do for now,
+ *         -1 once the video is aborted or decoding failed
+ */
+int visage_step_video(VisageVideo* video);
+
+/**
+ * Returns the refresh interval of the display the renderer presents to.
+ *
+ * @param renderer SDL renderer context for the window
+ * @return Refresh interval in microseconds, or 0 without vsync
+ */
+int64_t visage_refresh_interval(SDL_Renderer* renderer);
+
+/**
+ * Uploads the queued frame that is due a given time from now.
  *
- * The function expects the video frames to be in YUV420P format, which is
- * ensured by the video processing pipeline. The frame data is automatically
- * freed after being copied to the texture.
+ * Picks the frame like visage_display_frame() does and turns it into the
+ * shown texture, without drawing or presenting anything, for callers that
+ * draw several videos into one window. Hidden videos only drop the frames
+ * that are due. Must only be called from the rendering thread.
  *
  * @param renderer SDL renderer context for the window
- * @param texture SDL texture configured for YUV rendering
  * @param video Video context containing the frame queue
- * @return 0 on success, -1 if no frames are available
+ * @param ahead Milliseconds from now the frame will show up on the display
+ * @param delay Set to the milliseconds until the next frame is due, 0 when
+ *        it is unknown
+ * @return 1 if a new frame was uploaded, 0 otherwise
+ */
+int visage_update_video(SDL_Renderer* renderer, VisageVideo* video, int64_t ahead,
+                        int64_t* delay);
+
+/**
+ * Presents the frame of the video queue that is due at the next vblank.
+ *
+ * This function:
+ * - Picks the newest queued frame whose PTS is due on the playback clock by
+ *   the time the next vblank shows it, dropping older frames unuploaded,
+ *   where due means at or after the clock while playing backwards, or the
+ *   newest queued frame whatever the clock in low-latency mode
+ * - Uploads it to the next of the video's textures, or imports it when it
+ *   is a hardware surface
+ * - Presents it, or presents the previous frame again when no new frame is
+ *   due yet, so that with vsync the renderer presents exactly once per
+ *   vblank and frame rates are converted by repeating and skipping frames
+ *   (such as the 3:2 cadence of 24p on 60Hz)
  *
- * @note The SDL texture must be created with the same dimensions as the video
- *       frames and with the SDL_PIXELFORMAT_YV12 or SDL_PIXELFORMAT_IYUV format.
+ * With vsync enabled through SDL_SetRenderVSync(), SDL_RenderPresent() paces
+ * the calls to the refresh rate of the display. Without vsync, nothing is
+ * presented until the next frame is due or the redraw flag is set, and the
+ * caller is told how long to wait instead, which is meant to be spent in
+ * SDL_WaitEventTimeout(). If the clock has not been started yet, the oldest frame
+ * starts it. Must only be called from the rendering thread.
+ *
+ * @param renderer SDL renderer context for the window
+ * @param video Video context containing the frame queue
+ * @return Milliseconds the caller may wait before calling again, 0 when
+ *         presentation is paced by vsync or a frame is ready
  */
-int visage_display_frame(SDL_Renderer* renderer, SDL_Texture* texture, VisageVideo* video);
+int visage_display_frame(SDL_Renderer* renderer, VisageVideo* video);
 
 #endif // VISAGE_VIDEO_H
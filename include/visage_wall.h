@@ -0,0 +1,232 @@
+#ifndef VISAGE_WALL_H
+#define VISAGE_WALL_H
+
+#include <SDL3/SDL_events.h>
+#include <SDL3/SDL_rect.h>
+#include <SDL3/SDL_render.h>
+#include <libavformat/avformat.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "visage_clock.h"
+#include "visage_demux.h"
+#include "visage_gpu.h"
+#include "visage_video.h"
+#include "visage_workers.h"
+
+/**
+ * Structure representing one video of a wall and the contexts playing it.
+ */
+typedef struct VisageTile {
+    /**
+     * Format context of the opened file.
+     */
+    AVFormatContext* format_ctx;
+
+    /**
+     * Video context decoding the file, as a task of the worker pool.
+     */
+    VisageVideo* video;
+
+    /**
+     * Clock of the tile, started by its first frame.
+     */
+    VisageClock* clock;
+
+    /**
+     * Demuxer feeding the video context, on a thread of its own.
+     */
+    VisageDemuxer* demuxer;
+
+    /**
+     * Context presenting the hardware frames of the tile.
+     */
+    VisageGpu* gpu;
+
+    /**
+     * Task decoding the video, owned by the worker pool.
+     */
+    VisageTask* task;
+
+    /**
+     * Thread running the demuxer, valid once demux_started is set.
+     */
+    pthread_t demux_thread;
+    int demux_started;
+
+    /**
+     * Area of the window the tile is drawn in, in pixels. Empty while the
+     * tile is off-screen.
+     */
+    SDL_FRect rect;
+} VisageTile;
+
+/**
+ * Structure for playing several videos at once, tiled into one window.
+ *
+ * The videos are laid out in a grid that keeps the window as full as
+ * possible, each one scaled to fit its tile. Every video has its own
+ * demuxer thread and clock, but their decoding is shared by one pool of
+ * worker threads, one per physical core, instead of each video running a
+ * decoding thread with a full set of decoder threads. The audio of the
+ * videos is not played.
+ *
+ * One tile can be focused to fill the window, which moves the other tiles
+ * off-screen. Off-screen tiles, and all of them while the window is
+ * minimized, are hidden: their decoding gets low priority in the pool and
+ * skips frames no other frame refers to, and their frames are not
+ * uploaded, so that the watched videos get the cores. The tiles keep no
+ * frame cache, which would multiply its memory by the number of videos.
+ *
+ * The structure must be allocated using visage_alloc_wall() and initialized
+ * with visage_init_wall(). When no longer needed, it should be freed using
+ * visage_free_wall().
+ *
+ * Thread safety: must only be used from the rendering thread.
+ */
+typedef struct VisageWall {
+    /**
+     * Tiles of the videos, in the order of the files.
+     */
+    VisageTile* tiles;
+
+    /**
+     * Number of tiles.
+     */
+    int nb_tiles;
+
+    /**
+     * Pool of threads decoding all the videos.
+     */
+    VisageWorkers* workers;
+
+    /**
+     * Hardware acceleration, decoder threads, decoder threading type and
+     * adaptive mode of the video contexts, as in VisageVideo. With
+     * VISAGE_THREADS_AUTO the physical cores are shared out between the
+     * decoders. May be set before initialization.
+     */
+    const char* hwaccel;
+    int thread_count;
+    int thread_type;
+    int adaptive;
+
+    /**
+     * Set to present hardware frames without downloading them when the
+     * renderer supports it. May be set before initialization.
+     */
+    int zero_copy;
+
+    /**
+     * SDL event type the video contexts wake the rendering thread up with,
+     * 0 for none. May be set before initialization.
+     */
+    Uint32 frame_event;
+
+    /**
+     * Index of the tile filling the window, -1 to show the grid.
+     */
+    int focus;
+
+    /**
+     * Set while the window is minimized or fully covered.
+     */
+    int minimized;
+
+    /**
+     * Size of the window in pixels, as passed to visage_layout_wall().
+     */
+    int width;
+    int height;
+
+    /**
+     * Refresh interval of the display in microseconds, 0 without vsync,
+     * -1 to compute it on the next visage_display_wall() call.
+     */
+    int64_t refresh_interval;
+
+    /**
+     * Set when the window needs to be drawn again even if no frame is due.
+     */
+    int redraw;
+} VisageWall;
+
+/**
+ * Allocates a new, empty wall.
+ *
+ * @return Newly allocated VisageWall, or NULL on allocation failure
+ */
+VisageWall* visage_alloc_wall();
+
+/**
+ * Opens the files and starts playing them.
+ *
+ * Each file gets a tile with its own video context, clock and demuxer
+ * thread, and a task decoding it on the shared worker pool. Call
+ * visage_layout_wall() afterwards to place the tiles.
+ *
+ * @param renderer Renderer the tiles are drawn with
+ * @param files Paths or URLs of the videos
+ * @param nb_files Number of files, at most VISAGE_WORKERS_MAX_TASKS
+ * @param wall Wall to initialize
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_init_wall(SDL_Renderer* renderer, char** files, int nb_files, VisageWall* wall);
+
+/**
+ * Places the tiles in a window of the given size.
+ *
+ * @param wall Initialized wall
+ * @param width Width of the window in pixels
+ * @param height Height of the window in pixels
+ */
+void visage_layout_wall(VisageWall* wall, int width, int height);
+
+/**
+ * Focuses the tile at a point of the window, or goes back to the grid if a
+ * tile is focused already.
+ *
+ * @param wall Initialized wall
+ * @param x Horizontal position in pixels
+ * @param y Vertical position in pixels
+ */
+void visage_focus_wall(VisageWall* wall, float x, float y);
+
+/**
+ * Hides all tiles while the window cannot be seen, or shows them again.
+ *
+ * @param wall Initialized wall
+ * @param minimized 1 if the window is minimized or covered, 0 otherwise
+ */
+void visage_minimize_wall(VisageWall* wall, int minimized);
+
+/**
+ * Uploads the frames of all tiles that are due at the next vblank and
+ * presents them.
+ *
+ * Behaves like visage_display_frame() for the whole window: with vsync
+ * the window is presented once per vblank, without it only when a frame
+ * is due. Nothing is presented while the window is minimized.
+ *
+ * @param renderer Renderer the tiles are drawn with
+ * @param wall Initialized wall
+ * @return Milliseconds the caller may wait before calling again, 0 when
+ *         presentation is paced by vsync or a frame is ready
+ */
+int visage_display_wall(SDL_Renderer* renderer, VisageWall* wall);
+
+/**
+ * Returns whether every video of the wall has been presented.
+ *
+ * @param wall Initialized wall
+ * @return 1 if all videos have finished, 0 otherwise
+ */
+int visage_wall_finished(VisageWall* wall);
+
+/**
+ * Stops playback and frees the wall with all its tiles.
+ *
+ * @param wall Pointer to the wall pointer, will be set to NULL
+ */
+void visage_free_wall(VisageWall** wall);
+
+#endif // VISAGE_WALL_H
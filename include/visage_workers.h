@@ -0,0 +1,243 @@
+#ifndef VISAGE_WORKERS_H
+#define VISAGE_WORKERS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/** Priority of tasks whose output is being watched. */
+#define VISAGE_PRIORITY_HIGH 0
+
+/** Priority of tasks only run when no high priority task is waiting. */
+#define VISAGE_PRIORITY_LOW 1
+
+/** Number of task priorities. */
+#define VISAGE_PRIORITIES 2
+
+/** Largest number of tasks a pool can run. */
+#define VISAGE_WORKERS_MAX_TASKS 64
+
+/** Microseconds a task that had nothing to do waits before it is run again. */
+#define VISAGE_WORKERS_IDLE_US 1000
+
+/**
+ * Function run by a task, doing a bounded amount of work each time.
+ *
+ * @param arg Argument given when the task was added
+ * @return 1 if there may be more work right away, 0 if there was nothing to
+ *         do for now, -1 once the task is done for good
+ */
+typedef int (*VisageTaskFunc)(void* arg);
+
+/**
+ * Structure representing a task of a worker pool, such as the decoding of
+ * one stream.
+ *
+ * A task is run by a single worker at a time, over and over until it is
+ * done, so whatever it works on needs no locking between two runs even
+ * though the worker running it may change.
+ */
+typedef struct VisageTask {
+    /**
+     * Function doing the work of the task.
+     */
+    VisageTaskFunc run;
+
+    /**
+     * Argument passed to the function.
+     */
+    void* arg;
+
+    /**
+     * VISAGE_PRIORITY_HIGH or VISAGE_PRIORITY_LOW. May be changed from any
+     * thread, and takes effect the next time the task is queued.
+     */
+    atomic_int priority;
+
+    /**
+     * System time in microseconds a parked task is queued again at.
+     * Guarded by the pool mutex while the task is parked.
+     */
+    int64_t wake_time;
+} VisageTask;
+
+/**
+ * Structure representing one thread of a worker pool and the tasks queued
+ * on it.
+ *
+ * Each priority has its own ring of queued tasks. The worker takes tasks
+ * from the front of its own rings and puts them back at the end after
+ * running them, so the tasks it runs stay on its core. Idle workers steal
+ * tasks from the end of the rings of other workers.
+ */
+typedef struct VisageWorker {
+    /**
+     * Pool the worker belongs to.
+     */
+    struct VisageWorkers* workers;
+
+    /**
+     * Index of the worker in the pool.
+     */
+    int idx;
+
+    /**
+     * Thread running the worker.
+     */
+    pthread_t thread;
+
+    /**
+     * Rings of queued tasks, one per priority.
+     */
+    VisageTask* queues[VISAGE_PRIORITIES][VISAGE_WORKERS_MAX_TASKS];
+
+    /**
+     * Count of tasks taken from and added to each ring.
+     */
+    unsigned int heads[VISAGE_PRIORITIES];
+    unsigned int tails[VISAGE_PRIORITIES];
+
+    /**
+     * Mutex protecting the rings, taken by the worker and by thieves.
+     */
+    pthread_mutex_t mutex;
+} VisageWorker;
+
+/**
+ * Pool of worker threads sharing the decoding of several streams.
+ *
+ * Instead of a decoding thread per stream, each stream adds a task that
+ * decodes a packet per run. The worker threads run the tasks in turn, one
+ * thread per physical core, preferring high priority tasks over low
+ * priority ones, so that streams nobody is watching only get the time the
+ * watched streams leave over.
+ *
+ * Tasks that have nothing to do are parked for VISAGE_WORKERS_IDLE_US
+ * before they are queued again, and workers without tasks sleep until one
+ * is queued or a parked task is due.
+ *
+ * The structure must be allocated using visage_alloc_workers(), and
+ * started with visage_init_workers(). When no longer needed, it should be
+ * freed using visage_free_workers().
+ *
+ * Thread safety: visage_add_task() and visage_set_task_priority() may be
+ * called from any thread, the other functions only from the thread owning
+ * the pool.
+ */
+typedef struct VisageWorkers {
+    /**
+     * Worker threads.
+     */
+    VisageWorker* workers;
+
+    /**
+     * Number of worker threads.
+     */
+    int nb_workers;
+
+    /**
+     * Number of worker threads running, until they are joined.
+     */
+    int nb_started;
+
+    /**
+     * Tasks added to the pool, owned by it.
+     */
+    VisageTask* tasks[VISAGE_WORKERS_MAX_TASKS];
+
+    /**
+     * Number of tasks added to the pool.
+     */
+    int nb_tasks;
+
+    /**
+     * Tasks waiting for their wake time, guarded by the mutex.
+     */
+    VisageTask* parked[VISAGE_WORKERS_MAX_TASKS];
+
+    /**
+     * Number of parked tasks.
+     */
+    int nb_parked;
+
+    /**
+     * System time in microseconds the earliest parked task is due at,
+     * INT64_MAX without parked tasks. Lets workers skip the mutex while
+     * no parked task is due.
+     */
+    atomic_llong next_wake;
+
+    /**
+     * Number of tasks in the rings of all workers.
+     */
+    atomic_int nb_queued;
+
+    /**
+     * Mutex protecting the tasks and the parked tasks.
+     */
+    pthread_mutex_t mutex;
+
+    /**
+     * Condition idle workers wait on for tasks to be queued.
+     */
+    pthread_cond_t cond;
+
+    /**
+     * Set to stop the workers.
+     */
+    atomic_int abort;
+} VisageWorkers;
+
+/**
+ * Allocates a new worker pool without any threads.
+ *
+ * @return Newly allocated VisageWorkers, or NULL on allocation failure
+ */
+VisageWorkers* visage_alloc_workers();
+
+/**
+ * Starts the worker threads.
+ *
+ * @param workers Allocated worker pool
+ * @param count Number of threads, 0 for one per physical core
+ * @return 0 on success, -1 on error with error message printed to stdout
+ */
+int visage_init_workers(VisageWorkers* workers, int count);
+
+/**
+ * Adds a task, which is run until it reports that it is done.
+ *
+ * @param workers Started worker pool
+ * @param run Function doing the work of the task
+ * @param arg Argument passed to the function
+ * @param priority VISAGE_PRIORITY_HIGH or VISAGE_PRIORITY_LOW
+ * @return Task owned by the pool, or NULL on error with error message
+ *         printed to stdout
+ */
+VisageTask* visage_add_task(VisageWorkers* workers, VisageTaskFunc run, void* arg, int priority);
+
+/**
+ * Changes the priority of a task.
+ *
+ * @param task Task of a pool
+ * @param priority VISAGE_PRIORITY_HIGH or VISAGE_PRIORITY_LOW
+ */
+void visage_set_task_priority(VisageTask* task, int priority);
+
+/**
+ * Stops the worker threads and waits for the tasks they are running to
+ * return. Tasks that are not done are not run again.
+ *
+ * @param workers Worker pool to stop
+ */
+void visage_abort_workers(VisageWorkers* workers);
+
+/**
+ * Stops the worker threads if they are still running, and frees the pool
+ * and its tasks.
+ *
+ * @param workers Pointer to the worker pool pointer, will be set to NULL
+ */
+void visage_free_workers(VisageWorkers** workers);
+
+#endif // VISAGE_WORKERS_H
@@ -0,0 +1,71 @@
+#include <libavutil/macros.h>
+#include <libavutil/mem.h>
+#include <stdio.h>
+#include "visage_arena.h"
+
+/** Alignment of every object in bytes. */
+#define VISAGE_ARENA_ALIGN 16
+
+/** Allocates the arena. Returns NULL on failure. */
+VisageArena* visage_alloc_arena() {
+  VisageArena* arena = av_mallocz(sizeof(VisageArena));
+  if (!arena) return NULL;
+
+  // initialize properties to empty
+  arena->object_size = 0;
+  arena->chunk_objects = 0;
+  arena->chunks = NULL;
+  arena->nb_chunks = 0;
+  arena->chunks_capacity = 0;
+  arena->chunk_used = 0;
+
+  return arena;
+}
+
+/** Initializes the arena for objects of the size. Outputs 0 on success, -1 on error. */
+int visage_init_arena(VisageArena* arena, size_t object_size, int chunk_objects) {
+  if (object_size == 0 || chunk_objects < 0) {
+    printf("Error: invalid arena object size or count\n");
+    return -1;
+  }
+  arena->object_size = FFALIGN(object_size, VISAGE_ARENA_ALIGN);
+  arena->chunk_objects = chunk_objects ? chunk_objects : VISAGE_ARENA_CHUNK;
+
+  // the first object allocates the first chunk
+  arena->chunk_used = arena->chunk_objects;
+
+  return 0;
+}
+
+/** Hands out a zeroed object. Returns NULL on failure. */
+void* visage_arena_get(VisageArena* arena) {
+  // start a new chunk once the last one is used up
+  if (arena->chunk_used == arena->chunk_objects) {
+    if (arena->nb_chunks == arena->chunks_capacity) {
+      int capacity = arena->chunks_capacity ? arena->chunks_capacity * 2 : 8;
+      uint8_t** chunks = av_realloc_array(arena->chunks, capacity, sizeof(uint8_t*));
+      if (!chunks) return NULL;
+      arena->chunks = chunks;
+      arena->chunks_capacity = capacity;
+    }
+    uint8_t* chunk = av_mallocz(arena->object_size * arena->chunk_objects);
+    if (!chunk) return NULL;
+    arena->chunks[arena->nb_chunks++] = chunk;
+    arena->chunk_used = 0;
+  }
+
+  uint8_t* chunk = arena->chunks[arena->nb_chunks - 1];
+  return chunk + arena->object_size * arena->chunk_used++;
+}
+
+/** Frees the arena and all objects taken from it. */
+void visage_free_arena(VisageArena** arena) {
+  if (!*arena) return;
+
+  for (int i = 0; i < (*arena)->nb_chunks; i++) {
+    av_free((*arena)->chunks[i]);
+  }
+  av_free((*arena)->chunks);
+  av_free(*arena);
+  *arena = NULL;
+}
@@ -0,0 +1,381 @@
+#include <SDL3/SDL_audio.h>
+#include <SDL3/SDL_timer.h>
+#include <libavcodec/avcodec.h>
+#include <libavcodec/codec_par.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
+#include <libswresample/swresample.h>
+#include "visage_audio.h"
+#include "visage_packet_queue.h"
+
+/** Maximum amount of audio kept queued in the SDL stream, in milliseconds. */
+#define VISAGE_AUDIO_QUEUE_MS 500
+
+/** Audio queued in the SDL stream in low-latency mode above which it is played faster, in milliseconds. */
+#define VISAGE_AUDIO_LIVE_MS 40
+
+/** Audio queued in the SDL stream in low-latency mode above which it is dropped, in milliseconds. */
+#define VISAGE_AUDIO_LIVE_TRIM_MS 200
+
+/** Frequency ratio audio is played at in low-latency mode while catching up. */
+#define VISAGE_AUDIO_LIVE_CATCHUP 1.02f
+
+/** Allocates and initializes the audio context. Returns NULL on failure. */
+VisageAudio* visage_alloc_audio() {
+  VisageAudio* audio = av_mallocz(sizeof(VisageAudio));
+  if (!audio) return NULL;
+
+  // initialize properties to null
+  audio->format_ctx = NULL;
+  audio->codec = NULL;
+  audio->codecpar = NULL;
+  audio->codec_ctx = NULL;
+  audio->swr_ctx = NULL;
+  audio->sample_fmt = AV_SAMPLE_FMT_NONE;
+  audio->buffer = NULL;
+  audio->buffer_size = 0;
+  audio->stream = NULL;
+  audio->clock = NULL;
+  audio->end_pts = 0;
+  audio->serial = 0;
+  atomic_init(&audio->seek_pts, INT64_MIN);
+  audio->packets = NULL;
+  audio->stream_idx = -1;
+  audio->low_latency = 0;
+  audio->catching_up = 0;
+
+  return audio;
+}
+
+/** Frees the audio context. */
+void visage_free_audio(VisageAudio** audio) {
+  if (!*audio) return;
+
+  avcodec_free_context(&(*audio)->codec_ctx);
+  swr_free(&(*audio)->swr_ctx);
+  av_freep(&(*audio)->buffer);
+  visage_free_packet_queue(&(*audio)->packets);
+  av_free(*audio);
+  *audio = NULL;
+}
+
+/** Returns the SDL format of the interleaved sample format, or SDL_AUDIO_UNKNOWN. */
+static SDL_AudioFormat visage_audio_format(enum AVSampleFormat sample_fmt) {
+  switch (sample_fmt) {
+  case AV_SAMPLE_FMT_FLT:
+    return SDL_AUDIO_F32;
+  case AV_SAMPLE_FMT_S32:
+    return SDL_AUDIO_S32;
+  case AV_SAMPLE_FMT_S16:
+    return SDL_AUDIO_S16;
+  default:
+    return SDL_AUDIO_UNKNOWN;
+  }
+}
+
+/** Initializes the audio context for Visage. Outputs 0 on success, -1 on error. */
+int visage_init_audio(AVFormatContext* format_ctx, VisageAudio* audio) {
+  // set the format context
+  audio->format_ctx = format_ctx;
+
+  // temporary values for stream information
+  int audio_idx = -1;
+  const AVCodec* audio_codec = NULL;
+  AVCodecParameters* audio_codecpar = NULL;
+
+  // use the context to find information for the audio stream
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    // get stream and codec information
+    AVStream* stream = format_ctx->streams[i];
+    AVCodecParameters* par = stream->codecpar;
+    enum AVMediaType media_type = par->codec_type;
+
+    // detect if it is an audio stream and set info
+    if (media_type == AVMEDIA_TYPE_AUDIO) {
+      audio_codec = avcodec_find_decoder(par->codec_id);
+      audio_codecpar = par;
+      audio_idx = i;
+      break;
+    }
+  }
+
+  // throw an error if no audio stream is detected
+  if (audio_idx == -1 || audio_codec == NULL) {
+    printf("Error: file does not have audio\n");
+    return -1;
+  }
+
+  // otherwise, set values
+  audio->codec = audio_codec;
+  audio->codecpar = audio_codecpar;
+  audio->stream_idx = audio_idx;
+
+  // hand SDL the decoder's samples interleaved if it supports their format, or S16
+  audio->sample_fmt = av_get_packed_sample_fmt(audio_codecpar->format);
+  if (visage_audio_format(audio->sample_fmt) == SDL_AUDIO_UNKNOWN) {
+    audio->sample_fmt = AV_SAMPLE_FMT_S16;
+  }
+
+  // create audio specifications for SDL
+  audio->spec.channels = audio_codecpar->ch_layout.nb_channels;
+  audio->spec.format = visage_audio_format(audio->sample_fmt);
+  audio->spec.freq = audio_codecpar->sample_rate;
+
+  // allocate memory for SWR conversion context and set parameters
+  int r = swr_alloc_set_opts2(&audio->swr_ctx, &audio_codecpar->ch_layout, audio->sample_fmt,
+                              audio_codecpar->sample_rate, &audio_codecpar->ch_layout,
+                              audio_codecpar->format, audio_codecpar->sample_rate, 0, NULL);
+  if (r < 0) {
+    printf("Error: failed to allocate audio conversion context\n");
+    return -1;
+  }
+
+  // initialize SWR conversion context
+  if (swr_init(audio->swr_ctx) < 0) {
+    printf("Error: unable to initialize audio conversion context\n");
+    return -1;
+  }
+
+  // allocate memory for the audio codec context
+  audio->codec_ctx = avcodec_alloc_context3(audio_codec);
+  if (!audio->codec_ctx) {
+    printf("Error: failed to allocate memory for audio codec context\n");
+    return -1;
+  }
+
+  // copy codec parameters to the audio context
+  if (avcodec_parameters_to_context(audio->codec_ctx, audio_codecpar) < 0) {
+    printf("Error: failed to copy codec parameters to the audio context\n");
+    return -1;
+  }
+
+  // audio decoders are cheap next to video and barely scale with threads
+  audio->codec_ctx->thread_count = 1;
+
+  // initialize the audio codec context to use the given decoder
+  if (avcodec_open2(audio->codec_ctx, audio_codec, NULL) < 0) {
+    printf("Error: failed to initialize audio codec context\n");
+    return -1;
+  }
+
+  // allocate the queue of packets fed by the demuxer
+  audio->packets = visage_alloc_packet_queue();
+  if (!audio->packets) {
+    printf("Error: failed to allocate memory for the audio packet queue\n");
+    return -1;
+  }
+  audio->packets->time_base = format_ctx->streams[audio_idx]->time_base;
+
+  return 0;
+}
+
+/** Returns the duration of the audio queued in the SDL stream, in milliseconds. */
+int64_t visage_queued_audio(VisageAudio* audio) {
+  int64_t bytes_per_second = (int64_t) audio->spec.freq * SDL_AUDIO_FRAMESIZE(audio->spec);
+  return (int64_t) SDL_GetAudioStreamQueued(audio->stream) * 1000 / bytes_per_second;
+}
+
+/** Waits until the SDL stream has room for more audio. Returns 0 when ready, -1 on abort. */
+static int visage_wait_audio(VisageAudio* audio) {
+  while (visage_queued_audio(audio) > VISAGE_AUDIO_QUEUE_MS) {
+    if (visage_packet_queue_aborted(audio->packets)) return -1;
+    if (visage_packet_queue_serial(audio->packets) != audio->serial) return 0;
+    SDL_Delay(10);
+  }
+  return 0;
+}
+
+/** Keeps the audio of a live source close to it, dropping a backlog and playing slightly faster while above the target. */
+static void visage_trim_audio(VisageAudio* audio) {
+  int64_t queued = visage_queued_audio(audio);
+  if (queued > VISAGE_AUDIO_LIVE_TRIM_MS) {
+    SDL_ClearAudioStream(audio->stream);
+    queued = 0;
+  }
+
+  // the difference in pitch is too small to hear
+  int catching_up = queued > VISAGE_AUDIO_LIVE_MS;
+  if (catching_up != audio->catching_up) {
+    float ratio = catching_up ? VISAGE_AUDIO_LIVE_CATCHUP : 1.0f;
+    SDL_SetAudioStreamFrequencyRatio(audio->stream, ratio);
+    audio->catching_up = catching_up;
+  }
+}
+
+/** Interleaves the planes of the frame into the buffer. */
+static void visage_interleave_audio(VisageAudio* audio, const AVFrame* frame) {
+  int channels = audio->spec.channels;
+  int bytes = av_get_bytes_per_sample(audio->sample_fmt);
+
+  // copy sample by sample with the width known at compile time
+  switch (bytes) {
+  case 4:
+    for (int c = 0; c < channels; c++) {
+      const uint32_t* in = (const uint32_t*) frame->extended_data[c];
+      uint32_t* out = (uint32_t*) audio->buffer + c;
+      for (int i = 0; i < frame->nb_samples; i++) out[i * channels] = in[i];
+    }
+    break;
+  case 2:
+    for (int c = 0; c < channels; c++) {
+      const uint16_t* in = (const uint16_t*) frame->extended_data[c];
+      uint16_t* out = (uint16_t*) audio->buffer + c;
+      for (int i = 0; i < frame->nb_samples; i++) out[i * channels] = in[i];
+    }
+    break;
+  }
+}
+
+/** Brings the samples of the frame into the SDL format. Returns the number of samples per channel, or -1 on error. */
+static int visage_convert_audio(VisageAudio* audio, const AVFrame* frame, const uint8_t** data) {
+  int frame_size = SDL_AUDIO_FRAMESIZE(audio->spec);
+  int same_layout = frame->ch_layout.nb_channels == audio->spec.channels;
+
+  // interleaved samples in the SDL format need no conversion at all
+  if (same_layout && frame->format == (int) audio->sample_fmt) {
+    *data = frame->data[0];
+    return frame->nb_samples;
+  }
+  *data = NULL;
+
+  // grow the buffer when the frame needs more room
+  int samples = frame->nb_samples;
+  int planar = same_layout && frame->format == av_get_planar_sample_fmt(audio->sample_fmt);
+  if (!planar) samples = swr_get_out_samples(audio->swr_ctx, frame->nb_samples);
+  av_fast_malloc(&audio->buffer, &audio->buffer_size, (size_t) samples * frame_size);
+  if (!audio->buffer) {
+    audio->buffer_size = 0;
+    printf("Error: failed to allocate memory for audio samples\n");
+    return -1;
+  }
+
+  *data = audio->buffer;
+
+  // planar samples in the SDL format only need interleaving
+  if (planar) {
+    visage_interleave_audio(audio, frame);
+    return frame->nb_samples;
+  }
+
+  // convert anything else
+  return swr_convert(audio->swr_ctx, &audio->buffer, samples,
+                     (const uint8_t**) frame->extended_data, frame->nb_samples);
+}
+
+/** Receives all pending frames from the decoder into the SDL stream. Returns 0 on success, -1 on error. */
+static int visage_receive_audio(VisageAudio* audio, AVFrame* frame) {
+  while (avcodec_receive_frame(audio->codec_ctx, frame) >= 0) {
+    // skip the samples before the target of an accurate seek
+    int64_t end = (frame->best_effort_timestamp + frame->duration)
+      * av_q2d(audio->format_ctx->streams[audio->stream_idx]->time_base) * 1000;
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE && end < atomic_load(&audio->seek_pts)) {
+      av_frame_unref(frame);
+      continue;
+    }
+
+    // bring the samples into the SDL format
+    const uint8_t* data;
+    int samples = visage_convert_audio(audio, frame, &data);
+    if (samples < 0) {
+      av_frame_unref(frame);
+      return -1;
+    }
+
+    // samples without a timestamp follow the previous ones
+    int64_t pts = audio->end_pts;
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+      pts = frame->best_effort_timestamp
+        * av_q2d(audio->format_ctx->streams[audio->stream_idx]->time_base) * 1000;
+    }
+
+    // put samples to the audio stream
+    if (samples > 0) {
+      if (audio->low_latency) visage_trim_audio(audio);
+      SDL_PutAudioStreamData(audio->stream, data, samples * SDL_AUDIO_FRAMESIZE(audio->spec));
+      audio->end_pts = pts + (int64_t) samples * 1000 / audio->spec.freq;
+
+      // the samples being played now are the ones still queued behind the end,
+      // unless a seek has made them stale already
+      if (audio->clock && audio->serial == visage_packet_queue_serial(audio->packets)) {
+        visage_set_clock(audio->clock, audio->end_pts - visage_queued_audio(audio));
+      }
+    }
+    av_frame_unref(frame);
+
+    // keep the decoder from running too far ahead of playback, live sources being paced by their capture
+    if (!audio->low_latency && visage_wait_audio(audio) < 0) return -1;
+  }
+
+  return 0;
+}
+
+/** Processes the audio frames into the SDL stream. */
+int visage_process_audio(VisageAudio* audio) {
+  // check if context is initialized
+  if (!audio || !audio->stream) {
+    printf("Error: visage audio context is not initialized\n");
+    return -1;
+  }
+  int status = -1;
+  AVFrame* frame = NULL;
+
+  // allocate memory for packets
+  AVPacket* packet = av_packet_alloc();
+  if (!packet) {
+    printf("Error: failed to allocate memory for packets\n");
+    goto cleanup;
+  }
+
+  // allocate memory for frames
+  frame = av_frame_alloc();
+  if (!frame) {
+    printf("Error: failed to allocate memory for frames\n");
+    goto cleanup;
+  }
+
+  // take packets from the demuxer until the queue is aborted
+  int ret;
+  int serial;
+  while ((ret = visage_get_packet(audio->packets, packet, &serial)) >= 0) {
+    // start over from the new position after a seek
+    if (serial != audio->serial) {
+      avcodec_flush_buffers(audio->codec_ctx);
+      SDL_ClearAudioStream(audio->stream);
+      audio->serial = serial;
+    }
+
+    // drain the samples still buffered in the decoder at the end of the stream
+    if (ret == 0) {
+      avcodec_send_packet(audio->codec_ctx, NULL);
+      if (visage_receive_audio(audio, frame) < 0) goto cleanup;
+      avcodec_flush_buffers(audio->codec_ctx);
+      SDL_FlushAudioStream(audio->stream);
+      continue;
+    }
+
+    // send packet to the decoder
+    int send_ret = avcodec_send_packet(audio->codec_ctx, packet);
+    av_packet_unref(packet);
+    if (send_ret < 0) {
+      printf("Error: %s\n", av_err2str(send_ret));
+      goto cleanup;
+    }
+
+    if (visage_receive_audio(audio, frame) < 0) goto cleanup;
+  }
+  status = 0;
+
+  // cleanup everything
+ cleanup:
+  av_frame_free(&frame);
+  av_packet_free(&packet);
+
+  return status;
+}
+
+/** Aborts the audio processing. */
+void visage_abort_audio(VisageAudio* audio) {
+  visage_abort_packet_queue(audio->packets);
+}
@@ -0,0 +1,675 @@
+#include <SDL3/SDL_audio.h>
+#include <SDL3/SDL_error.h>
+#include <libavformat/avformat.h>
+#include <libavutil/common.h>
+#include <libavutil/macros.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "visage_audio.h"
+#include "visage_clock.h"
+#include "visage_convert.h"
+#include "visage_demux.h"
+#include "visage_packet_queue.h"
+#include "visage_stats.h"
+#include "visage_threads.h"
+#include "visage_video.h"
+
+/** Results of decoding one file. */
+typedef struct VisageBenchResult {
+    /**
+     * Number of frames that came out of the pipeline.
+     */
+    unsigned int frames;
+
+    /**
+     * Wall time from opening the decoder to the last frame, in microseconds.
+     */
+    int64_t elapsed;
+
+    /**
+     * Highest number of frames, packets and packet bytes queued at once.
+     */
+    unsigned int max_frames;
+    int max_packets;
+    int64_t max_packet_bytes;
+
+    /**
+     * Number of frames presented with a timestamp not after the one before,
+     * while playing.
+     */
+    unsigned int out_of_order;
+
+    /**
+     * Number of frames dropped for being late, while playing.
+     */
+    unsigned int dropped;
+
+    /**
+     * Timestamps of the frames in the order they were taken, in milliseconds.
+     */
+    int64_t* pts;
+
+    /**
+     * Differences between the time from one presented frame to the next and
+     * the difference of their timestamps, in microseconds, while playing.
+     */
+    int64_t* jitter;
+
+    /**
+     * Differences between the presented frames and the playback clock, which
+     * audio drives when there is some, in microseconds, while playing.
+     */
+    int64_t* drift;
+
+    /**
+     * Number of frames taken, and the number the samples have room for.
+     */
+    int nb_samples;
+    int samples_capacity;
+} VisageBenchResult;
+
+/** Default limits on the 99th percentiles of jitter and drift while playing, in milliseconds. */
+#define VISAGE_BENCH_MAX_JITTER 8.0
+#define VISAGE_BENCH_MAX_DRIFT 40.0
+
+/** Difference from the expected timestamps still accepted, in milliseconds, for time bases finer than them. */
+#define VISAGE_BENCH_PTS_TOLERANCE 2
+
+/** Default slowdown against the baseline still accepted, in percent. */
+#define VISAGE_BENCH_TOLERANCE 10
+
+/** Size of the buffer audio is taken out of its stream into while playing, in bytes. */
+#define VISAGE_BENCH_AUDIO_BUFFER 65536
+
+/** Thread entry point for reading packets from the file. */
+static void* visage_demux_thread(void* arg) {
+  visage_process_demux(arg);
+  return NULL;
+}
+
+/** Thread entry point for decoding video frames. */
+static void* visage_video_thread(void* arg) {
+  visage_process_video(arg);
+  return NULL;
+}
+
+/** Thread entry point for decoding audio samples. */
+static void* visage_audio_thread(void* arg) {
+  visage_process_audio(arg);
+  return NULL;
+}
+
+/** Command line options. */
+static const struct option visage_options[] = {
+  {"hwaccel", required_argument, NULL, 'a'},
+  {"threads", required_argument, NULL, 't'},
+  {"thread-type", required_argument, NULL, 'T'},
+  {"play", no_argument, NULL, 'p'},
+  {"max-jitter", required_argument, NULL, 'j'},
+  {"max-drift", required_argument, NULL, 'd'},
+  {"baseline", required_argument, NULL, 'b'},
+  {"tolerance", required_argument, NULL, 'r'},
+  {"pts", required_argument, NULL, 'P'},
+  {"help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0},
+};
+
+/** Prints the command line usage. */
+static void visage_usage(const char* program) {
+  printf("Usage: %s [options] <file>...\n", program);
+  printf("Decodes the video of every file as fast as possible, without a window.\n");
+  printf("Options:\n");
+  printf("  --hwaccel <type>  hardware decoding: auto (default), none, or a device type\n");
+  printf("  --threads <n>     video decoder threads, 0 for one per physical core (default)\n");
+  printf("  --thread-type <t> video decoder threading: auto (default), frame or slice\n");
+  printf("  --play            play in real time instead, with audio, and check that frames\n");
+  printf("                    come in order and on time\n");
+  printf("  --max-jitter <ms> highest 99th percentile of presentation jitter (default %.0f)\n",
+         VISAGE_BENCH_MAX_JITTER);
+  printf("  --max-drift <ms>  highest 99th percentile of drift from the clock (default %.0f)\n",
+         VISAGE_BENCH_MAX_DRIFT);
+  printf("  --baseline <file> compare frame rates with the file, or write it if missing\n");
+  printf("  --tolerance <%%>   slowdown against the baseline still accepted (default %d)\n",
+         VISAGE_BENCH_TOLERANCE);
+  printf("  --pts <file>      check the timestamps of the frames of a single file against\n");
+  printf("                    the file, one per line in milliseconds\n");
+  printf("Fails when a file fails to decode or a check does not pass.\n");
+}
+
+/** Returns the peak resident set size of the process in KiB. */
+static long visage_peak_rss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+/** Prints the timing percentiles of a stage. */
+static void visage_print_stage(VisageStats* stats, int stage, const char* name) {
+  unsigned int count = atomic_load(&stats->stages[stage].count);
+  if (count == 0) {
+    printf("  %-8s not used\n", name);
+    return;
+  }
+  int64_t total = atomic_load(&stats->stages[stage].total);
+  printf("  %-8s avg %7.3f ms  p50 %7.3f ms  p90 %7.3f ms  p99 %7.3f ms  max %7.3f ms\n", name,
+         total / (double) count / 1000.0,
+         visage_stage_percentile(stats, stage, 50) / 1000.0,
+         visage_stage_percentile(stats, stage, 90) / 1000.0,
+         visage_stage_percentile(stats, stage, 99) / 1000.0,
+         atomic_load(&stats->stages[stage].max) / 1000.0);
+}
+
+/** Compares two samples for sorting. */
+static int visage_compare_samples(const void* a, const void* b) {
+  int64_t x = *(const int64_t*) a;
+  int64_t y = *(const int64_t*) b;
+  return (x > y) - (x < y);
+}
+
+/** Sorts the samples and returns the percentile of them, 0 without samples. */
+static int64_t visage_sample_percentile(int64_t* samples, int count, double percentile) {
+  if (count == 0) return 0;
+  qsort(samples, count, sizeof(int64_t), visage_compare_samples);
+  int idx = (int) (percentile / 100 * (count - 1) + 0.5);
+  return samples[idx];
+}
+
+/** Adds the timestamp, jitter and drift of a taken frame to the results. Outputs 0 on success, -1 on error. */
+static int visage_add_sample(VisageBenchResult* result, int64_t pts, int64_t jitter,
+                             int64_t drift) {
+  if (result->nb_samples == result->samples_capacity) {
+    int capacity = result->samples_capacity ? result->samples_capacity * 2 : 1024;
+    int64_t* samples = av_realloc_array(result->pts, capacity, sizeof(int64_t));
+    if (!samples) return -1;
+    result->pts = samples;
+    samples = av_realloc_array(result->jitter, capacity, sizeof(int64_t));
+    if (!samples) return -1;
+    result->jitter = samples;
+    samples = av_realloc_array(result->drift, capacity, sizeof(int64_t));
+    if (!samples) return -1;
+    result->drift = samples;
+    result->samples_capacity = capacity;
+  }
+  result->pts[result->nb_samples] = pts;
+  result->jitter[result->nb_samples] = FFABS(jitter);
+  result->drift[result->nb_samples] = FFABS(drift);
+  result->nb_samples++;
+  return 0;
+}
+
+/** Takes frames off the queue as soon as they arrive. Outputs 0 on success, -1 on error. */
+static int visage_decode_frames(VisageVideo* video, VisageBenchResult* result) {
+  while (!visage_video_finished(video)) {
+    result->max_frames = FFMAX(result->max_frames, visage_count_video(video));
+    result->max_packets = FFMAX(result->max_packets, visage_count_packets(video->packets));
+    result->max_packet_bytes = FFMAX(result->max_packet_bytes,
+                                     visage_packet_queue_size(video->packets));
+    VisageVideoFrames* queued = visage_peek_video(video);
+    if (!queued) {
+      av_usleep(100);
+      continue;
+    }
+    if (visage_add_sample(result, queued->pts, 0, 0) < 0) {
+      printf("Error: failed to allocate memory for samples\n");
+      return -1;
+    }
+    visage_pop_video(video);
+    result->frames++;
+  }
+  result->dropped = atomic_load(&video->frames_dropped);
+
+  return 0;
+}
+
+/** Takes the audio that would have played since the last call out of its stream, standing in for the audio device. */
+static void visage_drain_audio(VisageAudio* audio, uint8_t* buffer, int64_t* drained) {
+  int64_t samples = (av_gettime_relative() - *drained) * audio->spec.freq / 1000000;
+  if (samples <= 0) return;
+  *drained += samples * 1000000 / audio->spec.freq;
+
+  // an empty stream plays silence, and the time passes all the same
+  int frame_size = SDL_AUDIO_FRAMESIZE(audio->spec);
+  int64_t bytes = samples * frame_size;
+  while (bytes > 0) {
+    int chunk = (int) FFMIN(bytes, VISAGE_BENCH_AUDIO_BUFFER / frame_size * frame_size);
+    int taken = SDL_GetAudioStreamData(audio->stream, buffer, chunk);
+    if (taken <= 0) break;
+    bytes -= taken;
+  }
+}
+
+/** Presents frames when they are due, recording their order and timing. Outputs 0 on success, -1 on error. */
+static int visage_play_frames(VisageVideo* video, VisageAudio* audio, uint8_t* buffer,
+                              VisageBenchResult* result) {
+  int64_t drained = av_gettime_relative();
+  int64_t last_pts = 0;
+  int64_t last_shown = 0;
+  int last_serial = -1;
+  while (!visage_video_finished(video)) {
+    if (audio) visage_drain_audio(audio, buffer, &drained);
+    result->max_frames = FFMAX(result->max_frames, visage_count_video(video));
+    result->max_packets = FFMAX(result->max_packets, visage_count_packets(video->packets));
+    result->max_packet_bytes = FFMAX(result->max_packet_bytes,
+                                     visage_packet_queue_size(video->packets));
+
+    // wait for the next frame, waking up often enough to keep the audio flowing
+    int64_t delay;
+    VisageVideoFrames* queued = visage_due_video(video, 0, &delay);
+    if (!queued) {
+      av_usleep(delay > 0 ? FFMIN(delay, 1) * 1000 : 100);
+      continue;
+    }
+
+    // compare with the frame before, which only follows from the same serial
+    int64_t shown = av_gettime_relative();
+    int64_t jitter = 0;
+    if (queued->serial == last_serial) {
+      if (queued->pts <= last_pts) result->out_of_order++;
+      jitter = (shown - last_shown) - (queued->pts - last_pts) * 1000;
+    }
+    int64_t drift = (queued->pts - visage_get_clock(video->clock)) * 1000;
+    if (visage_add_sample(result, queued->pts, jitter, drift) < 0) {
+      printf("Error: failed to allocate memory for samples\n");
+      return -1;
+    }
+    last_pts = queued->pts;
+    last_shown = shown;
+    last_serial = queued->serial;
+    visage_pop_video(video);
+    result->frames++;
+  }
+  result->dropped = atomic_load(&video->frames_dropped);
+
+  return 0;
+}
+
+/** Decodes the video of the file as fast as possible, or plays it in real time. Outputs 0 on success, -1 on error. */
+static int visage_bench_file(const char* file, const char* hwaccel, int thread_count,
+                             int thread_type, int play, VisageStats* stats,
+                             VisageBenchResult* result) {
+  int status = -1;
+  AVFormatContext* format_ctx = NULL;
+  VisageVideo* video = NULL;
+  VisageAudio* audio = NULL;
+  VisageClock* clock = NULL;
+  VisageDemuxer* demuxer = NULL;
+  uint8_t* buffer = NULL;
+
+  // open the file
+  int ret = avformat_open_input(&format_ctx, file, NULL, NULL);
+  if (ret != 0) {
+    printf("Error: failed to open %s: %s\n", file, av_err2str(ret));
+    return -1;
+  }
+  avformat_find_stream_info(format_ctx, NULL);
+
+  // set up the video pipeline without a renderer, so frames stay in system memory
+  video = visage_alloc_video();
+  clock = visage_alloc_clock();
+  demuxer = visage_alloc_demuxer();
+  if (!video || !clock || !demuxer) {
+    printf("Error: failed to allocate memory for the pipeline\n");
+    goto cleanup;
+  }
+  video->hwaccel = hwaccel;
+  video->thread_count = thread_count;
+  video->thread_type = thread_type;
+  video->stats = stats;
+
+  // nothing seeks back, so cached frames would only hold on to memory
+  video->cache_size = 0;
+  if (visage_init_video(format_ctx, video) < 0) goto cleanup;
+  video->clock = clock;
+
+  // play the audio into a stream without a device, which is drained in real time
+  if (play && av_find_best_stream(format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0) >= 0) {
+    audio = visage_alloc_audio();
+    buffer = av_malloc(VISAGE_BENCH_AUDIO_BUFFER);
+    if (!audio || !buffer) {
+      printf("Error: failed to allocate memory for the pipeline\n");
+      goto cleanup;
+    }
+    if (visage_init_audio(format_ctx, audio) < 0) goto cleanup;
+    audio->clock = clock;
+    audio->stream = SDL_CreateAudioStream(&audio->spec, &audio->spec);
+    if (!audio->stream) {
+      printf("Error: %s\n", SDL_GetError());
+      goto cleanup;
+    }
+  }
+  if (visage_init_demuxer(format_ctx, video, audio, demuxer) < 0) goto cleanup;
+
+  // run the demuxer and decoders
+  int64_t start = av_gettime_relative();
+  pthread_t demux_thread, video_thread, audio_thread;
+  pthread_create(&demux_thread, NULL, visage_demux_thread, demuxer);
+  pthread_create(&video_thread, NULL, visage_video_thread, video);
+  if (audio) pthread_create(&audio_thread, NULL, visage_audio_thread, audio);
+  ret = play ? visage_play_frames(video, audio, buffer, result)
+    : visage_decode_frames(video, result);
+  result->elapsed = av_gettime_relative() - start;
+
+  visage_abort_video(video);
+  if (audio) visage_abort_audio(audio);
+  pthread_join(demux_thread, NULL);
+  pthread_join(video_thread, NULL);
+  if (audio) pthread_join(audio_thread, NULL);
+  status = ret;
+
+  // cleanup everything
+ cleanup:
+  visage_free_demuxer(&demuxer);
+  visage_free_video(&video);
+  if (audio) SDL_DestroyAudioStream(audio->stream);
+  visage_free_audio(&audio);
+  visage_free_clock(&clock);
+  av_free(buffer);
+  avformat_close_input(&format_ctx);
+
+  return status;
+}
+
+/** Prints the percentiles of the samples, in milliseconds. */
+static void visage_print_samples(int64_t* samples, int count, const char* name) {
+  printf("  %-8s p50 %7.3f ms  p90 %7.3f ms  p99 %7.3f ms  max %7.3f ms\n", name,
+         visage_sample_percentile(samples, count, 50) / 1000.0,
+         visage_sample_percentile(samples, count, 90) / 1000.0,
+         visage_sample_percentile(samples, count, 99) / 1000.0,
+         visage_sample_percentile(samples, count, 100) / 1000.0);
+}
+
+/** Checks the order and timing of the played frames against the limits. Returns 1 if all pass, 0 otherwise. */
+static int visage_check_playback(VisageBenchResult* result, double max_jitter, double max_drift) {
+  int passed = 1;
+  if (result->out_of_order > 0) {
+    printf("  FAILED   %u frames out of order\n", result->out_of_order);
+    passed = 0;
+  }
+  double jitter = visage_sample_percentile(result->jitter, result->nb_samples, 99) / 1000.0;
+  if (jitter > max_jitter) {
+    printf("  FAILED   jitter p99 %.3f ms above %.3f ms\n", jitter, max_jitter);
+    passed = 0;
+  }
+  double drift = visage_sample_percentile(result->drift, result->nb_samples, 99) / 1000.0;
+  if (drift > max_drift) {
+    printf("  FAILED   drift p99 %.3f ms above %.3f ms\n", drift, max_drift);
+    passed = 0;
+  }
+  return passed;
+}
+
+/** Reads the expected timestamps of the frames, one per line in milliseconds. Returns their number, or -1 on error. */
+static int visage_read_timeline(const char* path, int64_t** timeline) {
+  FILE* input = fopen(path, "r");
+  if (!input) {
+    printf("Error: failed to open %s\n", path);
+    return -1;
+  }
+
+  int count = 0;
+  int capacity = 0;
+  int64_t pts;
+  while (fscanf(input, "%" SCNd64, &pts) == 1) {
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      int64_t* grown = av_realloc_array(*timeline, capacity, sizeof(int64_t));
+      if (!grown) {
+        printf("Error: failed to allocate memory for the timeline\n");
+        fclose(input);
+        return -1;
+      }
+      *timeline = grown;
+    }
+    (*timeline)[count++] = pts;
+  }
+  fclose(input);
+
+  return count;
+}
+
+/** Checks the timestamps of the frames against the expected ones, both counted from their first. Returns 1 if they match, 0 otherwise. */
+static int visage_check_timeline(VisageBenchResult* result, const int64_t* timeline, int count) {
+  // frames dropped for being late leave out as many expected timestamps
+  int expected = 0;
+  unsigned int skipped = 0;
+  for (int i = 0; i < result->nb_samples; i++) {
+    int64_t pts = result->pts[i] - result->pts[0];
+    while (expected < count && skipped < result->dropped
+           && timeline[expected] - timeline[0] < pts - VISAGE_BENCH_PTS_TOLERANCE) {
+      expected++;
+      skipped++;
+    }
+    if (expected == count) {
+      printf("  FAILED   frame %d at %" PRId64 " ms, after the %d expected frames\n", i, pts, count);
+      return 0;
+    }
+    int64_t expected_pts = timeline[expected] - timeline[0];
+    if (FFABS(pts - expected_pts) > VISAGE_BENCH_PTS_TOLERANCE) {
+      printf("  FAILED   frame %d at %" PRId64 " ms, expected %" PRId64 " ms\n", i, pts,
+             expected_pts);
+      return 0;
+    }
+    expected++;
+  }
+  if (result->nb_samples + result->dropped != (unsigned int) count) {
+    printf("  FAILED   %u frames, expected %d\n", result->nb_samples + result->dropped, count);
+    return 0;
+  }
+  printf("  timeline %d frames as expected\n", count);
+
+  return 1;
+}
+
+/** Returns the frame rate the baseline lists for the file, or 0 if it lists none. */
+static double visage_baseline_rate(const char* path, const char* file) {
+  FILE* baseline = fopen(path, "r");
+  if (!baseline) return 0;
+
+  // every line holds the frame rate and the file it was measured on
+  double rate = 0;
+  double line_rate;
+  char line_file[4096];
+  while (fscanf(baseline, "%lf %4095[^\n]", &line_rate, line_file) == 2) {
+    if (strcmp(line_file, file) == 0) rate = line_rate;
+  }
+  fclose(baseline);
+
+  return rate;
+}
+
+int main(int argc, char *argv[]) {
+  // parse the command line options
+  const char* hwaccel = "auto";
+  int thread_count = VISAGE_THREADS_AUTO;
+  int thread_type = VISAGE_THREADS_AUTO;
+  int play = 0;
+  double max_jitter = VISAGE_BENCH_MAX_JITTER;
+  double max_drift = VISAGE_BENCH_MAX_DRIFT;
+  const char* baseline_path = NULL;
+  int tolerance = VISAGE_BENCH_TOLERANCE;
+  const char* timeline_path = NULL;
+  int option;
+  while ((option = getopt_long(argc, argv, "h", visage_options, NULL)) != -1) {
+    switch (option) {
+    case 'a':
+      hwaccel = optarg;
+      break;
+    case 't':
+      thread_count = atoi(optarg);
+      if (thread_count < 0) {
+        printf("Error: invalid thread count \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'T':
+      if (strcmp(optarg, "frame") == 0) {
+        thread_type = FF_THREAD_FRAME;
+      } else if (strcmp(optarg, "slice") == 0) {
+        thread_type = FF_THREAD_SLICE;
+      } else if (strcmp(optarg, "auto") == 0) {
+        thread_type = VISAGE_THREADS_AUTO;
+      } else {
+        printf("Error: unknown thread type \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'p':
+      play = 1;
+      break;
+    case 'j':
+      max_jitter = atof(optarg);
+      if (max_jitter <= 0) {
+        printf("Error: invalid jitter limit \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'd':
+      max_drift = atof(optarg);
+      if (max_drift <= 0) {
+        printf("Error: invalid drift limit \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'b':
+      baseline_path = optarg;
+      break;
+    case 'P':
+      timeline_path = optarg;
+      break;
+    case 'r':
+      tolerance = atoi(optarg);
+      if (tolerance < 0 || tolerance >= 100) {
+        printf("Error: invalid tolerance \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    default:
+      visage_usage(argv[0]);
+      return option == 'h' ? 0 : -1;
+    }
+  }
+
+  // ensure that files are passed into the program
+  if (optind >= argc) {
+    visage_usage(argv[0]);
+    return -1;
+  }
+  if (play && baseline_path) {
+    printf("Error: the baseline holds decoding rates, which playing in real time does not measure\n");
+    return -1;
+  }
+  if (timeline_path && argc - optind > 1) {
+    printf("Error: the expected timestamps belong to a single file\n");
+    return -1;
+  }
+  int64_t* timeline = NULL;
+  int timeline_count = timeline_path ? visage_read_timeline(timeline_path, &timeline) : 0;
+  if (timeline_count < 0) return -1;
+  printf("Conversion kernels: %s\n", visage_convert_isa());
+
+  // start a baseline from this run when there is none yet
+  FILE* baseline_output = NULL;
+  if (baseline_path) {
+    FILE* baseline = fopen(baseline_path, "r");
+    if (baseline) {
+      fclose(baseline);
+    } else {
+      baseline_output = fopen(baseline_path, "w");
+      if (!baseline_output) {
+        printf("Error: failed to open %s\n", baseline_path);
+        return -1;
+      }
+    }
+  }
+
+  // benchmark every file of the corpus on its own
+  int failed = 0;
+  unsigned int total_frames = 0;
+  int64_t total_elapsed = 0;
+  for (int i = optind; i < argc; i++) {
+    VisageStats* stats = visage_alloc_stats();
+    if (!stats || visage_alloc_histograms(stats) < 0) {
+      printf("Error: failed to allocate memory for stats\n");
+      return -1;
+    }
+
+    VisageBenchResult result = {0};
+    if (visage_bench_file(argv[i], hwaccel, thread_count, thread_type, play, stats,
+                          &result) < 0) {
+      failed++;
+      av_freep(&result.pts);
+      av_freep(&result.jitter);
+      av_freep(&result.drift);
+      visage_free_stats(&stats);
+      continue;
+    }
+    total_frames += result.frames;
+    total_elapsed += result.elapsed;
+
+    // report throughput, latencies and memory
+    double rate = result.elapsed > 0 ? result.frames * 1000000.0 / result.elapsed : 0;
+    printf("%s\n", argv[i]);
+    printf("  frames   %u in %.3f s, %.2f frames/s\n", result.frames, result.elapsed / 1000000.0,
+           rate);
+    visage_print_stage(stats, VISAGE_STAGE_DEMUX, "demux");
+    visage_print_stage(stats, VISAGE_STAGE_DECODE, "decode");
+    visage_print_stage(stats, VISAGE_STAGE_CONVERT, "convert");
+    printf("  queues   %u frames, %d packets, %" PRId64 " KiB of packets at most\n",
+           result.max_frames, result.max_packets, result.max_packet_bytes / 1024);
+    printf("  memory   %ld KiB peak resident\n", visage_peak_rss());
+
+    // check the timestamps, the played frames, or the decoding rate against the baseline
+    if (timeline_path && !visage_check_timeline(&result, timeline, timeline_count)) failed++;
+    if (play) {
+      printf("  shown    %u frames, %u dropped, %u out of order\n", result.frames, result.dropped,
+             result.out_of_order);
+      visage_print_samples(result.jitter, result.nb_samples, "jitter");
+      visage_print_samples(result.drift, result.nb_samples, "drift");
+      if (!visage_check_playback(&result, max_jitter, max_drift)) failed++;
+    } else if (baseline_output) {
+      fprintf(baseline_output, "%.2f %s\n", rate, argv[i]);
+    } else if (baseline_path) {
+      double baseline_rate = visage_baseline_rate(baseline_path, argv[i]);
+      if (baseline_rate <= 0) {
+        printf("  baseline none for this file\n");
+      } else {
+        printf("  baseline %.2f frames/s, %+.1f%%\n", baseline_rate,
+               (rate / baseline_rate - 1) * 100);
+        if (rate < baseline_rate * (100 - tolerance) / 100) {
+          printf("  FAILED   more than %d%% slower than the baseline\n", tolerance);
+          failed++;
+        }
+      }
+    }
+    av_freep(&result.pts);
+    av_freep(&result.jitter);
+    av_freep(&result.drift);
+    visage_free_stats(&stats);
+  }
+  av_free(timeline);
+  if (baseline_output) {
+    fclose(baseline_output);
+    printf("Baseline written to %s\n", baseline_path);
+  }
+
+  // sum up the corpus
+  if (argc - optind > 1) {
+    printf("Total: %u frames in %.3f s, %.2f frames/s, %d failed\n", total_frames,
+           total_elapsed / 1000000.0,
+           total_elapsed > 0 ? total_frames * 1000000.0 / total_elapsed : 0, failed);
+  }
+
+  return failed ? -1 : 0;
+}
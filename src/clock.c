@@ -0,0 +1,90 @@
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <pthread.h>
+#include "visage_clock.h"
+
+/** Allocates the clock. Returns NULL on failure. */
+VisageClock* visage_alloc_clock() {
+  VisageClock* clock = av_mallocz(sizeof(VisageClock));
+  if (!clock) return NULL;
+
+  // initialize properties to unstarted
+  clock->pts = 0;
+  clock->updated = 0;
+  clock->started = 0;
+  clock->speed = 1.0;
+  pthread_mutex_init(&clock->mutex, NULL);
+
+  return clock;
+}
+
+/** Frees the clock. */
+void visage_free_clock(VisageClock** clock) {
+  if (!*clock) return;
+
+  pthread_mutex_destroy(&(*clock)->mutex);
+  av_free(*clock);
+  *clock = NULL;
+}
+
+/** Sets the presentation time being played now. */
+void visage_set_clock(VisageClock* clock, int64_t pts) {
+  pthread_mutex_lock(&clock->mutex);
+  clock->pts = pts;
+  clock->updated = av_gettime_relative();
+  clock->started = 1;
+  pthread_mutex_unlock(&clock->mutex);
+}
+
+/** Starts the clock at the presentation time unless it is running already. */
+void visage_start_clock(VisageClock* clock, int64_t pts) {
+  pthread_mutex_lock(&clock->mutex);
+  if (!clock->started) {
+    clock->pts = pts;
+    clock->updated = av_gettime_relative();
+    clock->started = 1;
+  }
+  pthread_mutex_unlock(&clock->mutex);
+}
+
+/** Stops the clock until it is set or started again. */
+void visage_reset_clock(VisageClock* clock) {
+  pthread_mutex_lock(&clock->mutex);
+  clock->started = 0;
+  pthread_mutex_unlock(&clock->mutex);
+}
+
+/** Returns the presentation time being played now, or VISAGE_CLOCK_UNSET. */
+int64_t visage_get_clock(VisageClock* clock) {
+  pthread_mutex_lock(&clock->mutex);
+  int64_t pts = VISAGE_CLOCK_UNSET;
+  if (clock->started) {
+    // extrapolate from the last update at the playback speed
+    pts = clock->pts + (int64_t) ((av_gettime_relative() - clock->updated) * clock->speed / 1000);
+  }
+  pthread_mutex_unlock(&clock->mutex);
+
+  return pts;
+}
+
+/** Changes the playback speed, keeping the presentation time being played now. */
+void visage_set_clock_speed(VisageClock* clock, double speed) {
+  pthread_mutex_lock(&clock->mutex);
+  int64_t now = av_gettime_relative();
+  if (clock->started) {
+    // rebase on the current time so the new speed only applies from now on
+    clock->pts += (int64_t) ((now - clock->updated) * clock->speed / 1000);
+  }
+  clock->updated = now;
+  clock->speed = speed;
+  pthread_mutex_unlock(&clock->mutex);
+}
+
+/** Returns the playback speed. */
+double visage_get_clock_speed(VisageClock* clock) {
+  pthread_mutex_lock(&clock->mutex);
+  double speed = clock->speed;
+  pthread_mutex_unlock(&clock->mutex);
+
+  return speed;
+}
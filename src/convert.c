@@ -0,0 +1,273 @@
+#include <libavutil/cpu.h>
+#include <libavutil/frame.h>
+#include <libavutil/macros.h>
+#include <libavutil/pixfmt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "visage_convert.h"
+
+#if defined(VISAGE_NO_SIMD)
+// the build asked for the portable kernels only
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VISAGE_CONVERT_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VISAGE_CONVERT_NEON 1
+#endif
+
+/** Row kernels of one instruction set. */
+typedef struct VisageConvertKernels {
+    const char* name;
+    /** Rounds 10-bit samples to 8 bits. */
+    void (*shift_row)(uint8_t* dst, const uint16_t* src, int width);
+    /** Averages two lines of 8-bit samples. */
+    void (*average_row)(uint8_t* dst, const uint8_t* a, const uint8_t* b, int width);
+    /** Averages two lines of 10-bit samples and rounds the result to 8 bits. */
+    void (*average_shift_row)(uint8_t* dst, const uint16_t* a, const uint16_t* b, int width);
+} VisageConvertKernels;
+
+/** Rounds 10-bit samples to 8 bits. */
+static void visage_shift_row_c(uint8_t* dst, const uint16_t* src, int width) {
+  for (int i = 0; i < width; i++) dst[i] = FFMIN((src[i] + 2) >> 2, 255);
+}
+
+/** Averages two lines of 8-bit samples, rounding up like pavgb. */
+static void visage_average_row_c(uint8_t* dst, const uint8_t* a, const uint8_t* b, int width) {
+  for (int i = 0; i < width; i++) dst[i] = (a[i] + b[i] + 1) >> 1;
+}
+
+/** Averages two lines of 10-bit samples and rounds the result to 8 bits. */
+static void visage_average_shift_row_c(uint8_t* dst, const uint16_t* a, const uint16_t* b,
+                                       int width) {
+  for (int i = 0; i < width; i++) dst[i] = FFMIN((((a[i] + b[i] + 1) >> 1) + 2) >> 2, 255);
+}
+
+#if defined(VISAGE_CONVERT_X86)
+/** Rounds 10-bit samples to 8 bits, 16 at a time. */
+__attribute__((target("sse4.1")))
+static void visage_shift_row_sse4(uint8_t* dst, const uint16_t* src, int width) {
+  const __m128i two = _mm_set1_epi16(2);
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    __m128i lo = _mm_loadu_si128((const __m128i*) (src + i));
+    __m128i hi = _mm_loadu_si128((const __m128i*) (src + i + 8));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+  }
+  visage_shift_row_c(dst + i, src + i, width - i);
+}
+
+/** Averages two lines of 8-bit samples, 16 at a time. */
+__attribute__((target("sse4.1")))
+static void visage_average_row_sse4(uint8_t* dst, const uint8_t* a, const uint8_t* b, int width) {
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*) (a + i));
+    __m128i y = _mm_loadu_si128((const __m128i*) (b + i));
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_avg_epu8(x, y));
+  }
+  visage_average_row_c(dst + i, a + i, b + i, width - i);
+}
+
+/** Averages two lines of 10-bit samples and rounds them to 8 bits, 16 at a time. */
+__attribute__((target("sse4.1")))
+static void visage_average_shift_row_sse4(uint8_t* dst, const uint16_t* a, const uint16_t* b,
+                                          int width) {
+  const __m128i two = _mm_set1_epi16(2);
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    __m128i lo = _mm_avg_epu16(_mm_loadu_si128((const __m128i*) (a + i)),
+                               _mm_loadu_si128((const __m128i*) (b + i)));
+    __m128i hi = _mm_avg_epu16(_mm_loadu_si128((const __m128i*) (a + i + 8)),
+                               _mm_loadu_si128((const __m128i*) (b + i + 8)));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+  }
+  visage_average_shift_row_c(dst + i, a + i, b + i, width - i);
+}
+
+/** Rounds 10-bit samples to 8 bits, 32 at a time. */
+__attribute__((target("avx2")))
+static void visage_shift_row_avx2(uint8_t* dst, const uint16_t* src, int width) {
+  const __m256i two = _mm256_set1_epi16(2);
+  int i = 0;
+  for (; i + 32 <= width; i += 32) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*) (src + i));
+    __m256i hi = _mm256_loadu_si256((const __m256i*) (src + i + 16));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+    // packing works within 128-bit lanes, put the quarters back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8);
+    _mm256_storeu_si256((__m256i*) (dst + i), packed);
+  }
+  visage_shift_row_sse4(dst + i, src + i, width - i);
+}
+
+/** Averages two lines of 8-bit samples, 32 at a time. */
+__attribute__((target("avx2")))
+static void visage_average_row_avx2(uint8_t* dst, const uint8_t* a, const uint8_t* b, int width) {
+  int i = 0;
+  for (; i + 32 <= width; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i*) (b + i));
+    _mm256_storeu_si256((__m256i*) (dst + i), _mm256_avg_epu8(x, y));
+  }
+  visage_average_row_sse4(dst + i, a + i, b + i, width - i);
+}
+
+/** Averages two lines of 10-bit samples and rounds them to 8 bits, 32 at a time. */
+__attribute__((target("avx2")))
+static void visage_average_shift_row_avx2(uint8_t* dst, const uint16_t* a, const uint16_t* b,
+                                          int width) {
+  const __m256i two = _mm256_set1_epi16(2);
+  int i = 0;
+  for (; i + 32 <= width; i += 32) {
+    __m256i lo = _mm256_avg_epu16(_mm256_loadu_si256((const __m256i*) (a + i)),
+                                  _mm256_loadu_si256((const __m256i*) (b + i)));
+    __m256i hi = _mm256_avg_epu16(_mm256_loadu_si256((const __m256i*) (a + i + 16)),
+                                  _mm256_loadu_si256((const __m256i*) (b + i + 16)));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8);
+    _mm256_storeu_si256((__m256i*) (dst + i), packed);
+  }
+  visage_average_shift_row_sse4(dst + i, a + i, b + i, width - i);
+}
+#endif
+
+#if defined(VISAGE_CONVERT_NEON)
+/** Rounds 10-bit samples to 8 bits, 16 at a time. */
+static void visage_shift_row_neon(uint8_t* dst, const uint16_t* src, int width) {
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    uint8x8_t lo = vqrshrn_n_u16(vld1q_u16(src + i), 2);
+    uint8x8_t hi = vqrshrn_n_u16(vld1q_u16(src + i + 8), 2);
+    vst1q_u8(dst + i, vcombine_u8(lo, hi));
+  }
+  visage_shift_row_c(dst + i, src + i, width - i);
+}
+
+/** Averages two lines of 8-bit samples, 16 at a time. */
+static void visage_average_row_neon(uint8_t* dst, const uint8_t* a, const uint8_t* b, int width) {
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+  }
+  visage_average_row_c(dst + i, a + i, b + i, width - i);
+}
+
+/** Averages two lines of 10-bit samples and rounds them to 8 bits, 16 at a time. */
+static void visage_average_shift_row_neon(uint8_t* dst, const uint16_t* a, const uint16_t* b,
+                                          int width) {
+  int i = 0;
+  for (; i + 16 <= width; i += 16) {
+    uint16x8_t lo = vrhaddq_u16(vld1q_u16(a + i), vld1q_u16(b + i));
+    uint16x8_t hi = vrhaddq_u16(vld1q_u16(a + i + 8), vld1q_u16(b + i + 8));
+    vst1q_u8(dst + i, vcombine_u8(vqrshrn_n_u16(lo, 2), vqrshrn_n_u16(hi, 2)));
+  }
+  visage_average_shift_row_c(dst + i, a + i, b + i, width - i);
+}
+#endif
+
+/** Kernels picked for the CPU, set once by visage_init_kernels(). */
+static VisageConvertKernels visage_kernels = {
+  "c", visage_shift_row_c, visage_average_row_c, visage_average_shift_row_c,
+};
+static pthread_once_t visage_kernels_once = PTHREAD_ONCE_INIT;
+
+/** Picks the fastest kernels the CPU supports. */
+static void visage_init_kernels() {
+  int flags = av_get_cpu_flags();
+#if defined(VISAGE_CONVERT_X86)
+  if (flags & AV_CPU_FLAG_AVX2) {
+    visage_kernels = (VisageConvertKernels) {
+      "avx2", visage_shift_row_avx2, visage_average_row_avx2, visage_average_shift_row_avx2,
+    };
+  } else if (flags & AV_CPU_FLAG_SSE4) {
+    visage_kernels = (VisageConvertKernels) {
+      "sse4", visage_shift_row_sse4, visage_average_row_sse4, visage_average_shift_row_sse4,
+    };
+  }
+#elif defined(VISAGE_CONVERT_NEON)
+  if (flags & AV_CPU_FLAG_NEON) {
+    visage_kernels = (VisageConvertKernels) {
+      "neon", visage_shift_row_neon, visage_average_row_neon, visage_average_shift_row_neon,
+    };
+  }
+#else
+  (void) flags;
+#endif
+}
+
+/** Returns the kernels for the CPU. */
+static const VisageConvertKernels* visage_get_kernels() {
+  pthread_once(&visage_kernels_once, visage_init_kernels);
+  return &visage_kernels;
+}
+
+/** Returns 1 if the kernels convert frames of the format. */
+int visage_can_convert(enum AVPixelFormat format) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  // the 10-bit kernels read little endian samples
+  if (format != AV_PIX_FMT_YUV422P) return 0;
+#endif
+  return format == AV_PIX_FMT_YUV422P || format == AV_PIX_FMT_YUV420P10LE
+    || format == AV_PIX_FMT_YUV422P10LE;
+}
+
+/** Converts the frame into YUV420P planes. Outputs 0 on success, -1 if the format is not handled. */
+int visage_convert_frame(const AVFrame* src, uint8_t* const dst[3], const int dst_linesize[3]) {
+  if (!visage_can_convert(src->format)) return -1;
+  const VisageConvertKernels* kernels = visage_get_kernels();
+  int width = src->width;
+  int height = src->height;
+  int chroma_width = (width + 1) >> 1;
+  int chroma_height = (height + 1) >> 1;
+  int high_depth = src->format != AV_PIX_FMT_YUV422P;
+  int full_chroma = src->format != AV_PIX_FMT_YUV420P10LE;
+
+  // luma keeps its size, only its depth may change
+  for (int y = 0; y < height; y++) {
+    const uint8_t* line = src->data[0] + (ptrdiff_t) y * src->linesize[0];
+    uint8_t* out = dst[0] + (ptrdiff_t) y * dst_linesize[0];
+    if (high_depth) {
+      kernels->shift_row(out, (const uint16_t*) line, width);
+    } else {
+      memcpy(out, line, width);
+    }
+  }
+
+  // chroma of 4:2:2 is halved vertically by averaging line pairs
+  for (int plane = 1; plane < 3; plane++) {
+    for (int y = 0; y < chroma_height; y++) {
+      uint8_t* out = dst[plane] + (ptrdiff_t) y * dst_linesize[plane];
+      if (!full_chroma) {
+        const uint8_t* line = src->data[plane] + (ptrdiff_t) y * src->linesize[plane];
+        kernels->shift_row(out, (const uint16_t*) line, chroma_width);
+        continue;
+      }
+
+      // the last line of an odd height is averaged with itself
+      int second = FFMIN(2 * y + 1, height - 1);
+      const uint8_t* a = src->data[plane] + (ptrdiff_t) (2 * y) * src->linesize[plane];
+      const uint8_t* b = src->data[plane] + (ptrdiff_t) second * src->linesize[plane];
+      if (high_depth) {
+        kernels->average_shift_row(out, (const uint16_t*) a, (const uint16_t*) b, chroma_width);
+      } else {
+        kernels->average_row(out, a, b, chroma_width);
+      }
+    }
+  }
+
+  return 0;
+}
+
+/** Returns the name of the instruction set of the kernels. */
+const char* visage_convert_isa() {
+  return visage_get_kernels()->name;
+}
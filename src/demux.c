@@ -0,0 +1,365 @@
+#include <SDL3/SDL_audio.h>
+#include <libavcodec/packet.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "visage_demux.h"
+#include "visage_packet_queue.h"
+#include "visage_stats.h"
+
+/** Number of packets a queue needs at least to count as filled, for packets without durations. */
+#define VISAGE_DEMUX_QUEUE_PACKETS 25
+
+/** Allocates and initializes the demuxer. Returns NULL on failure. */
+VisageDemuxer* visage_alloc_demuxer() {
+  VisageDemuxer* demuxer = av_mallocz(sizeof(VisageDemuxer));
+  if (!demuxer) return NULL;
+
+  // initialize properties to null
+  demuxer->format_ctx = NULL;
+  demuxer->video = NULL;
+  demuxer->audio = NULL;
+  demuxer->queue_duration = VISAGE_DEMUX_QUEUE_MS;
+  demuxer->max_queue_size = VISAGE_DEMUX_QUEUE_SIZE;
+  demuxer->keyframes = NULL;
+  demuxer->keyframe_pos = NULL;
+  demuxer->keyframe_next = NULL;
+  demuxer->nb_keyframes = 0;
+  demuxer->keyframes_capacity = 0;
+  demuxer->seek_by_bytes = 0;
+  demuxer->last_keyframe = AV_NOPTS_VALUE;
+  demuxer->reverse_end = AV_NOPTS_VALUE;
+
+  return demuxer;
+}
+
+/** Frees the demuxer. */
+void visage_free_demuxer(VisageDemuxer** demuxer) {
+  if (!*demuxer) return;
+
+  av_freep(&(*demuxer)->keyframes);
+  av_freep(&(*demuxer)->keyframe_pos);
+  av_freep(&(*demuxer)->keyframe_next);
+  av_free(*demuxer);
+  *demuxer = NULL;
+}
+
+/** Initializes the demuxer for Visage. Outputs 0 on success, -1 on error. */
+int visage_init_demuxer(AVFormatContext* format_ctx, VisageVideo* video, VisageAudio* audio,
+                        VisageDemuxer* demuxer) {
+  if (!video->packets || (audio && !audio->packets)) {
+    printf("Error: decoding contexts must be initialized before the demuxer\n");
+    return -1;
+  }
+
+  demuxer->format_ctx = format_ctx;
+  demuxer->video = video;
+  demuxer->audio = audio;
+
+  // byte offsets stay valid where timestamps jump, as ffplay decides it
+  const AVInputFormat* iformat = format_ctx->iformat;
+  demuxer->seek_by_bytes = !(iformat->flags & AVFMT_NO_BYTE_SEEK)
+    && (iformat->flags & AVFMT_TS_DISCONT) && strcmp(iformat->name, "ogg") != 0;
+
+  return 0;
+}
+
+/** Returns 1 if either packet queue has been aborted, 0 otherwise. */
+static int visage_demux_aborted(VisageDemuxer* demuxer) {
+  return visage_packet_queue_aborted(demuxer->video->packets)
+    || (demuxer->audio && visage_packet_queue_aborted(demuxer->audio->packets));
+}
+
+/** Returns 1 if the packet queue holds enough playing time. */
+static int visage_queue_filled(VisageDemuxer* demuxer, VisagePacketQueue* queue) {
+  if (visage_count_packets(queue) < VISAGE_DEMUX_QUEUE_PACKETS) return 0;
+  int64_t duration = visage_packet_queue_duration(queue);
+  return duration == 0 || duration >= demuxer->queue_duration;
+}
+
+/** Returns 1 if the packet queues hold enough to stop reading ahead. */
+static int visage_demux_full(VisageDemuxer* demuxer) {
+  // no audio is read while playing backwards
+  int reverse = demuxer->reverse_end != AV_NOPTS_VALUE;
+  VisagePacketQueue* audio = demuxer->audio && !reverse ? demuxer->audio->packets : NULL;
+  int64_t size = visage_packet_queue_size(demuxer->video->packets)
+    + (demuxer->audio ? visage_packet_queue_size(demuxer->audio->packets) : 0);
+  if (size >= demuxer->max_queue_size) return 1;
+  return visage_queue_filled(demuxer, demuxer->video->packets)
+    && (!audio || visage_queue_filled(demuxer, audio));
+}
+
+/** Returns the index of the first keyframe at or after the timestamp. */
+static int visage_find_keyframe(VisageDemuxer* demuxer, int64_t ts) {
+  int low = 0;
+  int high = demuxer->nb_keyframes;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (demuxer->keyframes[mid] < ts) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/** Inserts a keyframe into the index at the position. Returns 0 on success, -1 if memory runs out. */
+static int visage_insert_keyframe(VisageDemuxer* demuxer, int idx, int64_t ts, int64_t pos) {
+  if (demuxer->nb_keyframes == demuxer->keyframes_capacity) {
+    int capacity = demuxer->keyframes_capacity ? demuxer->keyframes_capacity * 2 : 256;
+    int64_t* keyframes = av_realloc_array(demuxer->keyframes, capacity, sizeof(int64_t));
+    if (!keyframes) return -1;
+    demuxer->keyframes = keyframes;
+    int64_t* keyframe_pos = av_realloc_array(demuxer->keyframe_pos, capacity, sizeof(int64_t));
+    if (!keyframe_pos) return -1;
+    demuxer->keyframe_pos = keyframe_pos;
+    uint8_t* keyframe_next = av_realloc_array(demuxer->keyframe_next, capacity, sizeof(uint8_t));
+    if (!keyframe_next) return -1;
+    demuxer->keyframe_next = keyframe_next;
+    demuxer->keyframes_capacity = capacity;
+  }
+
+  // keyframes usually arrive in order, so this rarely moves anything
+  int moved = demuxer->nb_keyframes - idx;
+  memmove(&demuxer->keyframes[idx + 1], &demuxer->keyframes[idx], moved * sizeof(int64_t));
+  memmove(&demuxer->keyframe_pos[idx + 1], &demuxer->keyframe_pos[idx], moved * sizeof(int64_t));
+  memmove(&demuxer->keyframe_next[idx + 1], &demuxer->keyframe_next[idx], moved * sizeof(uint8_t));
+  demuxer->keyframes[idx] = ts;
+  demuxer->keyframe_pos[idx] = pos;
+  demuxer->keyframe_next[idx] = 0;
+  demuxer->nb_keyframes++;
+
+  // a keyframe between two linked ones means they were not next to each other after all
+  if (idx > 0) demuxer->keyframe_next[idx - 1] = 0;
+
+  return 0;
+}
+
+/** Adds a keyframe timestamp and byte offset to the index, keeping it sorted and linked to the keyframe read before it. */
+static void visage_index_keyframe(VisageDemuxer* demuxer, int64_t ts, int64_t pos) {
+  int idx = visage_find_keyframe(demuxer, ts);
+  if (idx < demuxer->nb_keyframes && demuxer->keyframes[idx] == ts) {
+    if (demuxer->keyframe_pos[idx] < 0) demuxer->keyframe_pos[idx] = pos;
+  } else if (visage_insert_keyframe(demuxer, idx, ts, pos) < 0) {
+    // leave the index as it is, without linking over the missing keyframe
+    demuxer->last_keyframe = AV_NOPTS_VALUE;
+    return;
+  }
+
+  // no keyframe lies between two keyframes read one after the other
+  if (idx > 0 && demuxer->keyframes[idx - 1] == demuxer->last_keyframe) {
+    demuxer->keyframe_next[idx - 1] = 1;
+  }
+  demuxer->last_keyframe = ts;
+}
+
+/** Returns the index of the keyframe nearest to the timestamp, or -1 if the index does not know the keyframes around it. */
+static int visage_nearest_keyframe(VisageDemuxer* demuxer, int64_t ts) {
+  int idx = visage_find_keyframe(demuxer, ts);
+  if (idx < demuxer->nb_keyframes && demuxer->keyframes[idx] == ts) return idx;
+
+  // parts of the file that were never read may hide keyframes between indexed ones
+  if (idx == 0 || idx == demuxer->nb_keyframes || !demuxer->keyframe_next[idx - 1]) return -1;
+
+  // pick the closer of the keyframes around the timestamp
+  int64_t before = demuxer->keyframes[idx - 1];
+  int64_t after = demuxer->keyframes[idx];
+  return ts - before <= after - ts ? idx - 1 : idx;
+}
+
+/** Returns the index of the last keyframe before the timestamp, or -1 if the index does not know it. */
+static int visage_keyframe_before(VisageDemuxer* demuxer, int64_t ts) {
+  int idx = visage_find_keyframe(demuxer, ts);
+
+  // the keyframe at or after the timestamp must have been read right after it
+  if (idx == 0 || idx == demuxer->nb_keyframes || !demuxer->keyframe_next[idx - 1]) return -1;
+  return idx - 1;
+}
+
+/** Seeks to the indexed keyframe, by its byte offset when the format allows it. Returns a negative error code on failure. */
+static int visage_seek_keyframe(VisageDemuxer* demuxer, int idx) {
+  int64_t pos = demuxer->keyframe_pos[idx];
+  if (demuxer->seek_by_bytes && pos >= 0) {
+    return avformat_seek_file(demuxer->format_ctx, -1, pos, pos, pos, AVSEEK_FLAG_BYTE);
+  }
+  int64_t ts = demuxer->keyframes[idx];
+  return avformat_seek_file(demuxer->format_ctx, demuxer->video->stream_idx, INT64_MIN, ts, ts, 0);
+}
+
+/** Carries out the seek requested on the video context. */
+static void visage_demux_seek(VisageDemuxer* demuxer) {
+  VisageVideo* video = demuxer->video;
+  VisageAudio* audio = demuxer->audio;
+  AVStream* stream = demuxer->format_ctx->streams[video->stream_idx];
+  int64_t target = atomic_load(&video->seek_target);
+  int mode = atomic_load(&video->seek_mode);
+
+  // find where to resume decoding in the video stream time base
+  int64_t ts = av_rescale_q(target, (AVRational) {1, 1000}, stream->time_base);
+  int64_t min_ts = INT64_MIN;
+  int64_t max_ts = ts;
+  int keyframe = -1;
+  int ret = 0;
+  demuxer->reverse_end = AV_NOPTS_VALUE;
+  demuxer->last_keyframe = AV_NOPTS_VALUE;
+  if (mode == VISAGE_SEEK_BACKWARD) {
+    // the GOPs before the target are read one by one from the next loop on
+    demuxer->reverse_end = ts;
+  } else if (mode == VISAGE_SEEK_FAST) {
+    // snap to a known keyframe, or let the format pick the nearest one
+    keyframe = visage_nearest_keyframe(demuxer, ts);
+    if (keyframe < 0) max_ts = INT64_MAX;
+  }
+
+  if (keyframe >= 0) {
+    ret = visage_seek_keyframe(demuxer, keyframe);
+  } else if (mode != VISAGE_SEEK_BACKWARD) {
+    ret = avformat_seek_file(demuxer->format_ctx, video->stream_idx, min_ts, ts, max_ts, 0);
+  }
+  if (ret < 0) {
+    printf("Warning: failed to seek: %s\n", av_err2str(ret));
+  } else {
+    // skip to the exact target when decoding from the keyframe before it
+    int64_t seek_pts = mode == VISAGE_SEEK_ACCURATE ? target : INT64_MIN;
+    atomic_store(&video->seek_pts, seek_pts);
+
+    // play backwards from the target, or forwards again
+    atomic_store(&video->reverse, mode == VISAGE_SEEK_BACKWARD);
+    atomic_store(&video->resume_pts, target);
+
+    // throw away everything queued from the old position
+    visage_flush_packet_queue(video->packets);
+    if (audio) {
+      atomic_store(&audio->seek_pts, seek_pts);
+      visage_flush_packet_queue(audio->packets);
+      SDL_ClearAudioStream(audio->stream);
+    }
+    visage_reset_clock(video->clock);
+  }
+
+  atomic_store(&video->seek_request, 0);
+}
+
+/** Queues the video packets of the GOP before reverse_end, moving the end to its keyframe. Returns 0 on success, 1 at the start of the file, -1 on abort. */
+static int visage_demux_gop(VisageDemuxer* demuxer, AVPacket* packet) {
+  VisageVideo* video = demuxer->video;
+  int64_t end = demuxer->reverse_end;
+
+  // go to the keyframe before the end, from the index when it knows that one
+  int idx = visage_keyframe_before(demuxer, end);
+  int ret = idx >= 0 ? visage_seek_keyframe(demuxer, idx)
+    : avformat_seek_file(demuxer->format_ctx, video->stream_idx, INT64_MIN, end - 1, end - 1, 0);
+  if (ret < 0) return 1;
+  demuxer->last_keyframe = AV_NOPTS_VALUE;
+
+  // read up to the keyframe the GOP queued last starts with
+  int64_t start = AV_NOPTS_VALUE;
+  while (1) {
+    int64_t begin = av_gettime_relative();
+    if (av_read_frame(demuxer->format_ctx, packet) < 0) break;
+    visage_record_stage(video->stats, VISAGE_STAGE_DEMUX, begin);
+    if (packet->stream_index != video->stream_idx) {
+      av_packet_unref(packet);
+      continue;
+    }
+
+    int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    int key = packet->flags & AV_PKT_FLAG_KEY;
+    if (start == AV_NOPTS_VALUE) start = pts;
+    if (start >= end || (key && pts != AV_NOPTS_VALUE && pts >= end)) {
+      // the keyframe the GOP ends at follows the ones read before it
+      if (key && pts != AV_NOPTS_VALUE && start < end) {
+        visage_index_keyframe(demuxer, pts, packet->pos);
+      }
+      av_packet_unref(packet);
+      break;
+    }
+    if (key && pts != AV_NOPTS_VALUE) visage_index_keyframe(demuxer, pts, packet->pos);
+    ret = visage_put_packet(video->packets, packet);
+    av_packet_unref(packet);
+    if (ret < 0) return -1;
+  }
+
+  // nothing before the end means the first GOP has been queued already
+  if (start == AV_NOPTS_VALUE || start >= end) return 1;
+  demuxer->reverse_end = start;
+
+  return 0;
+}
+
+/** Reads packets from the file into the queues. */
+int visage_process_demux(VisageDemuxer* demuxer) {
+  // allocate memory for packets
+  AVPacket* packet = av_packet_alloc();
+  if (!packet) {
+    printf("Error: failed to allocate memory for packets\n");
+    visage_finish_packet_queue(demuxer->video->packets);
+    if (demuxer->audio) visage_finish_packet_queue(demuxer->audio->packets);
+    return -1;
+  }
+
+  int eof = 0;
+  while (!visage_demux_aborted(demuxer)) {
+    // seek when asked to, reading from the new position again
+    if (atomic_load(&demuxer->video->seek_request)) {
+      visage_demux_seek(demuxer);
+      eof = 0;
+      continue;
+    }
+
+    // wait while the decoders have enough packets to work on, or for a seek at the end
+    if (eof || visage_demux_full(demuxer)) {
+      av_usleep(10000);
+      continue;
+    }
+
+    // read the file backwards one GOP at a time, draining the decoder at its start
+    if (demuxer->reverse_end != AV_NOPTS_VALUE) {
+      int ret = visage_demux_gop(demuxer, packet);
+      if (ret < 0) break;
+      if (ret > 0) {
+        visage_finish_packet_queue(demuxer->video->packets);
+        eof = 1;
+      }
+      continue;
+    }
+
+    // read the next packet, letting the decoders drain at the end of the file
+    int64_t start = av_gettime_relative();
+    if (av_read_frame(demuxer->format_ctx, packet) < 0) {
+      visage_finish_packet_queue(demuxer->video->packets);
+      if (demuxer->audio) visage_finish_packet_queue(demuxer->audio->packets);
+      eof = 1;
+      continue;
+    }
+
+    visage_record_stage(demuxer->video->stats, VISAGE_STAGE_DEMUX, start);
+
+    // sources such as rtsp learn when the stream was captured once they are playing
+    if (demuxer->format_ctx->start_time_realtime != AV_NOPTS_VALUE) {
+      atomic_store(&demuxer->video->realtime_start, demuxer->format_ctx->start_time_realtime);
+    }
+
+    // dispatch the packet to the matching decoder
+    int ret = 0;
+    if (packet->stream_index == demuxer->video->stream_idx) {
+      int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+      if ((packet->flags & AV_PKT_FLAG_KEY) && ts != AV_NOPTS_VALUE) {
+        visage_index_keyframe(demuxer, ts, packet->pos);
+      }
+      ret = visage_put_packet(demuxer->video->packets, packet);
+    } else if (demuxer->audio && packet->stream_index == demuxer->audio->stream_idx) {
+      ret = visage_put_packet(demuxer->audio->packets, packet);
+    }
+    av_packet_unref(packet);
+    if (ret < 0) break;
+  }
+
+  av_packet_free(&packet);
+
+  return 0;
+}
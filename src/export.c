@@ -0,0 +1,493 @@
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "visage_clock.h"
+#include "visage_demux.h"
+#include "visage_packet_queue.h"
+#include "visage_video.h"
+#include "visage_workers.h"
+
+/** Default number of thumbnails taken from every file. */
+#define VISAGE_EXPORT_COUNT 16
+
+/** Default width thumbnails are scaled down to, in pixels. */
+#define VISAGE_EXPORT_WIDTH 320
+
+/** JPEG quantizer the thumbnails are encoded with, from 2 (best) to 31. */
+#define VISAGE_EXPORT_QSCALE 3
+
+/** One still taken from the video, waiting to be encoded. */
+typedef struct VisageThumbnail {
+    /**
+     * Reference to the decoded and scaled frame, blank once written.
+     */
+    AVFrame* frame;
+
+    /**
+     * Number of the thumbnail within the file, from 1.
+     */
+    int number;
+} VisageThumbnail;
+
+/**
+ * Thumbnails of one file, handed from the thread taking them to the
+ * workers encoding them.
+ *
+ * Thread safety: the thumbnails, their count and the next one to encode
+ * are protected by the mutex.
+ */
+typedef struct VisageExport {
+    /**
+     * Path the files are written to, followed by the thumbnail number.
+     */
+    const char* prefix;
+
+    /**
+     * Thumbnails taken so far, with room for all of them.
+     */
+    VisageThumbnail* thumbnails;
+    int nb_thumbnails;
+
+    /**
+     * Index of the next thumbnail to encode.
+     */
+    int next;
+
+    /**
+     * Set once no more thumbnails will be taken.
+     */
+    int finished;
+
+    /**
+     * Number of thumbnails written and failed to be written.
+     */
+    atomic_int written;
+    atomic_int failed;
+
+    /**
+     * Mutex protecting the thumbnails.
+     */
+    pthread_mutex_t mutex;
+} VisageExport;
+
+/** State of one task encoding thumbnails, kept from one run to the next. */
+typedef struct VisageEncoder {
+    /**
+     * Export the thumbnails are taken from.
+     */
+    VisageExport* export;
+
+    /**
+     * Conversion context into the JPEG pixel format, and the frame it
+     * converts into.
+     */
+    struct SwsContext* sws_ctx;
+    AVFrame* converted;
+
+    /**
+     * Packet receiving the encoded image.
+     */
+    AVPacket* packet;
+} VisageEncoder;
+
+/** Thread entry point for reading packets from the file. */
+static void* visage_demux_thread(void* arg) {
+  visage_process_demux(arg);
+  return NULL;
+}
+
+/** Thread entry point for decoding video frames. */
+static void* visage_video_thread(void* arg) {
+  visage_process_video(arg);
+  return NULL;
+}
+
+/** Command line options. */
+static const struct option visage_options[] = {
+  {"count", required_argument, NULL, 'n'},
+  {"width", required_argument, NULL, 'w'},
+  {"height", required_argument, NULL, 'H'},
+  {"output", required_argument, NULL, 'o'},
+  {"hwaccel", required_argument, NULL, 'a'},
+  {"threads", required_argument, NULL, 't'},
+  {"help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0},
+};
+
+/** Prints the command line usage. */
+static void visage_usage(const char* program) {
+  printf("Usage: %s [options] <file>...\n", program);
+  printf("Writes thumbnails evenly spaced over every file as JPEG images, without a window.\n");
+  printf("Only keyframes are decoded, so each thumbnail shows the keyframe nearest its time.\n");
+  printf("Options:\n");
+  printf("  --count <n>       thumbnails per file (default %d)\n", VISAGE_EXPORT_COUNT);
+  printf("  --width <px>      largest thumbnail width, 0 for any (default %d)\n",
+         VISAGE_EXPORT_WIDTH);
+  printf("  --height <px>     largest thumbnail height, 0 for any (default)\n");
+  printf("  --output <prefix> path before the thumbnail number, such as thumbs/clip for\n");
+  printf("                    thumbs/clip-001.jpg, the file name without extension by default\n");
+  printf("  --hwaccel <type>  hardware decoding: none (default), auto, or a device type\n");
+  printf("  --threads <n>     encoding workers, 0 for one per physical core (default)\n");
+}
+
+/** Converts and encodes the thumbnail into a JPEG file. Outputs 0 on success, -1 on error. */
+static int visage_write_thumbnail(VisageEncoder* encoder, AVFrame* frame, int number) {
+  int status = -1;
+  AVCodecContext* codec_ctx = NULL;
+  FILE* file = NULL;
+
+  // bring the frame into the full range format of JPEG
+  AVFrame* converted = encoder->converted;
+  av_frame_unref(converted);
+  converted->format = AV_PIX_FMT_YUVJ420P;
+  converted->width = frame->width;
+  converted->height = frame->height;
+  if (av_frame_get_buffer(converted, 0) < 0) {
+    printf("Error: failed to allocate memory for thumbnails\n");
+    return -1;
+  }
+  encoder->sws_ctx = sws_getCachedContext(encoder->sws_ctx, frame->width, frame->height,
+                                          frame->format, converted->width, converted->height,
+                                          converted->format, SWS_BILINEAR, NULL, NULL, NULL);
+  if (!encoder->sws_ctx) {
+    printf("Error: failed to create SWS conversion context\n");
+    return -1;
+  }
+  sws_scale(encoder->sws_ctx, (const uint8_t *const *) frame->data, frame->linesize, 0,
+            frame->height, converted->data, converted->linesize);
+
+  // open an encoder for the size of the thumbnail
+  const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+  if (!codec) {
+    printf("Error: no JPEG encoder available\n");
+    return -1;
+  }
+  codec_ctx = avcodec_alloc_context3(codec);
+  if (!codec_ctx) {
+    printf("Error: failed to allocate memory for the encoder\n");
+    return -1;
+  }
+  codec_ctx->width = converted->width;
+  codec_ctx->height = converted->height;
+  codec_ctx->pix_fmt = AV_PIX_FMT_YUVJ420P;
+  codec_ctx->time_base = (AVRational) {1, 25};
+  codec_ctx->flags |= AV_CODEC_FLAG_QSCALE;
+  codec_ctx->global_quality = FF_QP2LAMBDA * VISAGE_EXPORT_QSCALE;
+  codec_ctx->thread_count = 1;
+  if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
+    printf("Error: failed to initialize the JPEG encoder\n");
+    goto cleanup;
+  }
+
+  // encode the single image
+  converted->quality = codec_ctx->global_quality;
+  converted->pts = 0;
+  if (avcodec_send_frame(codec_ctx, converted) < 0 || avcodec_send_frame(codec_ctx, NULL) < 0
+      || avcodec_receive_packet(codec_ctx, encoder->packet) < 0) {
+    printf("Error: failed to encode thumbnail %d\n", number);
+    goto cleanup;
+  }
+
+  // write it next to the other thumbnails of the file
+  char path[4096];
+  snprintf(path, sizeof(path), "%s-%03d.jpg", encoder->export->prefix, number);
+  file = fopen(path, "wb");
+  if (!file || fwrite(encoder->packet->data, 1, encoder->packet->size, file)
+      != (size_t) encoder->packet->size) {
+    printf("Error: failed to write %s\n", path);
+    goto cleanup;
+  }
+  status = 0;
+
+  // cleanup everything
+ cleanup:
+  if (file) fclose(file);
+  av_packet_unref(encoder->packet);
+  avcodec_free_context(&codec_ctx);
+
+  return status;
+}
+
+/** Encodes the next thumbnail taken. Returns 1 if it did, 0 if none is waiting, -1 once all are written. */
+static int visage_encode_task(void* arg) {
+  VisageEncoder* encoder = arg;
+  VisageExport* export = encoder->export;
+
+  // take the next thumbnail, or finish once there will be none
+  pthread_mutex_lock(&export->mutex);
+  if (export->next == export->nb_thumbnails) {
+    int finished = export->finished;
+    pthread_mutex_unlock(&export->mutex);
+    return finished ? -1 : 0;
+  }
+  VisageThumbnail* thumbnail = &export->thumbnails[export->next++];
+  pthread_mutex_unlock(&export->mutex);
+
+  // the thumbnail is only ever handed to this task, so it needs no lock anymore
+  if (visage_write_thumbnail(encoder, thumbnail->frame, thumbnail->number) < 0) {
+    atomic_fetch_add(&export->failed, 1);
+  } else {
+    atomic_fetch_add(&export->written, 1);
+  }
+  av_frame_unref(thumbnail->frame);
+
+  return 1;
+}
+
+/** Takes the first frame decoded after the latest seek. Returns 1 if there is one, 0 if the video ended before. */
+static int visage_take_thumbnail(VisageVideo* video, AVFrame* frame) {
+  // the serial moves on before the request is cleared
+  while (atomic_load(&video->seek_request)) av_usleep(100);
+  int serial = visage_packet_queue_serial(video->packets);
+
+  // discard what was decoded before the seek
+  while (1) {
+    VisageVideoFrames* queued = visage_peek_video(video);
+    if (queued && queued->serial != serial) {
+      visage_pop_video(video);
+      continue;
+    }
+    if (queued) {
+      int ret = av_frame_ref(frame, queued->frame);
+      visage_pop_video(video);
+      return ret < 0 ? 0 : 1;
+    }
+    if (visage_video_finished(video)) return 0;
+    av_usleep(100);
+  }
+}
+
+/** Returns the file name without its directory and extension, in a newly allocated string. */
+static char* visage_default_prefix(const char* file) {
+  const char* name = strrchr(file, '/');
+  name = name ? name + 1 : file;
+  char* prefix = av_strdup(name);
+  if (!prefix) return NULL;
+  char* extension = strrchr(prefix, '.');
+  if (extension && extension != prefix) *extension = '\0';
+  return prefix;
+}
+
+/** Writes the thumbnails of the file. Outputs 0 on success, -1 on error. */
+static int visage_export_file(const char* file, const char* prefix, const char* hwaccel,
+                              int count, int width, int height, int worker_count) {
+  int status = -1;
+  AVFormatContext* format_ctx = NULL;
+  VisageVideo* video = NULL;
+  VisageClock* clock = NULL;
+  VisageDemuxer* demuxer = NULL;
+  VisageWorkers* workers = NULL;
+  VisageEncoder* encoders = NULL;
+  int nb_encoders = 0;
+  int started = 0;
+  pthread_t demux_thread, video_thread;
+  VisageExport export = {0};
+  pthread_mutex_init(&export.mutex, NULL);
+  export.prefix = prefix;
+
+  // open the file
+  int ret = avformat_open_input(&format_ctx, file, NULL, NULL);
+  if (ret != 0) {
+    printf("Error: failed to open %s: %s\n", file, av_err2str(ret));
+    goto cleanup;
+  }
+  avformat_find_stream_info(format_ctx, NULL);
+  if (format_ctx->duration <= 0) {
+    printf("Error: the duration of %s is unknown\n", file);
+    goto cleanup;
+  }
+  int64_t duration = format_ctx->duration / (AV_TIME_BASE / 1000);
+
+  // set up the video pipeline to decode keyframes only, scaled to the thumbnail size
+  video = visage_alloc_video();
+  clock = visage_alloc_clock();
+  demuxer = visage_alloc_demuxer();
+  export.thumbnails = av_calloc(count, sizeof(VisageThumbnail));
+  if (!video || !clock || !demuxer || !export.thumbnails) {
+    printf("Error: failed to allocate memory for the pipeline\n");
+    goto cleanup;
+  }
+  video->hwaccel = hwaccel;
+  video->keyframes_only = 1;
+  video->fit_width = width;
+  video->fit_height = height;
+
+  // every thumbnail is taken right after a seek, so nothing needs to be decoded ahead or kept
+  video->frames_capacity = 2;
+  video->cache_size = 0;
+  if (visage_init_video(format_ctx, video) < 0) goto cleanup;
+  video->clock = clock;
+  if (visage_init_demuxer(format_ctx, video, NULL, demuxer) < 0) goto cleanup;
+
+  // encode the thumbnails on their own workers while the next ones are decoded
+  workers = visage_alloc_workers();
+  if (!workers || visage_init_workers(workers, worker_count) < 0) {
+    printf("Error: failed to start the encoding workers\n");
+    goto cleanup;
+  }
+  encoders = av_calloc(workers->nb_workers, sizeof(VisageEncoder));
+  if (!encoders) {
+    printf("Error: failed to allocate memory for the encoders\n");
+    goto cleanup;
+  }
+  nb_encoders = workers->nb_workers;
+  for (int i = 0; i < nb_encoders; i++) {
+    encoders[i].export = &export;
+    encoders[i].converted = av_frame_alloc();
+    encoders[i].packet = av_packet_alloc();
+    if (!encoders[i].converted || !encoders[i].packet) {
+      printf("Error: failed to allocate memory for the encoders\n");
+      goto cleanup;
+    }
+    if (!visage_add_task(workers, visage_encode_task, &encoders[i], VISAGE_PRIORITY_HIGH)) {
+      goto cleanup;
+    }
+  }
+
+  // run the demuxer and decoder
+  int64_t start = av_gettime_relative();
+  pthread_create(&demux_thread, NULL, visage_demux_thread, demuxer);
+  pthread_create(&video_thread, NULL, visage_video_thread, video);
+  started = 1;
+
+  // seek to the middle of evenly spaced parts of the file, handing every frame to the encoders
+  for (int i = 0; i < count; i++) {
+    visage_seek_video(video, duration * (2 * i + 1) / (2 * count), VISAGE_SEEK_FAST);
+    AVFrame* frame = av_frame_alloc();
+    if (!frame) {
+      printf("Error: failed to allocate memory for thumbnails\n");
+      break;
+    }
+    if (!visage_take_thumbnail(video, frame)) {
+      av_frame_free(&frame);
+      break;
+    }
+    pthread_mutex_lock(&export.mutex);
+    export.thumbnails[export.nb_thumbnails].frame = frame;
+    export.thumbnails[export.nb_thumbnails].number = export.nb_thumbnails + 1;
+    export.nb_thumbnails++;
+    pthread_mutex_unlock(&export.mutex);
+  }
+
+  // wait for the encoders to write all of them
+  pthread_mutex_lock(&export.mutex);
+  export.finished = 1;
+  int taken = export.nb_thumbnails;
+  pthread_mutex_unlock(&export.mutex);
+  while (atomic_load(&export.written) + atomic_load(&export.failed) < taken) av_usleep(1000);
+
+  printf("%s: %d thumbnails in %.3f s\n", file, atomic_load(&export.written),
+         (av_gettime_relative() - start) / 1000000.0);
+  status = atomic_load(&export.failed) == 0 && taken > 0 ? 0 : -1;
+
+  // cleanup everything
+ cleanup:
+  visage_free_workers(&workers);
+  if (started) {
+    visage_abort_video(video);
+    pthread_join(demux_thread, NULL);
+    pthread_join(video_thread, NULL);
+  }
+  for (int i = 0; i < nb_encoders; i++) {
+    sws_freeContext(encoders[i].sws_ctx);
+    av_frame_free(&encoders[i].converted);
+    av_packet_free(&encoders[i].packet);
+  }
+  av_free(encoders);
+  visage_free_demuxer(&demuxer);
+  visage_free_video(&video);
+  visage_free_clock(&clock);
+  avformat_close_input(&format_ctx);
+  for (int i = 0; i < export.nb_thumbnails; i++) av_frame_free(&export.thumbnails[i].frame);
+  av_free(export.thumbnails);
+  pthread_mutex_destroy(&export.mutex);
+
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  // parse the command line options
+  int count = VISAGE_EXPORT_COUNT;
+  int width = VISAGE_EXPORT_WIDTH;
+  int height = 0;
+  const char* output = NULL;
+  const char* hwaccel = "none";
+  int worker_count = 0;
+  int option;
+  while ((option = getopt_long(argc, argv, "h", visage_options, NULL)) != -1) {
+    switch (option) {
+    case 'n':
+      count = atoi(optarg);
+      if (count <= 0) {
+        printf("Error: invalid thumbnail count \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'w':
+      width = atoi(optarg);
+      if (width < 0) {
+        printf("Error: invalid width \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'H':
+      height = atoi(optarg);
+      if (height < 0) {
+        printf("Error: invalid height \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'a':
+      hwaccel = optarg;
+      break;
+    case 't':
+      worker_count = atoi(optarg);
+      if (worker_count < 0) {
+        printf("Error: invalid thread count \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    default:
+      visage_usage(argv[0]);
+      return option == 'h' ? 0 : -1;
+    }
+  }
+
+  // ensure that files are passed into the program, and that their thumbnails do not collide
+  if (optind >= argc) {
+    visage_usage(argv[0]);
+    return -1;
+  }
+  if (output && argc - optind > 1) {
+    printf("Error: --output only applies to a single file\n");
+    return -1;
+  }
+
+  // export every file on its own
+  int failed = 0;
+  for (int i = optind; i < argc; i++) {
+    char* prefix = output ? av_strdup(output) : visage_default_prefix(argv[i]);
+    if (!prefix) {
+      printf("Error: failed to allocate memory for the output path\n");
+      return -1;
+    }
+    if (visage_export_file(argv[i], prefix, hwaccel, count, width, height, worker_count) < 0) {
+      failed++;
+    }
+    av_free(prefix);
+  }
+
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,189 @@
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <string.h>
+#include "visage_frame_cache.h"
+
+/** Allocates the frame cache. Returns NULL on failure. */
+VisageFrameCache* visage_alloc_frame_cache() {
+  VisageFrameCache* cache = av_mallocz(sizeof(VisageFrameCache));
+  if (!cache) return NULL;
+
+  // initialize properties to empty
+  cache->entries = NULL;
+  cache->nb_entries = 0;
+  cache->entries_capacity = 0;
+  cache->size = 0;
+  cache->max_size = VISAGE_FRAME_CACHE_SIZE;
+  cache->uses = 0;
+  cache->run = 0;
+  cache->seq = 0;
+
+  return cache;
+}
+
+/** Returns the index of the first cached frame at or after the timestamp. */
+static int visage_search_frame_cache(VisageFrameCache* cache, int64_t pts) {
+  int low = 0;
+  int high = cache->nb_entries;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (cache->entries[mid].pts < pts) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/** Returns the bytes of picture memory held by the frame. */
+static int64_t visage_frame_size(const AVFrame* frame) {
+  int64_t size = 0;
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+    size += frame->buf[i]->size;
+  }
+  return size;
+}
+
+/** Removes the cached frame at the index, keeping its blank frame as a spare past the last entry. */
+static void visage_remove_cached_frame(VisageFrameCache* cache, int idx) {
+  cache->size -= cache->entries[idx].size;
+  AVFrame* spare = cache->entries[idx].frame;
+  av_frame_unref(spare);
+  memmove(&cache->entries[idx], &cache->entries[idx + 1],
+          (cache->nb_entries - idx - 1) * sizeof(VisageCachedFrame));
+  cache->nb_entries--;
+  cache->entries[cache->nb_entries].frame = spare;
+}
+
+/** Drops the frames used longest ago until the size fits into the budget. */
+static void visage_evict_frame_cache(VisageFrameCache* cache, int64_t size) {
+  while (cache->nb_entries > 0 && cache->size + size > cache->max_size) {
+    int oldest = 0;
+    for (int i = 1; i < cache->nb_entries; i++) {
+      if (cache->entries[i].used < cache->entries[oldest].used) oldest = i;
+    }
+    visage_remove_cached_frame(cache, oldest);
+  }
+}
+
+/** Adds a reference to the frame, continuing the current run. Outputs 0 on success, -1 on error. */
+int visage_put_cached_frame(VisageFrameCache* cache, const AVFrame* frame, int64_t pts,
+                            int64_t duration) {
+  int64_t size = visage_frame_size(frame);
+  if (size > cache->max_size) {
+    visage_break_frame_cache(cache);
+    return 0;
+  }
+
+  // replace the frame cached for the same time, which goes with the new run from now on
+  int idx = visage_search_frame_cache(cache, pts);
+  if (idx < cache->nb_entries && cache->entries[idx].pts == pts) {
+    visage_remove_cached_frame(cache, idx);
+  }
+  visage_evict_frame_cache(cache, size);
+
+  // grow the entries, leaving the frame out if memory runs out
+  if (cache->nb_entries == cache->entries_capacity) {
+    int capacity = cache->entries_capacity ? cache->entries_capacity * 2 : 64;
+    VisageCachedFrame* entries = av_realloc_array(cache->entries, capacity,
+                                                  sizeof(VisageCachedFrame));
+    if (!entries) return -1;
+    for (int i = cache->entries_capacity; i < capacity; i++) {
+      entries[i].frame = NULL;
+    }
+    cache->entries = entries;
+    cache->entries_capacity = capacity;
+  }
+
+  // reference the frame into the spare past the last entry, sharing its picture buffers
+  AVFrame** spare = &cache->entries[cache->nb_entries].frame;
+  if (!*spare) {
+    *spare = av_frame_alloc();
+    if (!*spare) return -1;
+  }
+  if (av_frame_ref(*spare, frame) < 0) return -1;
+  AVFrame* ref = *spare;
+
+  // frames mostly arrive in order, so this rarely moves anything
+  idx = visage_search_frame_cache(cache, pts);
+  memmove(&cache->entries[idx + 1], &cache->entries[idx],
+          (cache->nb_entries - idx) * sizeof(VisageCachedFrame));
+  VisageCachedFrame* cached = &cache->entries[idx];
+  cached->frame = ref;
+  cached->pts = pts;
+  cached->duration = duration;
+  cached->size = size;
+  cached->run = cache->run;
+  cached->seq = cache->seq++;
+  cached->used = ++cache->uses;
+  cache->nb_entries++;
+  cache->size += size;
+
+  return 0;
+}
+
+/** Ends the current run. */
+void visage_break_frame_cache(VisageFrameCache* cache) {
+  cache->run++;
+  cache->seq = 0;
+}
+
+/** Returns the index of the frame decoded right after the one at the index, or -1 if it is not cached. */
+static int visage_next_cached_index(VisageFrameCache* cache, int idx) {
+  if (idx + 1 >= cache->nb_entries) return -1;
+  VisageCachedFrame* cached = &cache->entries[idx];
+  VisageCachedFrame* next = &cache->entries[idx + 1];
+  return next->run == cached->run && next->seq == cached->seq + 1 ? idx + 1 : -1;
+}
+
+/** Returns the cached frame on display at the time, or NULL if the cache does not cover it. */
+VisageCachedFrame* visage_find_cached_frame(VisageFrameCache* cache, int64_t pts) {
+  // take the latest frame starting at or before the time
+  int idx = visage_search_frame_cache(cache, pts);
+  if (idx == cache->nb_entries || cache->entries[idx].pts != pts) idx--;
+  if (idx < 0) return NULL;
+
+  // it is still on display unless it ended before the time
+  VisageCachedFrame* cached = &cache->entries[idx];
+  int next = visage_next_cached_index(cache, idx);
+  int64_t end = next >= 0 ? cache->entries[next].pts : cached->pts + cached->duration;
+  if (cached->pts != pts && end <= pts) return NULL;
+
+  cached->used = ++cache->uses;
+  return cached;
+}
+
+/** Returns the frame decoded right after the cached one at the timestamp, or NULL if it is not cached. */
+VisageCachedFrame* visage_next_cached_frame(VisageFrameCache* cache, int64_t pts) {
+  int idx = visage_search_frame_cache(cache, pts);
+  if (idx == cache->nb_entries || cache->entries[idx].pts != pts) return NULL;
+
+  int next = visage_next_cached_index(cache, idx);
+  if (next < 0) return NULL;
+  cache->entries[next].used = ++cache->uses;
+  return &cache->entries[next];
+}
+
+/** Drops all cached frames, keeping the blank frames for reuse. */
+void visage_clear_frame_cache(VisageFrameCache* cache) {
+  for (int i = 0; i < cache->nb_entries; i++) {
+    av_frame_unref(cache->entries[i].frame);
+  }
+  cache->nb_entries = 0;
+  cache->size = 0;
+  visage_break_frame_cache(cache);
+}
+
+/** Frees the frame cache. */
+void visage_free_frame_cache(VisageFrameCache** cache) {
+  if (!*cache) return;
+
+  for (int i = 0; i < (*cache)->entries_capacity; i++) {
+    av_frame_free(&(*cache)->entries[i].frame);
+  }
+  av_freep(&(*cache)->entries);
+  av_free(*cache);
+  *cache = NULL;
+}
@@ -0,0 +1,98 @@
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <stdio.h>
+#include "visage_frame_pool.h"
+
+/** Alignment of every picture line in bytes. */
+#define VISAGE_POOL_ALIGN 64
+
+/** Allocates the frame pool. Returns NULL on failure. */
+VisageFramePool* visage_alloc_frame_pool() {
+  VisageFramePool* pool = av_mallocz(sizeof(VisageFramePool));
+  if (!pool) return NULL;
+
+  // initialize properties to empty
+  pool->pool = NULL;
+  pool->format = AV_PIX_FMT_NONE;
+  pool->width = 0;
+  pool->height = 0;
+
+  return pool;
+}
+
+/** Frees the frame pool. */
+void visage_free_frame_pool(VisageFramePool** pool) {
+  if (!*pool) return;
+
+  av_buffer_pool_uninit(&(*pool)->pool);
+  av_free(*pool);
+  *pool = NULL;
+}
+
+/** Initializes the pool for the given picture format. Outputs 0 on success, -1 on error. */
+int visage_init_frame_pool(VisageFramePool* pool, enum AVPixelFormat format,
+                           int width, int height, int nb_buffers) {
+  // drop the old pool, its buffers are freed as their frames are released
+  av_buffer_pool_uninit(&pool->pool);
+
+  // compute aligned line sizes for the picture planes
+  if (av_image_fill_linesizes(pool->linesize, format, FFALIGN(width, VISAGE_POOL_ALIGN)) < 0) {
+    printf("Error: unsupported pixel format for the frame pool\n");
+    return -1;
+  }
+  for (int i = 0; i < 4; i++) {
+    pool->linesize[i] = FFALIGN(pool->linesize[i], VISAGE_POOL_ALIGN);
+  }
+
+  // compute the size of one whole picture
+  uint8_t* data[4];
+  int size = av_image_fill_pointers(data, format, height, NULL, pool->linesize);
+  if (size < 0) {
+    printf("Error: failed to compute the frame pool buffer size\n");
+    return -1;
+  }
+
+  // create the pool with padding for SIMD reads past the end
+  pool->pool = av_buffer_pool_init(size + VISAGE_POOL_ALIGN, NULL);
+  if (!pool->pool) {
+    printf("Error: failed to allocate memory for the frame pool\n");
+    return -1;
+  }
+  pool->format = format;
+  pool->width = width;
+  pool->height = height;
+
+  // warm up the pool so that playback does not allocate
+  AVBufferRef* buffers[nb_buffers > 0 ? nb_buffers : 1];
+  int warmed = 0;
+  for (; warmed < nb_buffers; warmed++) {
+    buffers[warmed] = av_buffer_pool_get(pool->pool);
+    if (!buffers[warmed]) break;
+  }
+  for (int i = 0; i < warmed; i++) {
+    av_buffer_unref(&buffers[i]);
+  }
+
+  return 0;
+}
+
+/** Attaches a pooled buffer to the frame. Outputs 0 on success, -1 on error. */
+int visage_get_pool_frame(VisageFramePool* pool, AVFrame* frame) {
+  frame->buf[0] = av_buffer_pool_get(pool->pool);
+  if (!frame->buf[0]) return -1;
+
+  // point the planes into the buffer
+  av_image_fill_pointers(frame->data, pool->format, pool->height,
+                         frame->buf[0]->data, pool->linesize);
+  for (int i = 0; i < 4; i++) {
+    frame->linesize[i] = pool->linesize[i];
+  }
+  frame->extended_data = frame->data;
+  frame->format = pool->format;
+  frame->width = pool->width;
+  frame->height = pool->height;
+
+  return 0;
+}
@@ -0,0 +1,374 @@
+#include <SDL3/SDL_properties.h>
+#include <SDL3/SDL_render.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/mem.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "visage_gpu.h"
+#include "visage_video.h"
+
+#if defined(__APPLE__)
+#include <CoreVideo/CoreVideo.h>
+#elif defined(_WIN32)
+#define COBJMACROS
+#include <initguid.h>
+#include <d3d11.h>
+#include <libavutil/hwcontext_d3d11va.h>
+#elif defined(__linux__)
+#include <SDL3/SDL_egl.h>
+#include <SDL3/SDL_opengles2.h>
+#include <libavutil/hwcontext_drm.h>
+#endif
+
+#if defined(__linux__)
+#ifndef DRM_FORMAT_MOD_INVALID
+#define DRM_FORMAT_MOD_INVALID ((1ULL << 56) - 1)
+#endif
+
+/** EGL and OpenGL ES entry points used to import dmabufs, loaded at runtime. */
+static PFNEGLCREATEIMAGEKHRPROC visage_egl_create_image;
+static PFNEGLDESTROYIMAGEKHRPROC visage_egl_destroy_image;
+static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC visage_gl_image_target;
+static PFNGLGENTEXTURESPROC visage_gl_gen_textures;
+static PFNGLDELETETEXTURESPROC visage_gl_delete_textures;
+static PFNGLBINDTEXTUREPROC visage_gl_bind_texture;
+static PFNGLTEXPARAMETERIPROC visage_gl_tex_parameter;
+
+/** Loads the EGL and OpenGL ES entry points. Returns 1 if all of them are available. */
+static int visage_load_egl() {
+  if (!SDL_EGL_GetCurrentDisplay()) return 0;
+
+  visage_egl_create_image = (PFNEGLCREATEIMAGEKHRPROC) SDL_EGL_GetProcAddress("eglCreateImageKHR");
+  visage_egl_destroy_image = (PFNEGLDESTROYIMAGEKHRPROC) SDL_EGL_GetProcAddress("eglDestroyImageKHR");
+  visage_gl_image_target =
+    (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC) SDL_GL_GetProcAddress("glEGLImageTargetTexture2DOES");
+  visage_gl_gen_textures = (PFNGLGENTEXTURESPROC) SDL_GL_GetProcAddress("glGenTextures");
+  visage_gl_delete_textures = (PFNGLDELETETEXTURESPROC) SDL_GL_GetProcAddress("glDeleteTextures");
+  visage_gl_bind_texture = (PFNGLBINDTEXTUREPROC) SDL_GL_GetProcAddress("glBindTexture");
+  visage_gl_tex_parameter = (PFNGLTEXPARAMETERIPROC) SDL_GL_GetProcAddress("glTexParameteri");
+
+  return visage_egl_create_image && visage_egl_destroy_image && visage_gl_image_target
+    && visage_gl_gen_textures && visage_gl_delete_textures && visage_gl_bind_texture
+    && visage_gl_tex_parameter;
+}
+
+/** Releases the EGL images and textures of the last imported VAAPI surface. */
+static void visage_release_egl(VisageGpu* gpu) {
+  EGLDisplay display = SDL_EGL_GetCurrentDisplay();
+  for (int i = 0; i < 2; i++) {
+    if (gpu->textures[i]) visage_gl_delete_textures(1, &gpu->textures[i]);
+    if (gpu->images[i]) visage_egl_destroy_image(display, gpu->images[i]);
+    gpu->textures[i] = 0;
+    gpu->images[i] = NULL;
+  }
+  av_frame_unref(gpu->drm_frame);
+}
+
+/** Imports one layer of a DRM-PRIME frame as an OpenGL ES texture. Outputs 0 on success, -1 on error. */
+static int visage_import_layer(VisageGpu* gpu, const AVDRMFrameDescriptor* desc, int layer_idx,
+                               int width, int height) {
+  const AVDRMLayerDescriptor* layer = &desc->layers[layer_idx];
+  if (layer->nb_planes != 1) return -1;
+  const AVDRMPlaneDescriptor* plane = &layer->planes[0];
+  const AVDRMObjectDescriptor* object = &desc->objects[plane->object_index];
+
+  // describe the dmabuf plane to EGL
+  EGLint attribs[] = {
+    EGL_WIDTH, width,
+    EGL_HEIGHT, height,
+    EGL_LINUX_DRM_FOURCC_EXT, layer->format,
+    EGL_DMA_BUF_PLANE0_FD_EXT, object->fd,
+    EGL_DMA_BUF_PLANE0_OFFSET_EXT, plane->offset,
+    EGL_DMA_BUF_PLANE0_PITCH_EXT, plane->pitch,
+    EGL_NONE, 0,
+    EGL_NONE, 0,
+    EGL_NONE,
+  };
+  if (object->format_modifier != DRM_FORMAT_MOD_INVALID) {
+    attribs[12] = EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT;
+    attribs[13] = object->format_modifier & 0xffffffff;
+    attribs[14] = EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT;
+    attribs[15] = object->format_modifier >> 32;
+  }
+
+  // wrap the plane in an EGL image and bind it to a texture
+  gpu->images[layer_idx] = visage_egl_create_image(SDL_EGL_GetCurrentDisplay(), EGL_NO_CONTEXT,
+                                                   EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+  if (!gpu->images[layer_idx]) return -1;
+
+  visage_gl_gen_textures(1, &gpu->textures[layer_idx]);
+  visage_gl_bind_texture(GL_TEXTURE_2D, gpu->textures[layer_idx]);
+  visage_gl_tex_parameter(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  visage_gl_tex_parameter(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  visage_gl_tex_parameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  visage_gl_tex_parameter(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  visage_gl_image_target(GL_TEXTURE_2D, gpu->images[layer_idx]);
+  visage_gl_bind_texture(GL_TEXTURE_2D, 0);
+
+  return 0;
+}
+
+/** Imports a VAAPI surface into the OpenGL ES renderer. Returns NULL on failure. */
+static SDL_Texture* visage_import_vaapi(VisageGpu* gpu, const AVFrame* frame) {
+  AVHWFramesContext* frames_ctx = (AVHWFramesContext*) frame->hw_frames_ctx->data;
+  if (frames_ctx->sw_format != AV_PIX_FMT_NV12) return NULL;
+
+  // export the surface as dmabufs, one layer per plane
+  gpu->drm_frame->format = AV_PIX_FMT_DRM_PRIME;
+  if (av_hwframe_map(gpu->drm_frame, frame, AV_HWFRAME_MAP_READ) < 0) return NULL;
+  const AVDRMFrameDescriptor* desc = (const AVDRMFrameDescriptor*) gpu->drm_frame->data[0];
+  if (desc->nb_layers != 2) return NULL;
+
+  // make sure SDL is done with the GL state before touching it
+  SDL_FlushRenderer(gpu->renderer);
+  if (visage_import_layer(gpu, desc, 0, frame->width, frame->height) < 0
+      || visage_import_layer(gpu, desc, 1, (frame->width + 1) / 2, (frame->height + 1) / 2) < 0) {
+    return NULL;
+  }
+
+  // wrap the luma and chroma textures in an NV12 texture
+  SDL_PropertiesID props = SDL_CreateProperties();
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_FORMAT_NUMBER, SDL_PIXELFORMAT_NV12);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_ACCESS_NUMBER, SDL_TEXTUREACCESS_STATIC);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_WIDTH_NUMBER, frame->width);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_HEIGHT_NUMBER, frame->height);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_COLORSPACE_NUMBER,
+                        visage_video_colorspace(frame));
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_OPENGLES2_TEXTURE_NUMBER, gpu->textures[0]);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_OPENGLES2_TEXTURE_UV_NUMBER, gpu->textures[1]);
+  SDL_Texture* texture = SDL_CreateTextureWithProperties(gpu->renderer, props);
+  SDL_DestroyProperties(props);
+
+  return texture;
+}
+#endif
+
+#if defined(__APPLE__)
+/** Wraps a VideoToolbox pixel buffer in a texture of the Metal renderer. Returns NULL on failure. */
+static SDL_Texture* visage_import_videotoolbox(VisageGpu* gpu, const AVFrame* frame) {
+  CVPixelBufferRef pixbuf = (CVPixelBufferRef) frame->data[3];
+
+  // pick the texture format matching the pixel buffer
+  SDL_PixelFormat format;
+  switch (CVPixelBufferGetPixelFormatType(pixbuf)) {
+  case kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange:
+  case kCVPixelFormatType_420YpCbCr8BiPlanarFullRange:
+    format = SDL_PIXELFORMAT_NV12;
+    break;
+  case kCVPixelFormatType_420YpCbCr10BiPlanarVideoRange:
+  case kCVPixelFormatType_420YpCbCr10BiPlanarFullRange:
+    format = SDL_PIXELFORMAT_P010;
+    break;
+  default:
+    return NULL;
+  }
+
+  SDL_PropertiesID props = SDL_CreateProperties();
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_FORMAT_NUMBER, format);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_ACCESS_NUMBER, SDL_TEXTUREACCESS_STATIC);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_WIDTH_NUMBER, frame->width);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_HEIGHT_NUMBER, frame->height);
+  SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_COLORSPACE_NUMBER,
+                        visage_video_colorspace(frame));
+  SDL_SetPointerProperty(props, SDL_PROP_TEXTURE_CREATE_METAL_PIXELBUFFER_POINTER, pixbuf);
+  SDL_Texture* texture = SDL_CreateTextureWithProperties(gpu->renderer, props);
+  SDL_DestroyProperties(props);
+
+  return texture;
+}
+#endif
+
+#if defined(_WIN32)
+/** Creates a D3D11VA device sharing the Direct3D 11 device of the renderer. Returns NULL on failure. */
+static AVBufferRef* visage_share_d3d11(SDL_Renderer* renderer) {
+  ID3D11Device* device = SDL_GetPointerProperty(SDL_GetRendererProperties(renderer),
+                                                SDL_PROP_RENDERER_D3D11_DEVICE_POINTER, NULL);
+  if (!device) return NULL;
+
+  // the decoder and the renderer use the device from different threads
+  ID3D10Multithread* multithread = NULL;
+  if (SUCCEEDED(ID3D11Device_QueryInterface(device, &IID_ID3D10Multithread,
+                                            (void**) &multithread))) {
+    ID3D10Multithread_SetMultithreadProtected(multithread, TRUE);
+    ID3D10Multithread_Release(multithread);
+  }
+
+  AVBufferRef* device_ref = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_D3D11VA);
+  if (!device_ref) return NULL;
+  AVHWDeviceContext* device_ctx = (AVHWDeviceContext*) device_ref->data;
+  AVD3D11VADeviceContext* d3d11_ctx = device_ctx->hwctx;
+  ID3D11Device_AddRef(device);
+  d3d11_ctx->device = device;
+  if (av_hwdevice_ctx_init(device_ref) < 0) {
+    av_buffer_unref(&device_ref);
+    return NULL;
+  }
+
+  return device_ref;
+}
+
+/** Copies a D3D11 decoder surface into a texture of the renderer on the GPU. Returns NULL on failure. */
+static SDL_Texture* visage_import_d3d11(VisageGpu* gpu, const AVFrame* frame) {
+  AVHWFramesContext* frames_ctx = (AVHWFramesContext*) frame->hw_frames_ctx->data;
+  AVD3D11VADeviceContext* d3d11_ctx = frames_ctx->device_ctx->hwctx;
+
+  SDL_PixelFormat format;
+  switch (frames_ctx->sw_format) {
+  case AV_PIX_FMT_NV12:
+    format = SDL_PIXELFORMAT_NV12;
+    break;
+  case AV_PIX_FMT_P010:
+    format = SDL_PIXELFORMAT_P010;
+    break;
+  default:
+    return NULL;
+  }
+
+  // reuse the target texture while the frame format stays the same
+  if (!gpu->texture || gpu->texture->format != format || gpu->texture->w != frame->width
+      || gpu->texture->h != frame->height) {
+    SDL_DestroyTexture(gpu->texture);
+    SDL_PropertiesID props = SDL_CreateProperties();
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_FORMAT_NUMBER, format);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_ACCESS_NUMBER, SDL_TEXTUREACCESS_STATIC);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_WIDTH_NUMBER, frame->width);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_HEIGHT_NUMBER, frame->height);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_COLORSPACE_NUMBER,
+                          visage_video_colorspace(frame));
+    gpu->texture = SDL_CreateTextureWithProperties(gpu->renderer, props);
+    SDL_DestroyProperties(props);
+    if (!gpu->texture) return NULL;
+  }
+  ID3D11Texture2D* target = SDL_GetPointerProperty(SDL_GetTextureProperties(gpu->texture),
+                                                   SDL_PROP_TEXTURE_D3D11_TEXTURE_POINTER, NULL);
+  if (!target) return NULL;
+
+  // copy the array slice of the decoder surface, skipping its alignment padding
+  D3D11_BOX box = {0, 0, 0, frame->width, frame->height, 1};
+  d3d11_ctx->lock(d3d11_ctx->lock_ctx);
+  ID3D11DeviceContext_CopySubresourceRegion(d3d11_ctx->device_context, (ID3D11Resource*) target,
+                                            0, 0, 0, 0, (ID3D11Resource*) frame->data[0],
+                                            (UINT) (intptr_t) frame->data[1], &box);
+  d3d11_ctx->unlock(d3d11_ctx->lock_ctx);
+
+  return gpu->texture;
+}
+#endif
+
+/** Allocates the gpu presentation context. Returns NULL on failure. */
+VisageGpu* visage_alloc_gpu() {
+  VisageGpu* gpu = av_mallocz(sizeof(VisageGpu));
+  if (!gpu) return NULL;
+
+  // initialize properties to null
+  gpu->renderer = NULL;
+  gpu->device_type = AV_HWDEVICE_TYPE_NONE;
+  gpu->texture = NULL;
+  gpu->frame = av_frame_alloc();
+#if defined(__linux__)
+  gpu->drm_frame = av_frame_alloc();
+  if (!gpu->drm_frame) {
+    av_frame_free(&gpu->frame);
+    av_free(gpu);
+    return NULL;
+  }
+#endif
+  if (!gpu->frame) {
+    visage_free_gpu(&gpu);
+    return NULL;
+  }
+
+  return gpu;
+}
+
+/** Frees the gpu presentation context. */
+void visage_free_gpu(VisageGpu** gpu) {
+  if (!*gpu) return;
+
+#if defined(__linux__)
+  if ((*gpu)->device_type != AV_HWDEVICE_TYPE_NONE) visage_release_egl(*gpu);
+  av_frame_free(&(*gpu)->drm_frame);
+#endif
+  SDL_DestroyTexture((*gpu)->texture);
+  av_frame_free(&(*gpu)->frame);
+  av_free(*gpu);
+  *gpu = NULL;
+}
+
+/** Sets up zero-copy presentation if the renderer supports it. Outputs 0 on success. */
+int visage_init_gpu(SDL_Renderer* renderer, VisageVideo* video, VisageGpu* gpu) {
+  gpu->renderer = renderer;
+  const char* name = SDL_GetRendererName(renderer);
+  if (!name) return 0;
+
+  // find the surface type this renderer can present directly
+  enum AVHWDeviceType type = AV_HWDEVICE_TYPE_NONE;
+#if defined(__APPLE__)
+  if (strcmp(name, "metal") == 0) type = AV_HWDEVICE_TYPE_VIDEOTOOLBOX;
+#elif defined(_WIN32)
+  if (strcmp(name, "direct3d11") == 0) type = AV_HWDEVICE_TYPE_D3D11VA;
+#elif defined(__linux__)
+  if (strcmp(name, "opengles2") == 0 && visage_load_egl()) type = AV_HWDEVICE_TYPE_VAAPI;
+#endif
+  if (type == AV_HWDEVICE_TYPE_NONE) return 0;
+
+  // respect a request for software decoding or for a different device
+  if (video->hwaccel && strcmp(video->hwaccel, "auto") != 0
+      && av_hwdevice_find_type_by_name(video->hwaccel) != type) {
+    return 0;
+  }
+
+  // create the device the decoder should use
+  AVBufferRef* device_ref = NULL;
+#if defined(_WIN32)
+  device_ref = visage_share_d3d11(renderer);
+#else
+  if (av_hwdevice_ctx_create(&device_ref, type, NULL, NULL, 0) < 0) device_ref = NULL;
+#endif
+  if (!device_ref) return 0;
+
+  // have the video context queue surfaces of this device instead of downloading them
+  av_buffer_unref(&video->hw_device_ctx);
+  video->hw_device_ctx = device_ref;
+  atomic_store(&video->zero_copy, 1);
+  video->gpu = gpu;
+  gpu->device_type = type;
+
+  return 0;
+}
+
+/** Creates a texture showing the hardware frame. Returns NULL on failure. */
+SDL_Texture* visage_gpu_texture(VisageGpu* gpu, const AVFrame* frame) {
+  if (gpu->device_type == AV_HWDEVICE_TYPE_NONE || !frame->hw_frames_ctx) return NULL;
+  AVHWFramesContext* frames_ctx = (AVHWFramesContext*) frame->hw_frames_ctx->data;
+  if (frames_ctx->device_ctx->type != gpu->device_type) return NULL;
+
+  // release the previous frame, its texture has been presented already
+#if defined(__linux__)
+  SDL_DestroyTexture(gpu->texture);
+  gpu->texture = NULL;
+  visage_release_egl(gpu);
+#elif defined(__APPLE__)
+  SDL_DestroyTexture(gpu->texture);
+  gpu->texture = NULL;
+#endif
+  av_frame_unref(gpu->frame);
+
+  // keep the surface alive while its texture is in use
+  if (av_frame_ref(gpu->frame, frame) < 0) return NULL;
+
+#if defined(__APPLE__)
+  gpu->texture = visage_import_videotoolbox(gpu, frame);
+  return gpu->texture;
+#elif defined(_WIN32)
+  return visage_import_d3d11(gpu, frame);
+#elif defined(__linux__)
+  gpu->texture = visage_import_vaapi(gpu, frame);
+  return gpu->texture;
+#else
+  return NULL;
+#endif
+}
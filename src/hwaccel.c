@@ -0,0 +1,165 @@
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "visage_frame_pool.h"
+#include "visage_hwaccel.h"
+#include "visage_video.h"
+
+/** Device types probed for automatic hardware decoding, in order of preference. */
+static const enum AVHWDeviceType visage_hwaccel_types[] = {
+#if defined(__APPLE__)
+  AV_HWDEVICE_TYPE_VIDEOTOOLBOX,
+#elif defined(_WIN32)
+  AV_HWDEVICE_TYPE_D3D11VA,
+  AV_HWDEVICE_TYPE_CUDA,
+  AV_HWDEVICE_TYPE_DXVA2,
+#else
+  AV_HWDEVICE_TYPE_VAAPI,
+  AV_HWDEVICE_TYPE_CUDA,
+  AV_HWDEVICE_TYPE_VDPAU,
+#endif
+  AV_HWDEVICE_TYPE_NONE,
+};
+
+/** Returns the pixel format the codec decodes to on the device type, or AV_PIX_FMT_NONE. */
+static enum AVPixelFormat visage_hwaccel_format(const AVCodec* codec, enum AVHWDeviceType type) {
+  for (int i = 0;; i++) {
+    const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+    if (!config) return AV_PIX_FMT_NONE;
+    if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX)
+        && config->device_type == type) {
+      return config->pix_fmt;
+    }
+  }
+}
+
+/** Picks the hardware pixel format, or the first software format if it is not offered. */
+static enum AVPixelFormat visage_get_hw_format(AVCodecContext* codec_ctx,
+                                               const enum AVPixelFormat* formats) {
+  VisageVideo* video = codec_ctx->opaque;
+
+  for (const enum AVPixelFormat* format = formats; *format != AV_PIX_FMT_NONE; format++) {
+    if (*format == video->hw_pix_fmt) return *format;
+  }
+
+  // the device cannot decode this stream, so decode it in software instead
+  printf("Warning: hardware decoding not supported for this stream, using software\n");
+  for (const enum AVPixelFormat* format = formats; *format != AV_PIX_FMT_NONE; format++) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(*format);
+    if (!(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) return *format;
+  }
+  return AV_PIX_FMT_NONE;
+}
+
+/** Tries to create a device of the given type for the codec. Outputs 0 on success, -1 on error. */
+static int visage_try_hwaccel(VisageVideo* video, enum AVHWDeviceType type) {
+  enum AVPixelFormat hw_pix_fmt = visage_hwaccel_format(video->codec, type);
+  if (hw_pix_fmt == AV_PIX_FMT_NONE) return -1;
+
+  AVBufferRef* device_ctx = NULL;
+  if (av_hwdevice_ctx_create(&device_ctx, type, NULL, NULL, 0) < 0) return -1;
+
+  video->hw_device_ctx = device_ctx;
+  video->hw_pix_fmt = hw_pix_fmt;
+  return 0;
+}
+
+/** Sets up hardware decoding on the codec context. Outputs 0 on success, -1 on error. */
+int visage_init_hwaccel(VisageVideo* video) {
+#if defined(VISAGE_NO_HWACCEL)
+  // hardware decoding was left out of the build, so frames never come from a device
+  visage_uninit_hwaccel(video);
+  atomic_store(&video->zero_copy, 0);
+  return 0;
+#endif
+  if (video->hwaccel && strcmp(video->hwaccel, "none") == 0) return 0;
+
+  if (video->hw_device_ctx) {
+    // use the device given for zero-copy presentation if the codec supports it
+    AVHWDeviceContext* device_ctx = (AVHWDeviceContext*) video->hw_device_ctx->data;
+    video->hw_pix_fmt = visage_hwaccel_format(video->codec, device_ctx->type);
+    if (video->hw_pix_fmt == AV_PIX_FMT_NONE) {
+      visage_uninit_hwaccel(video);
+      atomic_store(&video->zero_copy, 0);
+    }
+  }
+
+  if (video->hw_device_ctx) {
+    // nothing to create
+  } else if (video->hwaccel && strcmp(video->hwaccel, "auto") != 0) {
+    // use the requested device type only
+    enum AVHWDeviceType type = av_hwdevice_find_type_by_name(video->hwaccel);
+    if (type == AV_HWDEVICE_TYPE_NONE) {
+      printf("Error: unknown hardware acceleration \"%s\"\n", video->hwaccel);
+      return -1;
+    }
+    if (visage_try_hwaccel(video, type) < 0) {
+      printf("Warning: %s decoding is not available, using software\n", video->hwaccel);
+      return 0;
+    }
+  } else {
+    // probe the platform's device types until one works
+    for (int i = 0; visage_hwaccel_types[i] != AV_HWDEVICE_TYPE_NONE; i++) {
+      if (visage_try_hwaccel(video, visage_hwaccel_types[i]) == 0) break;
+    }
+    if (!video->hw_device_ctx) return 0;
+  }
+
+  // attach the device to the decoder
+  video->codec_ctx->hw_device_ctx = av_buffer_ref(video->hw_device_ctx);
+  if (!video->codec_ctx->hw_device_ctx) {
+    visage_uninit_hwaccel(video);
+    return 0;
+  }
+  video->codec_ctx->opaque = video;
+  video->codec_ctx->get_format = visage_get_hw_format;
+
+  return 0;
+}
+
+/** Releases the hardware device. */
+void visage_uninit_hwaccel(VisageVideo* video) {
+  av_buffer_unref(&video->hw_device_ctx);
+  video->hw_pix_fmt = AV_PIX_FMT_NONE;
+}
+
+/** Returns 1 if the frame is a hardware surface, 0 otherwise. */
+int visage_is_hw_frame(VisageVideo* video, const AVFrame* frame) {
+  return video->hw_pix_fmt != AV_PIX_FMT_NONE && frame->format == video->hw_pix_fmt;
+}
+
+/** Downloads the hardware frame into a pooled frame. Outputs 0 on success, -1 on error. */
+int visage_download_video(VisageVideo* video, const AVFrame* hw_frame, AVFrame* sw_frame) {
+  AVHWFramesContext* frames_ctx = (AVHWFramesContext*) hw_frame->hw_frames_ctx->data;
+
+  // (re)initialize the download pool when the surface format changes, downloaded
+  // frames displayable as they are stay in the queue so it needs as many buffers
+  VisageFramePool* pool = video->hw_frame_pool;
+  if (pool->format != frames_ctx->sw_format || pool->width != hw_frame->width
+      || pool->height != hw_frame->height) {
+    if (visage_init_frame_pool(pool, frames_ctx->sw_format, hw_frame->width,
+                               hw_frame->height, video->frames_capacity + 1) < 0) {
+      return -1;
+    }
+  }
+
+  // copy the surface into system memory
+  if (visage_get_pool_frame(pool, sw_frame) < 0) {
+    printf("Error: failed to allocate memory for downloaded frames\n");
+    return -1;
+  }
+  int ret = av_hwframe_transfer_data(sw_frame, hw_frame, 0);
+  if (ret < 0) {
+    printf("Error: %s\n", av_err2str(ret));
+    av_frame_unref(sw_frame);
+    return -1;
+  }
+  av_frame_copy_props(sw_frame, hw_frame);
+
+  return 0;
+}
@@ -0,0 +1,417 @@
+#include <libavcodec/codec_par.h>
+#include <libavcodec/defs.h>
+#include <libavutil/avstring.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/macros.h>
+#include <libavutil/mem.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "visage_index.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/** Bytes every sidecar starts with. */
+#define VISAGE_INDEX_MAGIC "VSGINDEX"
+
+/** Value written in native byte order to recognize sidecars from other machines. */
+#define VISAGE_INDEX_BYTE_ORDER 0x01020304
+
+/** Header at the start of the sidecar. */
+typedef struct VisageIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int64_t file_size;
+  int64_t file_mtime;
+  int64_t duration;
+  int64_t start_time;
+  int64_t bit_rate;
+  int32_t nb_streams;
+  int32_t stream_idx;
+  int32_t nb_keyframes;
+  int32_t reserved;
+} VisageIndexHeader;
+
+/** Parameters of one stream in the sidecar, following the header. */
+typedef struct VisageIndexStream {
+  int32_t codec_type;
+  int32_t codec_id;
+  int32_t time_base_num;
+  int32_t time_base_den;
+  int32_t width;
+  int32_t height;
+  int32_t format;
+  int32_t sample_rate;
+  int32_t channel_order;
+  int32_t channels;
+  int32_t avg_frame_rate_num;
+  int32_t avg_frame_rate_den;
+  int32_t r_frame_rate_num;
+  int32_t r_frame_rate_den;
+  int32_t sample_aspect_num;
+  int32_t sample_aspect_den;
+  int32_t extradata_size;
+  int32_t reserved;
+  uint64_t channel_mask;
+  int64_t extradata_offset;
+  int64_t start_time;
+  int64_t duration;
+} VisageIndexStream;
+
+/** Allocates the index. Returns NULL on failure. */
+VisageIndex* visage_alloc_index() {
+  VisageIndex* index = av_mallocz(sizeof(VisageIndex));
+  if (!index) return NULL;
+
+  // initialize properties to empty
+  index->path = NULL;
+  index->file_size = 0;
+  index->file_mtime = 0;
+  index->keyframes = NULL;
+  index->keyframe_pos = NULL;
+  index->keyframe_next = NULL;
+  index->nb_keyframes = 0;
+  index->nb_links = 0;
+  index->stream_idx = -1;
+
+  return index;
+}
+
+/** Frees the index. */
+void visage_free_index(VisageIndex** index) {
+  if (!*index) return;
+
+  av_freep(&(*index)->path);
+  av_freep(&(*index)->keyframes);
+  av_freep(&(*index)->keyframe_pos);
+  av_freep(&(*index)->keyframe_next);
+  av_free(*index);
+  *index = NULL;
+}
+
+/** Initializes the index for the file. Outputs 0 on success, -1 on error. */
+int visage_init_index(const char* file, VisageIndex* index) {
+#if defined(_WIN32)
+  (void) file;
+  (void) index;
+  printf("Error: sidecar indices are not supported on this platform\n");
+  return -1;
+#else
+  // a sidecar only belongs to the file as it is now
+  struct stat st;
+  if (stat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+    printf("Error: %s is not a regular file\n", file);
+    return -1;
+  }
+  index->file_size = st.st_size;
+#if defined(__APPLE__)
+  index->file_mtime = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+  index->file_mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+
+  index->path = av_asprintf("%s%s", file, VISAGE_INDEX_SUFFIX);
+  if (!index->path) {
+    printf("Error: failed to allocate memory for the index path\n");
+    return -1;
+  }
+
+  return 0;
+#endif
+}
+
+/** Returns the size of the keyframes in the sidecar in bytes, the links padded to keep alignment. */
+static int64_t visage_keyframes_size(int count) {
+  return count * (int64_t) (2 * sizeof(int64_t)) + FFALIGN((int64_t) count, 8);
+}
+
+/** Returns the number of keyframes linked to the next one. */
+static int visage_count_links(const uint8_t* keyframe_next, int count) {
+  int links = 0;
+  for (int i = 0; i < count; i++) links += keyframe_next[i] != 0;
+  return links;
+}
+
+/** Returns 1 if the stream has the parameters decoding needs before the first packet. */
+static int visage_stream_complete(AVStream* stream) {
+  AVCodecParameters* codecpar = stream->codecpar;
+  if (codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+    return codecpar->codec_id != AV_CODEC_ID_NONE && codecpar->width > 0 && codecpar->height > 0
+      && codecpar->format >= 0;
+  }
+  if (codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+    return codecpar->codec_id != AV_CODEC_ID_NONE && codecpar->sample_rate > 0
+      && codecpar->ch_layout.nb_channels > 0 && codecpar->format >= 0;
+  }
+  return 1;
+}
+
+/** Returns 1 if the sidecar mapping is whole and was written for the opened file. */
+static int visage_check_index(AVFormatContext* format_ctx, VisageIndex* index, const uint8_t* map,
+                              int64_t size) {
+  // the layout, machine and file must be the ones the sidecar was written for
+  const VisageIndexHeader* header = (const VisageIndexHeader*) map;
+  if (size < (int64_t) sizeof(VisageIndexHeader)
+      || memcmp(header->magic, VISAGE_INDEX_MAGIC, sizeof(header->magic)) != 0
+      || header->version != VISAGE_INDEX_VERSION || header->byte_order != VISAGE_INDEX_BYTE_ORDER
+      || header->file_size != index->file_size || header->file_mtime != index->file_mtime) {
+    return 0;
+  }
+  if (header->nb_streams != (int32_t) format_ctx->nb_streams || header->nb_keyframes < 0
+      || header->stream_idx < -1 || header->stream_idx >= header->nb_streams) {
+    return 0;
+  }
+  int64_t body = sizeof(VisageIndexHeader) + header->nb_streams * (int64_t) sizeof(VisageIndexStream)
+    + visage_keyframes_size(header->nb_keyframes);
+  if (body > size) return 0;
+
+  // the streams must be the ones the format found, with the same timestamps
+  const VisageIndexStream* records = (const VisageIndexStream*) (map + sizeof(VisageIndexHeader));
+  for (int i = 0; i < header->nb_streams; i++) {
+    const VisageIndexStream* record = &records[i];
+    AVStream* stream = format_ctx->streams[i];
+    if (record->codec_type != stream->codecpar->codec_type
+        || (stream->codecpar->codec_id != AV_CODEC_ID_NONE
+            && record->codec_id != (int32_t) stream->codecpar->codec_id)
+        || record->time_base_num != stream->time_base.num
+        || record->time_base_den != stream->time_base.den) {
+      return 0;
+    }
+    if (record->extradata_size < 0 || record->extradata_offset < body
+        || record->extradata_offset + record->extradata_size > size) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/** Fills in the parameters of the stream the format left unknown. */
+static void visage_apply_stream(const VisageIndexStream* record, const uint8_t* map,
+                                AVStream* stream) {
+  AVCodecParameters* codecpar = stream->codecpar;
+  if (codecpar->codec_id == AV_CODEC_ID_NONE) codecpar->codec_id = record->codec_id;
+  if (codecpar->width <= 0) codecpar->width = record->width;
+  if (codecpar->height <= 0) codecpar->height = record->height;
+  if (codecpar->format < 0) codecpar->format = record->format;
+  if (codecpar->sample_rate <= 0) codecpar->sample_rate = record->sample_rate;
+  if (codecpar->ch_layout.nb_channels <= 0 && record->channels > 0) {
+    av_channel_layout_uninit(&codecpar->ch_layout);
+    if (record->channel_order == AV_CHANNEL_ORDER_NATIVE) {
+      av_channel_layout_from_mask(&codecpar->ch_layout, record->channel_mask);
+    } else {
+      av_channel_layout_default(&codecpar->ch_layout, record->channels);
+    }
+  }
+  if (codecpar->sample_aspect_ratio.num == 0) {
+    codecpar->sample_aspect_ratio = (AVRational) {record->sample_aspect_num, record->sample_aspect_den};
+  }
+  if (stream->avg_frame_rate.num == 0) {
+    stream->avg_frame_rate = (AVRational) {record->avg_frame_rate_num, record->avg_frame_rate_den};
+  }
+  if (stream->r_frame_rate.num == 0) {
+    stream->r_frame_rate = (AVRational) {record->r_frame_rate_num, record->r_frame_rate_den};
+  }
+  if (stream->start_time == AV_NOPTS_VALUE) stream->start_time = record->start_time;
+  if (stream->duration == AV_NOPTS_VALUE) stream->duration = record->duration;
+
+  // decoders read the headers of some codecs only from the extradata
+  if (codecpar->extradata_size == 0 && record->extradata_size > 0) {
+    uint8_t* extradata = av_mallocz(record->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!extradata) return;
+    memcpy(extradata, map + record->extradata_offset, record->extradata_size);
+    av_free(codecpar->extradata);
+    codecpar->extradata = extradata;
+    codecpar->extradata_size = record->extradata_size;
+  }
+}
+
+/** Reads the sidecar into the format context and the index. Returns 1 if the streams are complete, 0 otherwise. */
+int visage_read_index(AVFormatContext* format_ctx, VisageIndex* index) {
+#if defined(_WIN32)
+  (void) format_ctx;
+  (void) index;
+  return 0;
+#else
+  // a missing sidecar is the usual case on the first playback
+  int fd = open(index->path, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  uint8_t* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return 0;
+
+  // ignore sidecars of other versions or of an older state of the file
+  if (!visage_check_index(format_ctx, index, map, st.st_size)) {
+    printf("Warning: ignoring outdated index %s\n", index->path);
+    munmap(map, st.st_size);
+    return 0;
+  }
+  const VisageIndexHeader* header = (const VisageIndexHeader*) map;
+  const VisageIndexStream* records = (const VisageIndexStream*) (map + sizeof(VisageIndexHeader));
+  for (int i = 0; i < header->nb_streams; i++) {
+    visage_apply_stream(&records[i], map, format_ctx->streams[i]);
+  }
+  if (format_ctx->duration == AV_NOPTS_VALUE) format_ctx->duration = header->duration;
+  if (format_ctx->start_time == AV_NOPTS_VALUE) format_ctx->start_time = header->start_time;
+  if (format_ctx->bit_rate <= 0) format_ctx->bit_rate = header->bit_rate;
+
+  // copy the keyframes out of the mapping, the demuxer keeps adding to them
+  int count = header->nb_keyframes;
+  if (count > 0 && header->stream_idx >= 0) {
+    const uint8_t* keyframes = (const uint8_t*) &records[header->nb_streams];
+    index->keyframes = av_malloc_array(count, sizeof(int64_t));
+    index->keyframe_pos = av_malloc_array(count, sizeof(int64_t));
+    index->keyframe_next = av_malloc(count);
+    if (index->keyframes && index->keyframe_pos && index->keyframe_next) {
+      memcpy(index->keyframes, keyframes, count * sizeof(int64_t));
+      memcpy(index->keyframe_pos, keyframes + count * sizeof(int64_t), count * sizeof(int64_t));
+      memcpy(index->keyframe_next, keyframes + 2 * count * sizeof(int64_t), count);
+      index->nb_keyframes = count;
+      index->nb_links = visage_count_links(index->keyframe_next, count);
+      index->stream_idx = header->stream_idx;
+    } else {
+      av_freep(&index->keyframes);
+      av_freep(&index->keyframe_pos);
+      av_freep(&index->keyframe_next);
+    }
+  }
+  munmap(map, st.st_size);
+
+  // the format may have found streams the parameters do not cover, such as late TS programs
+  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
+    if (!visage_stream_complete(format_ctx->streams[i])) return 0;
+  }
+
+  return 1;
+#endif
+}
+
+/** Hands the keyframes of the sidecar to the demuxer. */
+void visage_restore_index(VisageIndex* index, VisageDemuxer* demuxer) {
+  if (!index->keyframes || index->stream_idx != demuxer->video->stream_idx) return;
+
+  av_freep(&demuxer->keyframes);
+  av_freep(&demuxer->keyframe_pos);
+  av_freep(&demuxer->keyframe_next);
+  demuxer->keyframes = index->keyframes;
+  demuxer->keyframe_pos = index->keyframe_pos;
+  demuxer->keyframe_next = index->keyframe_next;
+  demuxer->nb_keyframes = index->nb_keyframes;
+  demuxer->keyframes_capacity = index->nb_keyframes;
+  index->keyframes = NULL;
+  index->keyframe_pos = NULL;
+  index->keyframe_next = NULL;
+}
+
+/** Fills in the sidecar record of the stream, pointing at extradata at the offset. */
+static void visage_record_stream(AVStream* stream, int64_t extradata_offset,
+                                 VisageIndexStream* record) {
+  AVCodecParameters* codecpar = stream->codecpar;
+  record->codec_type = codecpar->codec_type;
+  record->codec_id = codecpar->codec_id;
+  record->time_base_num = stream->time_base.num;
+  record->time_base_den = stream->time_base.den;
+  record->width = codecpar->width;
+  record->height = codecpar->height;
+  record->format = codecpar->format;
+  record->sample_rate = codecpar->sample_rate;
+  record->channel_order = codecpar->ch_layout.order;
+  record->channels = codecpar->ch_layout.nb_channels;
+  record->channel_mask = codecpar->ch_layout.order == AV_CHANNEL_ORDER_NATIVE
+    ? codecpar->ch_layout.u.mask : 0;
+  record->avg_frame_rate_num = stream->avg_frame_rate.num;
+  record->avg_frame_rate_den = stream->avg_frame_rate.den;
+  record->r_frame_rate_num = stream->r_frame_rate.num;
+  record->r_frame_rate_den = stream->r_frame_rate.den;
+  record->sample_aspect_num = codecpar->sample_aspect_ratio.num;
+  record->sample_aspect_den = codecpar->sample_aspect_ratio.den;
+  record->extradata_size = codecpar->extradata_size;
+  record->extradata_offset = extradata_offset;
+  record->start_time = stream->start_time;
+  record->duration = stream->duration;
+}
+
+/** Writes the sidecar of the file. Outputs 0 on success, -1 on error. */
+int visage_write_index(AVFormatContext* format_ctx, VisageDemuxer* demuxer, VisageIndex* index) {
+  // an unchanged index is already on disk, reading known keyframes again may only link them
+  int count = demuxer->nb_keyframes;
+  if (count <= index->nb_keyframes
+      && visage_count_links(demuxer->keyframe_next, count) <= index->nb_links) {
+    return 0;
+  }
+
+  // lay out the header, the streams, the keyframes with their links and then the extradata
+  int nb_streams = format_ctx->nb_streams;
+  int64_t size = sizeof(VisageIndexHeader) + nb_streams * (int64_t) sizeof(VisageIndexStream)
+    + visage_keyframes_size(count);
+  for (int i = 0; i < nb_streams; i++) {
+    size += FFALIGN(format_ctx->streams[i]->codecpar->extradata_size, 8);
+  }
+  uint8_t* data = av_mallocz(size);
+  if (!data) {
+    printf("Error: failed to allocate memory for the index\n");
+    return -1;
+  }
+
+  VisageIndexHeader* header = (VisageIndexHeader*) data;
+  memcpy(header->magic, VISAGE_INDEX_MAGIC, sizeof(header->magic));
+  header->version = VISAGE_INDEX_VERSION;
+  header->byte_order = VISAGE_INDEX_BYTE_ORDER;
+  header->file_size = index->file_size;
+  header->file_mtime = index->file_mtime;
+  header->duration = format_ctx->duration;
+  header->start_time = format_ctx->start_time;
+  header->bit_rate = format_ctx->bit_rate;
+  header->nb_streams = nb_streams;
+  header->stream_idx = demuxer->video->stream_idx;
+  header->nb_keyframes = count;
+
+  VisageIndexStream* records = (VisageIndexStream*) (data + sizeof(VisageIndexHeader));
+  uint8_t* keyframes = (uint8_t*) &records[nb_streams];
+  memcpy(keyframes, demuxer->keyframes, count * sizeof(int64_t));
+  memcpy(keyframes + count * sizeof(int64_t), demuxer->keyframe_pos, count * sizeof(int64_t));
+  if (count > 0) memcpy(keyframes + 2 * count * sizeof(int64_t), demuxer->keyframe_next, count);
+  int64_t offset = keyframes + visage_keyframes_size(count) - data;
+  for (int i = 0; i < nb_streams; i++) {
+    AVCodecParameters* codecpar = format_ctx->streams[i]->codecpar;
+    visage_record_stream(format_ctx->streams[i], offset, &records[i]);
+    if (codecpar->extradata_size > 0) {
+      memcpy(data + offset, codecpar->extradata, codecpar->extradata_size);
+    }
+    offset += FFALIGN(codecpar->extradata_size, 8);
+  }
+
+  // write next to the sidecar, replacing it only once complete
+  char* temp_path = av_asprintf("%s.tmp", index->path);
+  if (!temp_path) {
+    av_free(data);
+    printf("Error: failed to allocate memory for the index path\n");
+    return -1;
+  }
+  FILE* output = fopen(temp_path, "wb");
+  int ret = -1;
+  if (output) {
+    size_t written = fwrite(data, 1, size, output);
+    if (fclose(output) == 0 && written == (size_t) size && rename(temp_path, index->path) == 0) {
+      ret = 0;
+    } else {
+      remove(temp_path);
+    }
+  }
+  if (ret < 0) printf("Error: failed to write index %s: %s\n", index->path, strerror(errno));
+  av_free(temp_path);
+  av_free(data);
+
+  return ret;
+}
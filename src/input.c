@@ -0,0 +1,383 @@
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/macros.h>
+#include <libavutil/mem.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "visage_input.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/** Size of the buffer of the avio context the demuxer reads through. */
+#define VISAGE_INPUT_IO_SIZE 32768
+
+/** Allocates and initializes the input. Returns NULL on failure. */
+VisageInput* visage_alloc_input() {
+  VisageInput* input = av_mallocz(sizeof(VisageInput));
+  if (!input) return NULL;
+
+  // initialize properties to null
+  input->avio = NULL;
+  input->source = NULL;
+  input->buffer = NULL;
+  input->capacity = 0;
+  input->map = NULL;
+  input->advised_pos = 0;
+  input->size = -1;
+  input->read_pos = 0;
+  input->fill_pos = 0;
+  input->valid_pos = 0;
+  input->seek_pos = -1;
+  input->seek_ret = 0;
+  input->eof = 0;
+  input->error = 0;
+  atomic_init(&input->underruns, 0);
+  atomic_init(&input->abort, 0);
+  input->thread_started = 0;
+  pthread_mutex_init(&input->mutex, NULL);
+  pthread_cond_init(&input->cond, NULL);
+
+  return input;
+}
+
+/** Stops the background thread and any reads waiting for data. */
+void visage_abort_input(VisageInput* input) {
+  pthread_mutex_lock(&input->mutex);
+  atomic_store(&input->abort, 1);
+  pthread_cond_broadcast(&input->cond);
+  pthread_mutex_unlock(&input->mutex);
+}
+
+/** Frees the input. */
+void visage_free_input(VisageInput** input) {
+  if (!*input) return;
+
+  // stop filling before closing the source
+  visage_abort_input(*input);
+  if ((*input)->thread_started) pthread_join((*input)->thread, NULL);
+
+  if ((*input)->avio) av_freep(&(*input)->avio->buffer);
+  avio_context_free(&(*input)->avio);
+  avio_closep(&(*input)->source);
+  av_freep(&(*input)->buffer);
+#if !defined(_WIN32)
+  if ((*input)->map) munmap((*input)->map, (*input)->size);
+#endif
+  pthread_mutex_destroy(&(*input)->mutex);
+  pthread_cond_destroy(&(*input)->cond);
+  av_free(*input);
+  *input = NULL;
+}
+
+/** Interrupts blocking reads of the source once the input is aborted. */
+static int visage_input_interrupt(void* opaque) {
+  VisageInput* input = opaque;
+  return atomic_load(&input->abort);
+}
+
+/** Copies cached data for the demuxer, waiting for it to arrive. */
+static int visage_read_input(void* opaque, uint8_t* buf, int buf_size) {
+  VisageInput* input = opaque;
+  pthread_mutex_lock(&input->mutex);
+
+  // wait for the background thread, counting each time playback has to
+  if (input->read_pos == input->fill_pos && !input->eof && !atomic_load(&input->abort)) {
+    atomic_fetch_add(&input->underruns, 1);
+    while (input->read_pos == input->fill_pos && !input->eof && !atomic_load(&input->abort)) {
+      pthread_cond_wait(&input->cond, &input->mutex);
+    }
+  }
+
+  if (atomic_load(&input->abort) || input->read_pos == input->fill_pos) {
+    int ret = atomic_load(&input->abort) ? AVERROR_EXIT
+      : input->error ? input->error : AVERROR_EOF;
+    pthread_mutex_unlock(&input->mutex);
+    return ret;
+  }
+
+  // copy up to the end of the filled data or of the ring, whichever comes first
+  int64_t offset = input->read_pos % input->capacity;
+  int64_t size = FFMIN(input->fill_pos - input->read_pos, input->capacity - offset);
+  size = FFMIN(size, buf_size);
+  memcpy(buf, input->buffer + offset, size);
+  input->read_pos += size;
+
+  // make room for the background thread
+  pthread_cond_broadcast(&input->cond);
+  pthread_mutex_unlock(&input->mutex);
+
+  return size;
+}
+
+/** Moves the read position, from the cache when possible. */
+static int64_t visage_seek_input(void* opaque, int64_t offset, int whence) {
+  VisageInput* input = opaque;
+  if (whence == AVSEEK_SIZE) return input->size >= 0 ? input->size : AVERROR(ENOSYS);
+
+  pthread_mutex_lock(&input->mutex);
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE) {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = input->read_pos + offset;
+    break;
+  case SEEK_END:
+    pos = input->size >= 0 ? input->size + offset : -1;
+    break;
+  default:
+    pos = -1;
+    break;
+  }
+  if (pos < 0) {
+    pthread_mutex_unlock(&input->mutex);
+    return AVERROR(EINVAL);
+  }
+
+  // stay in the cache if it still holds the position
+  if (pos >= input->valid_pos && pos <= input->fill_pos) {
+    input->read_pos = pos;
+    pthread_cond_broadcast(&input->cond);
+    pthread_mutex_unlock(&input->mutex);
+    return pos;
+  }
+
+  // otherwise have the background thread seek the source
+  input->seek_pos = pos;
+  pthread_cond_broadcast(&input->cond);
+  while (input->seek_pos >= 0 && !atomic_load(&input->abort)) {
+    pthread_cond_wait(&input->cond, &input->mutex);
+  }
+  int64_t ret = atomic_load(&input->abort) ? AVERROR_EXIT : input->seek_ret;
+  pthread_mutex_unlock(&input->mutex);
+
+  return ret;
+}
+
+/** Fills the ring buffer from the source until aborted. */
+static void* visage_fill_input(void* arg) {
+  VisageInput* input = arg;
+  pthread_mutex_lock(&input->mutex);
+
+  while (!atomic_load(&input->abort)) {
+    // restart the cache at the position of a seek
+    if (input->seek_pos >= 0) {
+      int64_t pos = input->seek_pos;
+      pthread_mutex_unlock(&input->mutex);
+      int64_t ret = avio_seek(input->source, pos, SEEK_SET);
+      pthread_mutex_lock(&input->mutex);
+      if (ret >= 0) {
+        input->read_pos = pos;
+        input->fill_pos = pos;
+        input->valid_pos = pos;
+        input->eof = 0;
+        input->error = 0;
+      }
+      input->seek_ret = ret;
+      input->seek_pos = -1;
+      pthread_cond_broadcast(&input->cond);
+      continue;
+    }
+
+    // sleep while the buffer is full or the source is exhausted
+    int64_t space = input->capacity - (input->fill_pos - input->read_pos);
+    if (input->eof || space == 0) {
+      pthread_cond_wait(&input->cond, &input->mutex);
+      continue;
+    }
+
+    // read into the free space up to the end of the ring, giving up the data it overwrites
+    int64_t offset = input->fill_pos % input->capacity;
+    int size = FFMIN(FFMIN(space, input->capacity - offset), INT32_MAX);
+    input->valid_pos = FFMAX(input->valid_pos, input->fill_pos + size - input->capacity);
+    pthread_mutex_unlock(&input->mutex);
+    int ret = avio_read_partial(input->source, input->buffer + offset, size);
+    pthread_mutex_lock(&input->mutex);
+
+    if (ret > 0) {
+      input->fill_pos += ret;
+    } else if (ret == 0 || ret == AVERROR_EOF) {
+      input->eof = 1;
+    } else if (!atomic_load(&input->abort)) {
+      printf("Warning: failed to read the input: %s\n", av_err2str(ret));
+      input->error = ret;
+      input->eof = 1;
+    }
+    pthread_cond_broadcast(&input->cond);
+  }
+
+  pthread_mutex_unlock(&input->mutex);
+  return NULL;
+}
+
+/** Initializes the input for Visage. Outputs 0 on success, -1 on error. */
+int visage_init_input(const char* url, int64_t cache_size, VisageInput* input) {
+  // open the url, interruptible so that shutdown never hangs on the network
+  AVIOInterruptCB interrupt = {visage_input_interrupt, input};
+  int ret = avio_open2(&input->source, url, AVIO_FLAG_READ, &interrupt, NULL);
+  if (ret < 0) {
+    printf("Error: failed to open %s: %s\n", url, av_err2str(ret));
+    return -1;
+  }
+  input->size = avio_size(input->source);
+
+  // allocate the read-ahead cache
+  input->buffer = av_malloc(cache_size);
+  if (!input->buffer) {
+    printf("Error: failed to allocate memory for the input cache\n");
+    return -1;
+  }
+  input->capacity = cache_size;
+
+  // create the avio context for the demuxer to read the cache through
+  uint8_t* io_buffer = av_malloc(VISAGE_INPUT_IO_SIZE);
+  if (!io_buffer) {
+    printf("Error: failed to allocate memory for the input buffer\n");
+    return -1;
+  }
+  input->avio = avio_alloc_context(io_buffer, VISAGE_INPUT_IO_SIZE, 0, input,
+                                   visage_read_input, NULL, visage_seek_input);
+  if (!input->avio) {
+    av_free(io_buffer);
+    printf("Error: failed to allocate memory for the input context\n");
+    return -1;
+  }
+  input->avio->seekable = input->source->seekable;
+
+  // start filling the cache in the background
+  if (pthread_create(&input->thread, NULL, visage_fill_input, input) != 0) {
+    printf("Error: failed to start the input thread\n");
+    return -1;
+  }
+  input->thread_started = 1;
+
+  return 0;
+}
+
+/** Returns the number of bytes cached ahead of the demuxer. */
+int64_t visage_input_fill(VisageInput* input) {
+  if (input->map) return 0;
+  pthread_mutex_lock(&input->mutex);
+  int64_t fill = input->fill_pos - input->read_pos;
+  pthread_mutex_unlock(&input->mutex);
+  return fill;
+}
+
+#if !defined(_WIN32)
+/** Asks the kernel to read the mapping ahead of the position. */
+static void visage_advise_input(VisageInput* input, int64_t pos) {
+  // madvise needs page aligned addresses, and the mapping starts on a page
+  int64_t page = sysconf(_SC_PAGESIZE);
+  int64_t start = pos / page * page;
+  int64_t end = FFMIN(pos + VISAGE_INPUT_READAHEAD, input->size);
+  if (end > start) madvise(input->map + start, end - start, MADV_WILLNEED);
+  input->advised_pos = end;
+}
+
+/** Copies mapped data for the demuxer. */
+static int visage_read_map(void* opaque, uint8_t* buf, int buf_size) {
+  VisageInput* input = opaque;
+  if (input->read_pos >= input->size) return AVERROR_EOF;
+
+  // keep the read ahead going once half of it has been consumed
+  if (input->read_pos >= input->advised_pos - VISAGE_INPUT_READAHEAD / 2) {
+    visage_advise_input(input, input->read_pos);
+  }
+
+  int size = FFMIN(buf_size, input->size - input->read_pos);
+  memcpy(buf, input->map + input->read_pos, size);
+  input->read_pos += size;
+
+  return size;
+}
+
+/** Moves the read position in the mapping. */
+static int64_t visage_seek_map(void* opaque, int64_t offset, int whence) {
+  VisageInput* input = opaque;
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE) {
+  case AVSEEK_SIZE:
+    return input->size;
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = input->read_pos + offset;
+    break;
+  case SEEK_END:
+    pos = input->size + offset;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+  if (pos < 0) return AVERROR(EINVAL);
+
+  // start reading ahead at the new position right away
+  input->read_pos = pos;
+  if (pos < input->advised_pos - VISAGE_INPUT_READAHEAD || pos >= input->advised_pos) {
+    visage_advise_input(input, pos);
+  }
+
+  return pos;
+}
+#endif
+
+/** Maps the file for the demuxer to read. Outputs 0 on success, -1 on error. */
+int visage_map_input(const char* path, VisageInput* input) {
+#if defined(_WIN32)
+  printf("Error: mapping files is not supported on this platform\n");
+  return -1;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("Error: failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  // map the whole file, which stays mapped after closing the descriptor
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    printf("Error: %s is not a regular file\n", path);
+    close(fd);
+    return -1;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("Error: failed to map %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  input->map = map;
+  input->size = st.st_size;
+
+  // playback reads the file front to back, seeks restart the read ahead
+  madvise(input->map, input->size, MADV_SEQUENTIAL);
+  visage_advise_input(input, 0);
+
+  // create the avio context for the demuxer to read the mapping through
+  uint8_t* io_buffer = av_malloc(VISAGE_INPUT_IO_SIZE);
+  if (!io_buffer) {
+    printf("Error: failed to allocate memory for the input buffer\n");
+    return -1;
+  }
+  input->avio = avio_alloc_context(io_buffer, VISAGE_INPUT_IO_SIZE, 0, input,
+                                   visage_read_map, NULL, visage_seek_map);
+  if (!input->avio) {
+    av_free(io_buffer);
+    printf("Error: failed to allocate memory for the input context\n");
+    return -1;
+  }
+  input->avio->seekable = AVIO_SEEKABLE_NORMAL;
+
+  return 0;
+#endif
+}
@@ -1,314 +1,788 @@
 #include <SDL3/SDL_audio.h>
 #include <SDL3/SDL_error.h>
 #include <SDL3/SDL_events.h>
+#include <SDL3/SDL_hints.h>
 #include <SDL3/SDL_init.h>
 #include <SDL3/SDL_oldnames.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_pixels.h>
 #include <SDL3/SDL_render.h>
+#include <SDL3/SDL_timer.h>
 #include <SDL3/SDL_video.h>
-#include <libavcodec/avcodec.h>
-#include <libavcodec/codec_id.h>
-#include <libavcodec/codec_par.h>
-#include <libavcodec/packet.h>
 #include <libavformat/avformat.h>
-#include <libavutil/avutil.h>
-#include <libavutil/channel_layout.h>
-#include <libavutil/error.h>
+#include <libavutil/common.h>
 #include <libavutil/frame.h>
-#include <libavutil/pixfmt.h>
-#include <libavutil/samplefmt.h>
-#include <libswresample/swresample.h>
-#include <libswscale/swscale.h>
+#include <libavutil/time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include "visage_audio.h"
+#include "visage_demux.h"
+#include "visage_gpu.h"
+#include "visage_index.h"
+#include "visage_input.h"
+#include "visage_stats.h"
+#include "visage_video.h"
+#include "visage_wall.h"
+
+/** Thread entry point for reading packets from the file. */
+static void* visage_demux_thread(void* arg) {
+  visage_process_demux(arg);
+  return NULL;
+}
 
-int main(int argc, char *argv[]) {
-  // ensure that a file is passed into the program
-  if (argc < 2) {
-    char* program = argv[0];
-    printf("Usage: %s <file>\n", program);
-    return -1;
-  }
+/** Thread entry point for decoding video frames. */
+static void* visage_video_thread(void* arg) {
+  visage_process_video(arg);
+  return NULL;
+}
 
-  // open the file
-  char* file = argv[1];
-  AVFormatContext* format_ctx = NULL;
-  if (avformat_open_input(&format_ctx, file, NULL, NULL) != 0) {
-    printf("Error\n");
-    return -1;
-  }
+/** Thread entry point for decoding audio samples. */
+static void* visage_audio_thread(void* arg) {
+  visage_process_audio(arg);
+  return NULL;
+}
 
-  // get streams and setup variables for video and audio
-  avformat_find_stream_info(format_ctx, NULL);
-  int video_idx = -1;
-  int audio_idx = -1;
-  const AVCodec* video_codec = NULL;
-  AVCodecParameters* video_codecpar = NULL;
-  const AVCodec* audio_codec = NULL;
-  AVCodecParameters* audio_codecpar = NULL;
-
-  // find information for the video and audio streams
-  for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
-    // get stream and codec information
-    AVStream* stream = format_ctx->streams[i];
-    AVCodecParameters* par = stream->codecpar;
-    enum AVMediaType media_type = par->codec_type;
-
-    // detect if it is a video stream and set info
-    if (media_type == AVMEDIA_TYPE_VIDEO) {
-      video_codec = avcodec_find_decoder(par->codec_id);
-      video_codecpar = par;
-      video_idx = i;
-      continue;
-    }
+/** Size of the window until the size of the video is known. */
+#define VISAGE_WINDOW_WIDTH 1280
+#define VISAGE_WINDOW_HEIGHT 720
+
+/** Command line options. */
+static const struct option visage_options[] = {
+  {"hwaccel", required_argument, NULL, 'a'},
+  {"no-zero-copy", no_argument, NULL, 'z'},
+  {"threads", required_argument, NULL, 't'},
+  {"thread-type", required_argument, NULL, 'T'},
+  {"seek", required_argument, NULL, 's'},
+  {"cache", required_argument, NULL, 'c'},
+  {"frame-cache", required_argument, NULL, 'C'},
+  {"live", no_argument, NULL, 'l'},
+  {"low-latency", no_argument, NULL, 'L'},
+  {"fast-start", no_argument, NULL, 'f'},
+  {"index", no_argument, NULL, 'I'},
+  {"no-map", no_argument, NULL, 'M'},
+  {"adaptive", no_argument, NULL, 'A'},
+  {"stats", required_argument, NULL, 'S'},
+  {"help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0},
+};
+
+/** Prints the command line usage. */
+static void visage_usage(const char* program) {
+  printf("Usage: %s [options] <file>...\n", program);
+  printf("Several files are played muted side by side, click a video to focus it.\n");
+  printf("Options:\n");
+  printf("  --hwaccel <type>  hardware decoding: auto (default), none, or a device\n");
+  printf("                    type such as vaapi, cuda, videotoolbox or d3d11va\n");
+  printf("  --no-zero-copy    download hardware frames instead of presenting them\n");
+  printf("  --threads <n>     video decoder threads, 0 for one per physical core (default)\n");
+  printf("  --thread-type <t> video decoder threading: auto (default), frame or slice\n");
+  printf("  --seek <mode>     seeking with the arrow keys: fast (default) snaps to\n");
+  printf("                    keyframes, accurate lands on the exact time\n");
+  printf("  --cache <MiB>     read-ahead cache for network input, 0 to disable (default 8)\n");
+  printf("  --frame-cache <MiB>\n");
+  printf("                    decoded frames kept for seeking back, 0 to disable (default 256)\n");
+  printf("  --live            probe briefly and do not buffer, for live sources\n");
+  printf("  --low-latency     show the newest frame and keep audio queues short, for\n");
+  printf("                    live sources at the cost of smoothness, implies --live\n");
+  printf("  --fast-start      probe less of the file before playing\n");
+  printf("  --index           keep an index next to local files, to open and seek them\n");
+  printf("                    without probing the next time\n");
+  printf("  --no-map          read local files instead of mapping them, for files that\n");
+  printf("                    are still being written or may be truncated while playing\n");
+  printf("  --adaptive        upload frames at the size of the window when it is smaller\n");
+  printf("  --stats <file>    write playback statistics every second as JSON lines,\n");
+  printf("                    - for stderr, press i to show them over the video\n");
+  printf("Keys:\n");
+  printf("  left/right, down/up  seek by 10 seconds, by a minute\n");
+  printf("  space                pause or resume\n");
+  printf("  [ ]                  slower or faster, from 4x backwards to 4x forwards\n");
+  printf("  backspace            back to normal speed\n");
+  printf("  , .                  pause and step one frame backwards or forwards\n");
+}
 
-    // detect if it is an audio stream and set info
-    if (media_type == AVMEDIA_TYPE_AUDIO) {
-      audio_codec = avcodec_find_decoder(par->codec_id);
-      audio_codecpar = par;
-      audio_idx = i;
-      continue;
-    }
+/** Creates the renderer, preferring one that can present hardware frames. */
+static SDL_Renderer* visage_create_renderer(SDL_Window* window, int zero_copy) {
+#if defined(__linux__)
+  // dmabufs can only be imported by the OpenGL ES renderer
+  if (zero_copy) {
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, "opengles2");
+    if (renderer) return renderer;
   }
+#else
+  (void) zero_copy;
+#endif
+  return SDL_CreateRenderer(window, NULL);
+}
 
-  // throw an error if no video stream is detected
-  if (video_idx == -1 || video_codec == NULL) {
-    printf("Error: file must be a video file\n");
+/** Creates the window and its renderer, presenting on vsync where available. Outputs 0 on success, -1 on error. */
+static int visage_create_window(SDL_WindowFlags flags, int zero_copy, SDL_Window** window,
+                                SDL_Renderer** renderer) {
+  *window = SDL_CreateWindow("visage", VISAGE_WINDOW_WIDTH, VISAGE_WINDOW_HEIGHT,
+                             SDL_WINDOW_RESIZABLE | flags);
+  if (!*window) {
+    printf("Error: %s\n", SDL_GetError());
     return -1;
   }
 
-  // throw an error if no audio stream is detected
-  if (audio_idx == -1 || audio_codec == NULL) {
-    printf("Error: file does not have audio\n");
-    return -1;
-  }
-  
-  // initialize SDL
-  if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
+  // initialize SDL renderer
+  *renderer = visage_create_renderer(*window, zero_copy);
+  if (!*renderer) {
     printf("Error: %s\n", SDL_GetError());
     return -1;
   }
 
-  // create SDL window
-  SDL_Window* window = SDL_CreateWindow("visage",
-                                        video_codecpar->width, video_codecpar->height,
-                                        SDL_WINDOW_RESIZABLE);
-  if (!window) {
+  // pace presentation to the display, falling back to timers without vsync
+  if (!SDL_SetRenderVSync(*renderer, 1)) {
+    printf("Warning: vsync is not available, presenting on timers\n");
+  }
+
+  return 0;
+}
+
+/** Handles a single SDL event of the wall on the main thread. */
+static void visage_handle_wall_event(SDL_Event* event, SDL_Renderer* renderer, VisageWall* wall,
+                                     int* running) {
+  switch (event->type) {
+  case SDL_EVENT_QUIT:
+    *running = 0;
+    break;
+  case SDL_EVENT_MOUSE_BUTTON_DOWN:
+    // focus the clicked video, or go back to the grid
+    SDL_ConvertEventToRenderCoordinates(renderer, event);
+    visage_focus_wall(wall, event->button.x, event->button.y);
+    break;
+  case SDL_EVENT_WINDOW_MINIMIZED:
+  case SDL_EVENT_WINDOW_OCCLUDED:
+    // give the decoding time to other processes while nobody watches
+    visage_minimize_wall(wall, 1);
+    break;
+  case SDL_EVENT_WINDOW_RESTORED:
+  case SDL_EVENT_WINDOW_EXPOSED:
+    visage_minimize_wall(wall, 0);
+    wall->redraw = 1;
+    break;
+  case SDL_EVENT_WINDOW_DISPLAY_CHANGED:
+    // the new display may refresh at a different rate
+    wall->refresh_interval = -1;
+    wall->redraw = 1;
+    break;
+  case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+    visage_layout_wall(wall, event->window.data1, event->window.data2);
+    break;
+  }
+}
+
+/** Plays several files tiled into one window. Outputs 0 on success, -1 on error. */
+static int visage_play_wall(char** files, int nb_files, VisageWall* wall) {
+  // initialize SDL, using EGL so that the OpenGL ES renderer can import dmabufs
+  if (wall->zero_copy) SDL_SetHint(SDL_HINT_VIDEO_FORCE_EGL, "1");
+  if (!SDL_Init(SDL_INIT_VIDEO)) {
     printf("Error: %s\n", SDL_GetError());
     return -1;
   }
+  SDL_Window* window;
+  SDL_Renderer* renderer;
+  if (visage_create_window(0, wall->zero_copy, &window, &renderer) < 0) return -1;
+
+  // open the files and start decoding them on the shared workers
+  wall->frame_event = SDL_RegisterEvents(1);
+  if (visage_init_wall(renderer, files, nb_files, wall) < 0) return -1;
+  int window_width, window_height;
+  if (!SDL_GetWindowSizeInPixels(window, &window_width, &window_height)) {
+    window_width = VISAGE_WINDOW_WIDTH;
+    window_height = VISAGE_WINDOW_HEIGHT;
+  }
+  visage_layout_wall(wall, window_width, window_height);
 
-  // create audio specifications for SDL
-  SDL_AudioSpec audiospec = {0};
-  audiospec.channels = audio_codecpar->ch_layout.nb_channels;
-  audiospec.format = SDL_AUDIO_S16;
-  audiospec.freq = audio_codecpar->sample_rate;
+  // render the tiles on the main thread, woken up by the decoders when frames arrive
+  SDL_Event event;
+  int running = 1;
+  while (running) {
+    int delay = visage_display_wall(renderer, wall);
+
+    // stop once the last frame of every video has been shown
+    if (visage_wall_finished(wall)) break;
+
+    // sleep until the next frame is due or an event arrives, then handle all pending events
+    if (SDL_WaitEventTimeout(&event, delay)) {
+      do {
+        visage_handle_wall_event(&event, renderer, wall, &running);
+      } while (SDL_PollEvent(&event));
+    }
+  }
+
+  // cleanup everything, the textures of the tiles first
+  visage_free_wall(&wall);
+  SDL_DestroyRenderer(renderer);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+
+  return 0;
+}
+
+/** Returns 1 if the url is read through a protocol other than local files. */
+static int visage_network_input(const char* url) {
+  // formats such as rtsp handle their own I/O and have no protocol
+  const char* protocol = avio_find_protocol_name(url);
+  return protocol && strcmp(protocol, "file") != 0 && strcmp(protocol, "pipe") != 0;
+}
+
+/** Returns 1 if the path names a regular local file that can be mapped. */
+static int visage_local_file(const char* path) {
+#if defined(_WIN32)
+  (void) path;
+  return 0;
+#else
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+#endif
+}
 
-  // allocate memory for SWR conversion context and set parameters
-  SwrContext* swr_ctx = NULL;
-  int r = swr_alloc_set_opts2(&swr_ctx, &audio_codecpar->ch_layout, AV_SAMPLE_FMT_S16,
-                              audio_codecpar->sample_rate, &audio_codecpar->ch_layout,
-                              audio_codecpar->format, audio_codecpar->sample_rate, 0, NULL);
-  if (r < 0) {
-    printf("Error: failed to allocate audio conversion context\n");
+/** File to open and the decoding contexts opened from it during startup. */
+typedef struct VisageStartup {
+  const char* file;
+  int64_t cache_size;
+  int live;
+  int fast_start;
+  int use_index;
+  int map;
+  AVFormatContext* format_ctx;
+  VisageInput* input;
+  VisageIndex* index;
+  VisageAudio* audio;
+  int ret;
+} VisageStartup;
+
+/** Opens the file and the audio decoder. Outputs 0 on success, -1 on error. */
+static int visage_open_file(VisageStartup* startup) {
+  // read network input through the read-ahead cache, and local files from a mapping
+  const char* file = startup->file;
+  avformat_network_init();
+  AVFormatContext* format_ctx = avformat_alloc_context();
+  if (!format_ctx) {
+    printf("Error: failed to allocate memory for format context\n");
     return -1;
   }
+  int network = startup->cache_size > 0 && visage_network_input(file);
+  if (network || (startup->map && visage_local_file(file))) {
+    startup->input = visage_alloc_input();
+    if (!startup->input) {
+      printf("Error: failed to allocate memory for input\n");
+      return -1;
+    }
+    int ret = network ? visage_init_input(file, startup->cache_size, startup->input)
+      : visage_map_input(file, startup->input);
+    if (ret < 0 && network) return -1;
+    if (ret < 0) {
+      // files that cannot be mapped are still read through the file protocol
+      printf("Warning: reading %s without mapping it\n", file);
+      visage_free_input(&startup->input);
+    } else {
+      format_ctx->pb = startup->input->avio;
+      format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+  }
 
-  // initialize SWR conversion context
-  if (swr_init(swr_ctx) < 0) {
-    printf("Error: unable to initialize audio conversion context\n");
+  // bound how much of the file is probed, and do not buffer live sources while probing
+  AVDictionary* format_options = NULL;
+  if (startup->fast_start) {
+    av_dict_set(&format_options, "probesize", "1048576", 0);
+    av_dict_set(&format_options, "analyzeduration", "250000", 0);
+  }
+  if (startup->live) {
+    av_dict_set(&format_options, "fflags", "nobuffer", 0);
+    av_dict_set(&format_options, "probesize", "32768", 0);
+    av_dict_set(&format_options, "analyzeduration", "500000", 0);
+  }
+
+  // open the file
+  int ret = avformat_open_input(&format_ctx, file, NULL, &format_options);
+  av_dict_free(&format_options);
+  if (ret != 0) {
+    printf("Error: failed to open %s: %s\n", file, av_err2str(ret));
     return -1;
   }
+  startup->format_ctx = format_ctx;
+
+  // take the streams information from the index of an earlier playback, or probe for it
+  int indexed = 0;
+  if (startup->use_index && visage_local_file(file)) {
+    startup->index = visage_alloc_index();
+    if (!startup->index) {
+      printf("Error: failed to allocate memory for index\n");
+      return -1;
+    }
+    if (visage_init_index(file, startup->index) < 0) return -1;
+    indexed = visage_read_index(format_ctx, startup->index);
+  }
+  if (!indexed) avformat_find_stream_info(format_ctx, NULL);
 
-  // open and start the SDL audio device stream
-  SDL_AudioStream* audiostream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK,
-                                                           &audiospec, NULL, NULL);
-  if (!audiostream) {
-    printf("Error: %s\n", SDL_GetError());
+  // ensure there is a video to show
+  if (av_find_best_stream(format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0) < 0) {
+    printf("Error: file must be a video file\n");
     return -1;
   }
-  SDL_ResumeAudioStreamDevice(audiostream);
 
-  // initialize SDL renderer
-  SDL_Renderer* renderer = SDL_CreateRenderer(window, NULL);
-  if (!renderer) {
-    printf("Error: %s\n", SDL_GetError());
+  // set up the audio decoding context
+  startup->audio = visage_alloc_audio();
+  if (!startup->audio) {
+    printf("Error: failed to allocate memory for audio context\n");
     return -1;
   }
+  return visage_init_audio(format_ctx, startup->audio);
+}
+
+/** Thread entry point for opening the file during startup. */
+static void* visage_open_thread(void* arg) {
+  VisageStartup* startup = arg;
+  startup->ret = visage_open_file(startup);
+  return NULL;
+}
+
+/** Playback speeds the bracket keys step through, negative ones playing backwards. */
+static const double visage_speeds[] = {-4.0, -2.0, -1.0, 0.5, 1.0, 2.0, 4.0};
+
+/** Index of the normal speed in visage_speeds. */
+#define VISAGE_SPEED_NORMAL 4
+
+/** Speed and direction picked with the keyboard, and the contexts they apply to. */
+typedef struct VisagePlayback {
+  VisageVideo* video;
+  VisageAudio* audio;
+  int seek_mode;
+  int speed;
+  int paused;
+  int reverse;
+} VisagePlayback;
+
+/** Plays at the speed from now on, pausing at 0, with the audio resampled to match. */
+static void visage_set_speed(VisagePlayback* playback, double speed) {
+  visage_set_clock_speed(playback->video->clock, speed);
+
+  // audio changes pitch with the speed, and is silent while paused or playing backwards
+  SDL_AudioStream* stream = playback->audio->stream;
+  if (speed > 0) {
+    SDL_SetAudioStreamFrequencyRatio(stream, (float) speed);
+    SDL_ResumeAudioStreamDevice(stream);
+  } else {
+    SDL_PauseAudioStreamDevice(stream);
+  }
+}
 
-  // create texture to render the video
-  SDL_Texture* video_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV,
-                                                 SDL_TEXTUREACCESS_STREAMING,
-                                                 video_codecpar->width,
-                                                 video_codecpar->height);
+/** Turns playback around at the position, unless it goes that way already. */
+static void visage_turn_playback(VisagePlayback* playback, int reverse, int64_t position) {
+  if (reverse == playback->reverse) return;
+  playback->reverse = reverse;
+  visage_seek_video(playback->video, position,
+                    reverse ? VISAGE_SEEK_BACKWARD : VISAGE_SEEK_ACCURATE);
+}
 
-  // initialize the SWS conversion context
-  struct SwsContext* sws_ctx = sws_getContext(video_codecpar->width, video_codecpar->height,
-                                              video_codecpar->format, video_codecpar->width,
-                                              video_codecpar->height, AV_PIX_FMT_YUV420P,
-                                              SWS_BILINEAR, NULL, NULL, NULL);
+/** Plays at the picked speed, or pauses, in the direction of the speed. */
+static void visage_update_playback(VisagePlayback* playback) {
+  double speed = visage_speeds[playback->speed];
+  if (!playback->paused) {
+    visage_turn_playback(playback, speed < 0, visage_video_position(playback->video));
+  }
+  visage_set_speed(playback, playback->paused ? 0 : speed);
+}
 
-  // allocate memory for the audio codec context
-  AVCodecContext* audio_codec_ctx = avcodec_alloc_context3(audio_codec);
-  if (!audio_codec_ctx) {
-    printf("Error: failed to allocate memory for audio codec context\n");
-    return -1;
+/** Pauses and shows the next frame backwards or forwards, turning playback around if needed. */
+static void visage_step_playback(VisagePlayback* playback, int backward) {
+  VisageVideo* video = playback->video;
+  playback->paused = 1;
+  visage_set_speed(playback, 0);
+
+  // the first frame the other way is the one the seek lands on
+  if (backward == playback->reverse) {
+    visage_next_frame(video);
+  } else {
+    int64_t position = visage_video_position(video);
+    visage_turn_playback(playback, backward, backward ? position : position + 1);
   }
+}
 
-  // copy codec parameters to the video context
-  if (avcodec_parameters_to_context(audio_codec_ctx, audio_codecpar) < 0) {
-    printf("Error: failed to copy codec parameters to the audio context\n");
+/** Handles a single SDL event on the main thread. */
+static void visage_handle_event(const SDL_Event* event, VisagePlayback* playback, int* running) {
+  VisageVideo* video = playback->video;
+  int seek_mode = playback->reverse ? VISAGE_SEEK_BACKWARD : playback->seek_mode;
+  switch (event->type) {
+  case SDL_EVENT_QUIT:
+    *running = 0;
+    break;
+  case SDL_EVENT_KEY_DOWN:
+    // seek by 10 seconds with left and right, by a minute with down and up
+    switch (event->key.key) {
+    case SDLK_LEFT:
+      visage_seek_video(video, visage_video_position(video) - 10000, seek_mode);
+      break;
+    case SDLK_RIGHT:
+      visage_seek_video(video, visage_video_position(video) + 10000, seek_mode);
+      break;
+    case SDLK_DOWN:
+      visage_seek_video(video, visage_video_position(video) - 60000, seek_mode);
+      break;
+    case SDLK_UP:
+      visage_seek_video(video, visage_video_position(video) + 60000, seek_mode);
+      break;
+    case SDLK_SPACE:
+      playback->paused = !playback->paused;
+      visage_update_playback(playback);
+      break;
+    case SDLK_LEFTBRACKET:
+    case SDLK_RIGHTBRACKET:
+      // live sources play at the pace they are captured at, which audio catches up with
+      if (video->low_latency) break;
+
+      // step through the speeds, playing backwards below the slowest forward one
+      playback->speed += event->key.key == SDLK_RIGHTBRACKET ? 1 : -1;
+      playback->speed = av_clip(playback->speed, 0, FF_ARRAY_ELEMS(visage_speeds) - 1);
+      playback->paused = 0;
+      visage_update_playback(playback);
+      printf("Speed: %gx\n", visage_speeds[playback->speed]);
+      break;
+    case SDLK_BACKSPACE:
+      playback->speed = VISAGE_SPEED_NORMAL;
+      playback->paused = 0;
+      visage_update_playback(playback);
+      break;
+    case SDLK_COMMA:
+    case SDLK_PERIOD:
+      if (video->low_latency) break;
+      visage_step_playback(playback, event->key.key == SDLK_COMMA);
+      break;
+    case SDLK_I:
+      // toggle the statistics overlay
+      video->stats->overlay = !video->stats->overlay;
+      video->redraw = 1;
+      break;
+    }
+    break;
+  case SDL_EVENT_WINDOW_DISPLAY_CHANGED:
+    // the new display may refresh at a different rate
+    video->refresh_interval = -1;
+    video->redraw = 1;
+    break;
+  case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+    // pick the upload size for the new window size
+    visage_resize_video(video, event->window.data1, event->window.data2);
+    video->redraw = 1;
+    break;
+  case SDL_EVENT_WINDOW_EXPOSED:
+    // show the current frame at the new size right away
+    video->redraw = 1;
+    break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  // parse the command line options
+  const char* hwaccel = "auto";
+  int zero_copy = 1;
+  int thread_count = VISAGE_THREADS_AUTO;
+  int thread_type = VISAGE_THREADS_AUTO;
+  int seek_mode = VISAGE_SEEK_FAST;
+  int64_t cache_size = VISAGE_INPUT_CACHE_SIZE;
+  int64_t frame_cache_size = VISAGE_FRAME_CACHE_SIZE;
+  int live = 0;
+  int low_latency = 0;
+  int fast_start = 0;
+  int use_index = 0;
+  int map = 1;
+  int adaptive = 0;
+  const char* stats_path = NULL;
+  int option;
+  while ((option = getopt_long(argc, argv, "h", visage_options, NULL)) != -1) {
+    switch (option) {
+    case 'a':
+      hwaccel = optarg;
+      break;
+    case 'z':
+      zero_copy = 0;
+      break;
+    case 't':
+      thread_count = atoi(optarg);
+      if (thread_count < 0) {
+        printf("Error: invalid thread count \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'T':
+      if (strcmp(optarg, "frame") == 0) {
+        thread_type = FF_THREAD_FRAME;
+      } else if (strcmp(optarg, "slice") == 0) {
+        thread_type = FF_THREAD_SLICE;
+      } else if (strcmp(optarg, "auto") == 0) {
+        thread_type = VISAGE_THREADS_AUTO;
+      } else {
+        printf("Error: unknown thread type \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 's':
+      if (strcmp(optarg, "fast") == 0) {
+        seek_mode = VISAGE_SEEK_FAST;
+      } else if (strcmp(optarg, "accurate") == 0) {
+        seek_mode = VISAGE_SEEK_ACCURATE;
+      } else {
+        printf("Error: unknown seek mode \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'c':
+      cache_size = atoll(optarg) * 1024 * 1024;
+      if (cache_size < 0) {
+        printf("Error: invalid cache size \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'C':
+      frame_cache_size = atoll(optarg) * 1024 * 1024;
+      if (frame_cache_size < 0) {
+        printf("Error: invalid frame cache size \"%s\"\n", optarg);
+        return -1;
+      }
+      break;
+    case 'l':
+      live = 1;
+      break;
+    case 'L':
+      live = 1;
+      low_latency = 1;
+      break;
+    case 'f':
+      fast_start = 1;
+      break;
+    case 'I':
+      use_index = 1;
+      break;
+    case 'M':
+      map = 0;
+      break;
+    case 'A':
+      adaptive = 1;
+      break;
+    case 'S':
+      stats_path = optarg;
+      break;
+    default:
+      visage_usage(argv[0]);
+      return option == 'h' ? 0 : -1;
+    }
+  }
+
+  // ensure that a file is passed into the program
+  if (optind >= argc) {
+    visage_usage(argv[0]);
     return -1;
   }
 
-  // initialize the video codec context to use the given decoder
-  if (avcodec_open2(audio_codec_ctx, audio_codec, NULL) < 0) {
-    printf("Error: failed to initialize audio codec context\n");
+  // tile several files into one window, decoding them on a shared pool of workers
+  if (argc - optind > 1) {
+    VisageWall* wall = visage_alloc_wall();
+    if (!wall) {
+      printf("Error: failed to allocate memory for wall\n");
+      return -1;
+    }
+    wall->hwaccel = hwaccel;
+    wall->zero_copy = zero_copy;
+    wall->thread_count = thread_count;
+    wall->thread_type = thread_type;
+    wall->adaptive = adaptive;
+    return visage_play_wall(&argv[optind], argc - optind, wall);
+  }
+
+  // open the file and the audio decoder while SDL starts up
+  int64_t start_time = av_gettime_relative();
+  VisageStartup startup = {argv[optind], cache_size, live, fast_start, use_index, map,
+                           NULL, NULL, NULL, NULL, -1};
+  pthread_t open_thread;
+  if (pthread_create(&open_thread, NULL, visage_open_thread, &startup) != 0) {
+    printf("Error: failed to start the open thread\n");
     return -1;
   }
 
-  // allocate memory for the video codec context
-  AVCodecContext* video_codec_ctx = avcodec_alloc_context3(video_codec);
-  if (!video_codec_ctx) {
-    printf("Error: failed to allocate memory for video codec context\n");
+  // initialize SDL, using EGL so that the OpenGL ES renderer can import dmabufs
+  if (zero_copy) SDL_SetHint(SDL_HINT_VIDEO_FORCE_EGL, "1");
+  if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
+    printf("Error: %s\n", SDL_GetError());
     return -1;
   }
 
-  // copy codec parameters to the video context
-  if (avcodec_parameters_to_context(video_codec_ctx, video_codecpar) < 0) {
-    printf("Error: failed to copy codec parameters to the video context\n");
+  // create SDL window, hidden until the size of the video is known
+  SDL_Window* window;
+  SDL_Renderer* renderer;
+  if (visage_create_window(SDL_WINDOW_HIDDEN, zero_copy, &window, &renderer) < 0) return -1;
+
+  // open the audio device, the stream is bound once the decoder is known
+  SDL_AudioDeviceID audio_device = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
+  if (!audio_device) {
+    printf("Error: %s\n", SDL_GetError());
     return -1;
   }
 
-  // initialize the video codec context to use the given decoder
-  if (avcodec_open2(video_codec_ctx, video_codec, NULL) < 0) {
-    printf("Error: failed to initialize video codec context\n");
+  // wait for the file to be opened
+  pthread_join(open_thread, NULL);
+  if (startup.ret < 0) return -1;
+  AVFormatContext* format_ctx = startup.format_ctx;
+  VisageInput* input = startup.input;
+  VisageIndex* index = startup.index;
+  VisageAudio* audio = startup.audio;
+
+  // show the window at the size of the video
+  int video_idx = av_find_best_stream(format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  AVCodecParameters* codecpar = format_ctx->streams[video_idx]->codecpar;
+  SDL_SetWindowSize(window, codecpar->width, codecpar->height);
+  SDL_SetWindowPosition(window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
+  SDL_ShowWindow(window);
+
+  // set up the video decoding context
+  VisageVideo* video = visage_alloc_video();
+  if (!video) {
+    printf("Error: failed to allocate memory for video context\n");
     return -1;
   }
+  video->hwaccel = hwaccel;
+  video->adaptive = adaptive;
+  video->thread_count = thread_count;
+  video->thread_type = thread_type;
+  video->low_latency = low_latency;
+  video->cache_size = frame_cache_size;
+  audio->low_latency = low_latency;
+
+  // start with the size the window was shown at
+  int window_width, window_height;
+  if (SDL_GetWindowSizeInPixels(window, &window_width, &window_height)) {
+    visage_resize_video(video, window_width, window_height);
+  }
 
-  // allocate memory for packets
-  AVPacket* packet = av_packet_alloc();
-  if (!packet) {
-    printf("Error: failed to allocate memory for packets\n");
+  // present hardware frames directly when the renderer supports it
+  VisageGpu* gpu = visage_alloc_gpu();
+  if (!gpu) {
+    printf("Error: failed to allocate memory for gpu context\n");
     return -1;
   }
+  if (zero_copy && visage_init_gpu(renderer, video, gpu) < 0) return -1;
+  if (visage_init_video(format_ctx, video) < 0) return -1;
 
-  // allocate memory for frames
-  AVFrame* frame = av_frame_alloc();
-  if (!frame) {
-    printf("Error: failed to allocate memory for frames\n");
+  // collect statistics for the overlay and the JSON lines
+  VisageStats* stats = visage_alloc_stats();
+  if (!stats) {
+    printf("Error: failed to allocate memory for stats\n");
     return -1;
   }
-  
-  // allocate memory for scaled frame
-  AVFrame* scaled_frame = av_frame_alloc();
-  if (!scaled_frame) {
-    printf("Error: failed to allocate memory for scaled frames\n");
+  if (stats_path) {
+    stats->output = strcmp(stats_path, "-") == 0 ? stderr : fopen(stats_path, "w");
+    if (!stats->output) {
+      printf("Error: failed to open %s\n", stats_path);
+      return -1;
+    }
+  }
+  video->stats = stats;
+
+  // set up the clock audio drives and video follows
+  VisageClock* clock = visage_alloc_clock();
+  if (!clock) {
+    printf("Error: failed to allocate memory for clock\n");
     return -1;
   }
+  video->clock = clock;
+  audio->clock = clock;
 
-  // set scaled frame parameters for YUV format
-  scaled_frame->format = AV_PIX_FMT_YUV420P;
-  scaled_frame->width = video_codecpar->width;
-  scaled_frame->height = video_codecpar->height;
+  // set up the demuxer feeding both decoders
+  VisageDemuxer* demuxer = visage_alloc_demuxer();
+  if (!demuxer) {
+    printf("Error: failed to allocate memory for demuxer\n");
+    return -1;
+  }
+  if (visage_init_demuxer(format_ctx, video, audio, demuxer) < 0) return -1;
+  if (index) visage_restore_index(index, demuxer);
 
-  // allocate new buffer for scaled frames
-  int ret = av_frame_get_buffer(scaled_frame, 0);
-  if (ret < 0) {
-    printf("Error: %s\n", av_err2str(ret));
+  // feed the audio device from a stream in the format of the decoder
+  SDL_AudioStream* audiostream = SDL_CreateAudioStream(&audio->spec, NULL);
+  if (!audiostream || !SDL_BindAudioStream(audio_device, audiostream)) {
+    printf("Error: %s\n", SDL_GetError());
     return -1;
   }
+  audio->stream = audiostream;
 
-  // start SDl event loop
-  SDL_Event event;
+  // let the decoder wake the main thread up as soon as the first frame arrives
+  video->frame_event = SDL_RegisterEvents(1);
 
-  // read frames from the stream
-  while (av_read_frame(format_ctx, packet) >= 0) {
-    // poll SDL events
-    SDL_PollEvent(&event);
+  // start the demuxing and decoding threads
+  pthread_t demux_thread, video_thread, audio_thread;
+  pthread_create(&demux_thread, NULL, visage_demux_thread, demuxer);
+  pthread_create(&video_thread, NULL, visage_video_thread, video);
+  pthread_create(&audio_thread, NULL, visage_audio_thread, audio);
 
-    // handle SDL events
-    switch (event.type) {
-    case SDL_EVENT_QUIT:
-      goto cleanup;
+  // start SDL event loop, woken up by the decoder when frames arrive
+  SDL_Event event;
+  int running = 1;
+  VisagePlayback playback = {video, audio, seek_mode, VISAGE_SPEED_NORMAL, 0, 0};
+
+  // render frames from the queue on the main thread
+  int first_frame = 1;
+  while (running) {
+    // present the frame due at the next vblank
+    int delay = visage_display_frame(renderer, video);
+    if (first_frame && video->shown_texture) {
+      printf("Time to first frame: %d ms\n", (int) ((av_gettime_relative() - start_time) / 1000));
+      first_frame = 0;
     }
 
-    // ensure it is an audio or video frame
-    if (packet->stream_index != video_idx && packet->stream_index != audio_idx) continue;
-
-    // handle if it is a video frame
-    if (packet->stream_index == video_idx) {
-      // send packet to the decoder
-      int send_ret = avcodec_send_packet(video_codec_ctx, packet);
-      av_packet_unref(packet);
-      if (send_ret < 0) {
-        printf("Error: %s\n", av_err2str(send_ret));
-        return -1;
-      }
-    
-      // receive frame from the decoder
-      while (avcodec_receive_frame(video_codec_ctx, frame) >= 0) {
-        // convert the frame into the YUV format
-        sws_scale(sws_ctx, (const uint8_t *const *) frame->data, frame->linesize,
-                  0, frame->height, scaled_frame->data, scaled_frame->linesize);
-
-        // update texture with new frame data
-        SDL_UpdateYUVTexture(video_texture, NULL,
-                             scaled_frame->data[0], scaled_frame->linesize[0],
-                             scaled_frame->data[1], scaled_frame->linesize[1],
-                             scaled_frame->data[2], scaled_frame->linesize[2]);
-
-        // clear current renderer and copy new texture
-        SDL_RenderClear(renderer);
-        SDL_RenderTexture(renderer, video_texture, NULL, NULL);
-        SDL_RenderPresent(renderer);
-      }
+    // stop once the last frame has been shown, or pause on the first one when playing backwards
+    if (visage_video_finished(video)) {
+      if (!playback.reverse) break;
+      playback.paused = 1;
+      visage_set_speed(&playback, 0);
+      visage_turn_playback(&playback, 0, 0);
     }
-    
-    // handle if it is an audio frame
-    else if (packet->stream_index == audio_idx) {
-      // send packet to the decoder
-      int send_ret = avcodec_send_packet(audio_codec_ctx, packet);
-      av_packet_unref(packet);
-      if (send_ret < 0) {
-        printf("Error: %s\n", av_err2str(send_ret));
-        return -1;
-      }
-      
-      while (avcodec_receive_frame(audio_codec_ctx, frame) >= 0) {
-        // allocate output sample buffer
-        uint8_t* buffer;
-        av_samples_alloc(&buffer, NULL, audiospec.channels, frame->nb_samples,
-                         AV_SAMPLE_FMT_S16, 0);
-
-        // convert to S16 format
-        swr_convert(swr_ctx, &buffer, frame->nb_samples, (const uint8_t**)frame->data,
-                    frame->nb_samples);
-            
-        // put samples to the audio stream
-        SDL_PutAudioStreamData(audiostream, buffer,
-                               frame->nb_samples * audiospec.channels * sizeof(int16_t));
-
-        // free the buffer
-        av_freep(&buffer);
-      }
+
+    // report once per interval, showing the new report right away
+    if (visage_update_stats(stats, video, audio, input) && stats->overlay) video->redraw = 1;
+
+    // sleep until the next frame is due or an event arrives, then handle all pending events
+    if (SDL_WaitEventTimeout(&event, delay)) {
+      do {
+        visage_handle_event(&event, &playback, &running);
+      } while (SDL_PollEvent(&event));
     }
   }
 
+  // stop the worker threads and wait for them to exit
+  visage_abort_video(video);
+  visage_abort_audio(audio);
+  if (input) visage_abort_input(input);
+  pthread_join(demux_thread, NULL);
+  pthread_join(video_thread, NULL);
+  pthread_join(audio_thread, NULL);
+
+  printf("Dropped frames: %u\n", atomic_load(&video->frames_dropped));
+  if (input && !input->map) printf("Input underruns: %u\n", atomic_load(&input->underruns));
+
+  // keep the keyframes found for the next playback
+  if (index) visage_write_index(format_ctx, demuxer, index);
+
   // cleanup everything
- cleanup:
-  av_frame_free(&scaled_frame);
-  av_frame_free(&frame);
-  av_packet_free(&packet);
-  avcodec_free_context(&video_codec_ctx);
-  avcodec_free_context(&audio_codec_ctx);
-  sws_freeContext(sws_ctx);
+  visage_free_demuxer(&demuxer);
+  visage_free_index(&index);
+  visage_free_video(&video);
+  visage_free_audio(&audio);
+  visage_free_gpu(&gpu);
+  visage_free_clock(&clock);
+  if (stats->output && stats->output != stderr) fclose(stats->output);
+  visage_free_stats(&stats);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyAudioStream(audiostream);
-  swr_free(&swr_ctx);
+  SDL_CloseAudioDevice(audio_device);
+  SDL_DestroyWindow(window);
   SDL_Quit();
-  avformat_free_context(format_ctx);
+  avformat_close_input(&format_ctx);
+  visage_free_input(&input);
 
   return 0;
 }
@@ -0,0 +1,248 @@
+#include <libavcodec/packet.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+#include <pthread.h>
+#include "visage_arena.h"
+#include "visage_packet_queue.h"
+
+/** Allocates and initializes an empty packet queue. Returns NULL on failure. */
+VisagePacketQueue* visage_alloc_packet_queue() {
+  VisagePacketQueue* queue = av_mallocz(sizeof(VisagePacketQueue));
+  if (!queue) return NULL;
+
+  // initialize properties to empty
+  queue->first = NULL;
+  queue->last = NULL;
+  queue->nb_packets = 0;
+  queue->size = 0;
+  queue->duration = 0;
+  queue->time_base = (AVRational) {1, 1000};
+  queue->finished = 0;
+  queue->drained = 0;
+  queue->serial = 0;
+  queue->abort = 0;
+  queue->free_nodes = NULL;
+
+  // nodes come from the arena of the queue and are recycled through the free list
+  queue->nodes = visage_alloc_arena();
+  if (!queue->nodes || visage_init_arena(queue->nodes, sizeof(VisagePacketNode), 0) < 0) {
+    visage_free_arena(&queue->nodes);
+    av_free(queue);
+    return NULL;
+  }
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->cond, NULL);
+
+  return queue;
+}
+
+/** Frees the packets of a list of nodes, leaving the nodes to the arena. */
+static void visage_free_packet_nodes(VisagePacketNode* node) {
+  while (node) {
+    av_packet_free(&node->packet);
+    node = node->next;
+  }
+}
+
+/** Frees the packet queue and all the packets in it. */
+void visage_free_packet_queue(VisagePacketQueue** queue) {
+  if (!*queue) return;
+
+  visage_free_packet_nodes((*queue)->first);
+  visage_free_packet_nodes((*queue)->free_nodes);
+  visage_free_arena(&(*queue)->nodes);
+
+  pthread_cond_destroy(&(*queue)->cond);
+  pthread_mutex_destroy(&(*queue)->mutex);
+  av_free(*queue);
+  *queue = NULL;
+}
+
+/** Takes a node off the free list, or a new one from the arena. Must be called with the lock held. Returns NULL on failure. */
+static VisagePacketNode* visage_get_packet_node(VisagePacketQueue* queue) {
+  VisagePacketNode* node = queue->free_nodes;
+  if (node) {
+    queue->free_nodes = node->next;
+    node->next = NULL;
+    return node;
+  }
+
+  // only happens until the queue has seen its largest size
+  node = visage_arena_get(queue->nodes);
+  if (!node) return NULL;
+  node->packet = av_packet_alloc();
+  // on failure the node stays unused until the arena is freed
+  if (!node->packet) return NULL;
+  node->next = NULL;
+  return node;
+}
+
+/** Moves a packet to the end of the queue. Returns 0 on success, -1 on error. */
+int visage_put_packet(VisagePacketQueue* queue, AVPacket* packet) {
+  pthread_mutex_lock(&queue->mutex);
+  if (queue->abort) {
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+  VisagePacketNode* node = visage_get_packet_node(queue);
+  if (!node) {
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+  av_packet_move_ref(node->packet, packet);
+
+  // add to the queue
+  if (!queue->last) {
+    queue->first = node;
+  } else {
+    queue->last->next = node;
+  }
+  queue->last = node;
+  queue->nb_packets++;
+  queue->size += node->packet->size + sizeof(*node);
+  queue->duration += node->packet->duration;
+  pthread_cond_signal(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+
+  return 0;
+}
+
+/** Takes the next packet from the queue, waiting for one if block is set. Returns 1 on success, 0 on end of stream, -1 on abort, VISAGE_PACKET_EMPTY if there is none yet. */
+static int visage_take_packet(VisagePacketQueue* queue, AVPacket* packet, int* serial,
+                              int block) {
+  pthread_mutex_lock(&queue->mutex);
+
+  // wait for a packet to arrive, or for an end of stream not reported yet
+  while (!queue->first && !(queue->finished && !queue->drained) && !queue->abort) {
+    if (!block) {
+      pthread_mutex_unlock(&queue->mutex);
+      return VISAGE_PACKET_EMPTY;
+    }
+    pthread_cond_wait(&queue->cond, &queue->mutex);
+  }
+  *serial = queue->serial;
+
+  // check if the queue was aborted or has run out
+  if (queue->abort) {
+    pthread_mutex_unlock(&queue->mutex);
+    return -1;
+  }
+  if (!queue->first) {
+    queue->drained = 1;
+    pthread_mutex_unlock(&queue->mutex);
+    return 0;
+  }
+
+  // unlink the first node
+  VisagePacketNode* node = queue->first;
+  queue->first = node->next;
+  if (!queue->first) queue->last = NULL;
+  queue->nb_packets--;
+  queue->size -= node->packet->size + sizeof(*node);
+  queue->duration -= node->packet->duration;
+
+  // hand the packet reference to the caller, which leaves the node blank for reuse
+  av_packet_move_ref(packet, node->packet);
+  node->next = queue->free_nodes;
+  queue->free_nodes = node;
+  pthread_mutex_unlock(&queue->mutex);
+
+  return 1;
+}
+
+/** Takes the next packet from the queue. Returns 1 on success, 0 on end of stream, -1 on abort. */
+int visage_get_packet(VisagePacketQueue* queue, AVPacket* packet, int* serial) {
+  return visage_take_packet(queue, packet, serial, 1);
+}
+
+/** Takes the next packet from the queue without waiting. Returns VISAGE_PACKET_EMPTY if there is none yet. */
+int visage_poll_packet(VisagePacketQueue* queue, AVPacket* packet, int* serial) {
+  return visage_take_packet(queue, packet, serial, 0);
+}
+
+/** Returns the number of packets in the queue. */
+int visage_count_packets(VisagePacketQueue* queue) {
+  pthread_mutex_lock(&queue->mutex);
+  int nb_packets = queue->nb_packets;
+  pthread_mutex_unlock(&queue->mutex);
+  return nb_packets;
+}
+
+/** Returns the memory held by the queued packets in bytes. */
+int64_t visage_packet_queue_size(VisagePacketQueue* queue) {
+  pthread_mutex_lock(&queue->mutex);
+  int64_t size = queue->size;
+  pthread_mutex_unlock(&queue->mutex);
+  return size;
+}
+
+/** Returns the duration of the queued packets in milliseconds. */
+int64_t visage_packet_queue_duration(VisagePacketQueue* queue) {
+  pthread_mutex_lock(&queue->mutex);
+  int64_t duration = av_rescale_q(queue->duration, queue->time_base, (AVRational) {1, 1000});
+  pthread_mutex_unlock(&queue->mutex);
+  return duration;
+}
+
+/** Marks the end of the stream for the queue. */
+void visage_finish_packet_queue(VisagePacketQueue* queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->finished = 1;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+/** Discards all packets in the queue and starts a new serial. */
+void visage_flush_packet_queue(VisagePacketQueue* queue) {
+  pthread_mutex_lock(&queue->mutex);
+  VisagePacketNode* first = queue->first;
+  queue->first = NULL;
+  queue->last = NULL;
+  queue->nb_packets = 0;
+  queue->size = 0;
+  queue->duration = 0;
+  queue->finished = 0;
+  queue->drained = 0;
+  queue->serial++;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+
+  // release the packet data outside of the lock
+  VisagePacketNode* last = first;
+  for (VisagePacketNode* node = first; node; node = node->next) {
+    av_packet_unref(node->packet);
+    last = node;
+  }
+
+  // give the blank nodes back for reuse
+  if (first) {
+    pthread_mutex_lock(&queue->mutex);
+    last->next = queue->free_nodes;
+    queue->free_nodes = first;
+    pthread_mutex_unlock(&queue->mutex);
+  }
+}
+
+/** Returns the serial of the queue. */
+int visage_packet_queue_serial(VisagePacketQueue* queue) {
+  pthread_mutex_lock(&queue->mutex);
+  int serial = queue->serial;
+  pthread_mutex_unlock(&queue->mutex);
+  return serial;
+}
+
+/** Aborts the queue and wakes up all waiting threads. */
+void visage_abort_packet_queue(VisagePacketQueue* queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->abort = 1;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+/** Returns 1 if the queue has been aborted, 0 otherwise. */
+int visage_packet_queue_aborted(VisagePacketQueue* queue) {
+  pthread_mutex_lock(&queue->mutex);
+  int abort = queue->abort;
+  pthread_mutex_unlock(&queue->mutex);
+  return abort;
+}
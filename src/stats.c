@@ -0,0 +1,201 @@
+#include <SDL3/SDL_render.h>
+#include <libavutil/macros.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "visage_audio.h"
+#include "visage_input.h"
+#include "visage_packet_queue.h"
+#include "visage_stats.h"
+#include "visage_video.h"
+
+/** Names of the stages in the overlay and the JSON lines. */
+static const char* visage_stage_names[VISAGE_STAGES] = {
+  "demux", "decode", "convert", "upload", "present",
+};
+
+/** Allocates empty stats. Returns NULL on failure. */
+VisageStats* visage_alloc_stats() {
+  VisageStats* stats = av_mallocz(sizeof(VisageStats));
+  if (!stats) return NULL;
+
+  // initialize properties to empty
+  for (int i = 0; i < VISAGE_STAGES; i++) {
+    atomic_init(&stats->stages[i].total, 0);
+    atomic_init(&stats->stages[i].max, 0);
+    atomic_init(&stats->stages[i].count, 0);
+    stats->stage_avg[i] = 0;
+    stats->stage_max[i] = 0;
+  }
+  stats->histograms = NULL;
+  stats->frames_repeated = 0;
+  stats->drift = 0;
+  stats->latency = -1;
+  stats->latency_peak = -1;
+  stats->latency_max = -1;
+  stats->fps = 0;
+  stats->started = av_gettime_relative();
+  stats->updated = stats->started;
+  stats->overlay = 0;
+  stats->output = NULL;
+
+  return stats;
+}
+
+/** Frees the stats. */
+void visage_free_stats(VisageStats** stats) {
+  if (!*stats) return;
+
+  av_free((*stats)->histograms);
+  av_free(*stats);
+  *stats = NULL;
+}
+
+/** Adds the time since start to the stage. */
+void visage_record_stage(VisageStats* stats, int stage, int64_t start) {
+  if (!stats) return;
+
+  // each stage has a single writer, so the maximum needs no compare and swap
+  int64_t elapsed = av_gettime_relative() - start;
+  VisageStageTimes* times = &stats->stages[stage];
+  atomic_fetch_add_explicit(&times->total, elapsed, memory_order_relaxed);
+  atomic_fetch_add_explicit(&times->count, 1, memory_order_relaxed);
+  if (elapsed > atomic_load_explicit(&times->max, memory_order_relaxed)) {
+    atomic_store_explicit(&times->max, elapsed, memory_order_relaxed);
+  }
+
+  if (stats->histograms) {
+    int64_t bucket = FFMIN(elapsed / VISAGE_STATS_BUCKET_US, VISAGE_STATS_BUCKETS - 1);
+    atomic_fetch_add_explicit(&stats->histograms[stage * VISAGE_STATS_BUCKETS + bucket], 1,
+                              memory_order_relaxed);
+  }
+}
+
+/** Keeps the latency of the presented frame, in milliseconds. */
+void visage_record_latency(VisageStats* stats, int64_t latency) {
+  if (!stats) return;
+
+  stats->latency = latency / 1000;
+  stats->latency_peak = FFMAX(stats->latency_peak, stats->latency);
+}
+
+/** Allocates the timing histograms. Outputs 0 on success, -1 on error. */
+int visage_alloc_histograms(VisageStats* stats) {
+  stats->histograms = av_calloc(VISAGE_STAGES * VISAGE_STATS_BUCKETS, sizeof(atomic_uint));
+  if (!stats->histograms) {
+    printf("Error: failed to allocate memory for histograms\n");
+    return -1;
+  }
+  return 0;
+}
+
+/** Returns the percentile of the timings of the stage in microseconds. */
+int64_t visage_stage_percentile(VisageStats* stats, int stage, double percentile) {
+  atomic_uint* histogram = &stats->histograms[stage * VISAGE_STATS_BUCKETS];
+  uint64_t count = 0;
+  for (int i = 0; i < VISAGE_STATS_BUCKETS; i++) count += atomic_load(&histogram[i]);
+  if (count == 0) return 0;
+
+  // walk up to the bucket holding the rank of the percentile
+  uint64_t rank = (uint64_t) (count * percentile / 100.0);
+  uint64_t seen = 0;
+  for (int i = 0; i < VISAGE_STATS_BUCKETS; i++) {
+    seen += atomic_load(&histogram[i]);
+    if (seen > rank) return (int64_t) (i + 1) * VISAGE_STATS_BUCKET_US;
+  }
+  return (int64_t) VISAGE_STATS_BUCKETS * VISAGE_STATS_BUCKET_US;
+}
+
+/** Writes the report as a JSON line. */
+static void visage_write_stats(VisageStats* stats) {
+  FILE* output = stats->output;
+  fprintf(output, "{\"time_ms\":%" PRId64, (stats->updated - stats->started) / 1000);
+  for (int i = 0; i < VISAGE_STAGES; i++) {
+    fprintf(output, ",\"%s_avg_us\":%" PRId64 ",\"%s_max_us\":%" PRId64,
+            visage_stage_names[i], stats->stage_avg[i], visage_stage_names[i], stats->stage_max[i]);
+  }
+  fprintf(output, ",\"fps\":%.2f,\"video_frames\":%u,\"video_packets\":%d", stats->fps,
+          stats->video_frames, stats->video_packets);
+  fprintf(output, ",\"audio_packets\":%d,\"audio_queued_ms\":%" PRId64, stats->audio_packets,
+          stats->audio_queued);
+  fprintf(output, ",\"input_fill\":%" PRId64 ",\"dropped\":%u,\"repeated\":%u", stats->input_fill,
+          stats->dropped, stats->repeated);
+  fprintf(output, ",\"drift_ms\":%" PRId64 ",\"latency_ms\":%" PRId64, stats->drift,
+          stats->latency);
+  fprintf(output, ",\"latency_max_ms\":%" PRId64 "}\n", stats->latency_max);
+  fflush(output);
+}
+
+/** Makes a report once per interval. Returns 1 if one was made. */
+int visage_update_stats(VisageStats* stats, VisageVideo* video, VisageAudio* audio,
+                        VisageInput* input) {
+  if (!stats) return 0;
+  int64_t now = av_gettime_relative();
+  int64_t interval = now - stats->updated;
+  if (interval < VISAGE_STATS_INTERVAL_MS * 1000) return 0;
+  stats->updated = now;
+
+  // take the timings of the interval, starting the next one at zero
+  for (int i = 0; i < VISAGE_STAGES; i++) {
+    VisageStageTimes* times = &stats->stages[i];
+    int64_t total = atomic_exchange_explicit(&times->total, 0, memory_order_relaxed);
+    unsigned int count = atomic_exchange_explicit(&times->count, 0, memory_order_relaxed);
+    stats->stage_max[i] = atomic_exchange_explicit(&times->max, 0, memory_order_relaxed);
+    stats->stage_avg[i] = count ? total / count : 0;
+    if (i == VISAGE_STAGE_UPLOAD) stats->fps = count * 1000000.0 / interval;
+  }
+
+  // sample the queues
+  stats->video_frames = visage_count_video(video);
+  stats->video_packets = visage_count_packets(video->packets);
+  stats->audio_packets = audio ? visage_count_packets(audio->packets) : 0;
+  stats->audio_queued = audio && audio->stream ? visage_queued_audio(audio) : 0;
+  stats->input_fill = input ? visage_input_fill(input) : 0;
+  stats->dropped = atomic_load(&video->frames_dropped);
+  stats->repeated = stats->frames_repeated;
+  stats->latency_max = stats->latency_peak;
+  stats->latency_peak = -1;
+
+  if (stats->output) visage_write_stats(stats);
+  return 1;
+}
+
+/** Draws the report over the video when the overlay is on. */
+void visage_draw_stats(VisageStats* stats, SDL_Renderer* renderer) {
+  if (!stats || !stats->overlay) return;
+
+  // format the report into lines of the debug font
+  char lines[VISAGE_STAGES + 7][64];
+  int count = 0;
+  for (int i = 0; i < VISAGE_STAGES; i++) {
+    snprintf(lines[count++], sizeof(lines[0]), "%-8s avg %6.2f ms max %6.2f ms",
+             visage_stage_names[i], stats->stage_avg[i] / 1000.0, stats->stage_max[i] / 1000.0);
+  }
+  snprintf(lines[count++], sizeof(lines[0]), "fps      %.2f", stats->fps);
+  snprintf(lines[count++], sizeof(lines[0]), "frames   %u queued", stats->video_frames);
+  snprintf(lines[count++], sizeof(lines[0]), "packets  %d video %d audio", stats->video_packets,
+           stats->audio_packets);
+  snprintf(lines[count++], sizeof(lines[0]), "audio    %" PRId64 " ms queued, input %" PRId64 " KiB",
+           stats->audio_queued, stats->input_fill / 1024);
+  snprintf(lines[count++], sizeof(lines[0]), "dropped  %u repeated %u", stats->dropped,
+           stats->repeated);
+  snprintf(lines[count++], sizeof(lines[0]), "drift    %+" PRId64 " ms", stats->drift);
+  if (stats->latency >= 0) {
+    snprintf(lines[count++], sizeof(lines[0]), "latency  %" PRId64 " ms max %" PRId64 " ms",
+             stats->latency, stats->latency_max);
+  }
+
+  // draw on a dark box so that the text stays readable on any frame
+  float line_height = SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2;
+  SDL_FRect box = {4, 4, 46 * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 8, count * line_height + 8};
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+  SDL_RenderFillRect(renderer, &box);
+  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+  for (int i = 0; i < count; i++) {
+    SDL_RenderDebugText(renderer, box.x + 4, box.y + 4 + i * line_height, lines[i]);
+  }
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+}
@@ -0,0 +1,80 @@
+#include <libavcodec/avcodec.h>
+#include <libavutil/cpu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "visage_threads.h"
+
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/** Returns the number of physical cores, at least 1. */
+int visage_physical_cores() {
+  int cores = 0;
+
+#if defined(__APPLE__)
+  size_t size = sizeof(cores);
+  if (sysctlbyname("hw.physicalcpu", &cores, &size, NULL, 0) != 0) cores = 0;
+#elif defined(_WIN32)
+  // count the processor core entries of the topology
+  DWORD size = 0;
+  GetLogicalProcessorInformation(NULL, &size);
+  SYSTEM_LOGICAL_PROCESSOR_INFORMATION* info = malloc(size);
+  if (info && GetLogicalProcessorInformation(info, &size)) {
+    for (DWORD i = 0; i < size / sizeof(*info); i++) {
+      if (info[i].Relationship == RelationProcessorCore) cores++;
+    }
+  }
+  free(info);
+#else
+  // count the cpus that come first among the hyperthreads of their core
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  for (long i = 0; i < cpus; i++) {
+    char path[96];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%ld/topology/thread_siblings_list", i);
+    FILE* file = fopen(path, "r");
+    if (!file) continue;
+    long first;
+    if (fscanf(file, "%ld", &first) == 1 && first == i) cores++;
+    fclose(file);
+  }
+#endif
+
+  // fall back to the logical processors when the topology is unavailable
+  if (cores <= 0) cores = av_cpu_count();
+  return cores > 0 ? cores : 1;
+}
+
+/** Picks the thread count and type of the decoder. */
+void visage_init_threads(AVCodecContext* codec_ctx, int count, int type) {
+  codec_ctx->thread_count = count > 0 ? count : visage_physical_cores();
+  if (type != VISAGE_THREADS_AUTO) {
+    codec_ctx->thread_type = type;
+    return;
+  }
+
+  // choose between frame and slice threading for this codec
+  int capabilities = codec_ctx->codec ? codec_ctx->codec->capabilities : 0;
+  const AVCodecDescriptor* desc = avcodec_descriptor_get(codec_ctx->codec_id);
+  int intra_only = desc && (desc->props & AV_CODEC_PROP_INTRA_ONLY);
+  if (intra_only && (capabilities & AV_CODEC_CAP_SLICE_THREADS)) {
+    codec_ctx->thread_type = FF_THREAD_SLICE;
+  } else if (capabilities & AV_CODEC_CAP_FRAME_THREADS) {
+    codec_ctx->thread_type = FF_THREAD_FRAME;
+  } else {
+    codec_ctx->thread_type = FF_THREAD_SLICE;
+  }
+}
+
+/** Returns the name of the threading type in use. */
+const char* visage_thread_type_name(const AVCodecContext* codec_ctx) {
+  if (codec_ctx->thread_count <= 1) return "none";
+  if (codec_ctx->active_thread_type & FF_THREAD_FRAME) return "frame";
+  if (codec_ctx->active_thread_type & FF_THREAD_SLICE) return "slice";
+  return "none";
+}
@@ -1,206 +1,950 @@
+#include <SDL3/SDL_error.h>
+#include <SDL3/SDL_events.h>
+#include <SDL3/SDL_properties.h>
+#include <SDL3/SDL_render.h>
+#include <SDL3/SDL_video.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/frame.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mathematics.h>
 #include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
 #include <libswscale/swscale.h>
 #include <libavcodec/codec_par.h>
 #include <libavformat/avformat.h>
-#include <pthread.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "visage_convert.h"
+#include "visage_frame_cache.h"
+#include "visage_frame_pool.h"
+#include "visage_gpu.h"
+#include "visage_hwaccel.h"
+#include "visage_packet_queue.h"
+#include "visage_stats.h"
+#include "visage_threads.h"
+#include "visage_video.h"
 
-/**
- * Holds the queue of video frames.
- */
-typedef struct VisageVideoFrames {
-  /** The video frame. */
-  AVFrame* frame;
+/** Shortest wait in microseconds when the frame queue is full. */
+#define VISAGE_VIDEO_MIN_BACKOFF 100
 
-  /** The next video frame. */
-  struct VisageVideoFrames* next;
+/** Longest wait in microseconds when the frame queue is full. */
+#define VISAGE_VIDEO_MAX_BACKOFF 4000
 
-  /** The PTS in milliseconds. */
-  uint64_t pts;
-} VisageVideoFrames;
-
-/** Allocates and initializes the video frames queue. Returns NULL on failure. */
-VisageVideoFrames* visage_alloc_frames() {
-  VisageVideoFrames* video_frames = av_mallocz(sizeof(VisageVideoFrames));
+/** Allocates the slots of the video frames queue. Returns NULL on failure. */
+VisageVideoFrames* visage_alloc_frames(unsigned int capacity) {
+  VisageVideoFrames* video_frames = av_calloc(capacity, sizeof(VisageVideoFrames));
   if (!video_frames) return NULL;
 
-  // initialize properties to null
-  video_frames->frame = NULL;
-  video_frames->next = NULL;
-  video_frames->pts = 0;
+  // preallocate a blank frame for every slot
+  for (unsigned int i = 0; i < capacity; i++) {
+    video_frames[i].frame = av_frame_alloc();
+    video_frames[i].pts = 0;
+    video_frames[i].serial = 0;
+    video_frames[i].captured = AV_NOPTS_VALUE;
+    if (!video_frames[i].frame) {
+      visage_free_frames(&video_frames, capacity);
+      return NULL;
+    }
+  }
 
   return video_frames;
 }
 
-/** Frees the space allocated by a frames node. */
-void visage_free_frames(VisageVideoFrames* frames) {
-  av_frame_free(&frames->frame);
-  av_free(frames);
-}
+/** Frees the slots of the frames queue and the frames they hold. */
+void visage_free_frames(VisageVideoFrames** frames, unsigned int capacity) {
+  if (!*frames) return;
 
-/** Frees all the frames in the queue. */
-void visage_free_all_frames(VisageVideoFrames* frames) {
-  while (frames) {
-    VisageVideoFrames *next = frames->next;
-    av_frame_free(&frames->frame);
-    av_free(frames);
-    frames = next;
+  for (unsigned int i = 0; i < capacity; i++) {
+    av_frame_free(&(*frames)[i].frame);
   }
+  av_free(*frames);
+  *frames = NULL;
+}
+
+/** Borrows the oldest frame in the queue. Returns NULL if queue is empty. */
+VisageVideoFrames* visage_peek_video(VisageVideo* video) {
+  // the tail is only written by this thread, the head is published by the decoder
+  unsigned int tail = atomic_load_explicit(&video->frames_tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&video->frames_head, memory_order_acquire);
+  if (head == tail) return NULL;
+
+  return &video->frames[tail & (video->frames_capacity - 1)];
+}
+
+/** Pops the oldest frame off of the queue, handing its slot back to the decoder. */
+void visage_pop_video(VisageVideo* video) {
+  unsigned int tail = atomic_load_explicit(&video->frames_tail, memory_order_relaxed);
+
+  // release the frame data before the slot can be reused
+  av_frame_unref(video->frames[tail & (video->frames_capacity - 1)].frame);
+  atomic_store_explicit(&video->frames_tail, tail + 1, memory_order_release);
 }
 
-/**
- * Holds the context for playing the video on the screen.
- */
-typedef struct VisageVideo {
-  /** The format context that holds the file. */
-  AVFormatContext* format_ctx;
+/** Returns the oldest frame decoded since the latest seek, discarding older ones. Returns NULL if there is none. */
+static VisageVideoFrames* visage_current_video(VisageVideo* video) {
+  int serial = visage_packet_queue_serial(video->packets);
+  VisageVideoFrames* queued;
+  while ((queued = visage_peek_video(video)) && queued->serial != serial) {
+    visage_pop_video(video);
+  }
+  return queued;
+}
 
-  /** The codec the video is encoded in. */
-  const AVCodec* codec;
+/** Returns how far the clock has to run until the frame is due, in milliseconds of the video. */
+static int64_t visage_frame_wait(int64_t pts, int64_t clock, int reverse) {
+  return reverse ? clock - pts : pts - clock;
+}
 
-  /** The codec parameters for the video. */
-  AVCodecParameters* codecpar;
+/** Returns the frame due ahead milliseconds from now, dropping late ones. Returns NULL if none is due. */
+static VisageVideoFrames* visage_sync_video(VisageVideo* video, int64_t ahead, int64_t* delay) {
+  *delay = 0;
 
-  /** The SWS context for converting the video frame pixels. */
-  struct SwsContext* sws_ctx;
+  // discard frames decoded before the latest seek
+  VisageVideoFrames* queued = visage_current_video(video);
+  if (!queued) return NULL;
 
-  /** The codec context for the video. */
-  AVCodecContext* codec_ctx;
+  // follow the video until audio drives the clock
+  visage_start_clock(video->clock, queued->pts);
 
-  /** The queue of video frames. */
-  VisageVideoFrames* frames;
+  // the clock moves at its speed until then, backwards in reverse
+  double speed = visage_get_clock_speed(video->clock);
+  int reverse = atomic_load(&video->reverse);
+  int64_t clock = visage_get_clock(video->clock) + (int64_t) (ahead * speed);
 
-  /** Mutex for accessing the frames. */
-  pthread_mutex_t frame_mutex;
+  // live sources show the newest frame right away, replacing the ones it came after
+  if (video->low_latency) {
+    while (visage_count_video(video) >= 2) {
+      visage_pop_video(video);
+      atomic_fetch_add(&video->frames_dropped, 1);
+      queued = visage_peek_video(video);
+    }
+    return queued;
+  }
 
-  /** The index of the video stream in the format context. */
-  int stream_idx;
-} VisageVideo;
+  // skip frames that are replaced by a later frame already due
+  while (visage_count_video(video) >= 2) {
+    unsigned int tail = atomic_load_explicit(&video->frames_tail, memory_order_relaxed);
+    VisageVideoFrames* next = &video->frames[(tail + 1) & (video->frames_capacity - 1)];
+    if (visage_frame_wait(next->pts, clock, reverse) > 0) break;
+    visage_pop_video(video);
+    atomic_fetch_add(&video->frames_dropped, 1);
+    queued = next;
+  }
 
-/** Pops a frame off of the queue. Returns NULL if queue is empty. */
-AVFrame* visage_pop_video(VisageVideo* video) {
-  // check if queue is empty
-  pthread_mutex_lock(&video->frame_mutex);
-  if (!video->frames) {
-    pthread_mutex_unlock(&video->frame_mutex);
+  // wait for the frame to be due, for as long as it takes at the speed of the clock
+  int64_t wait = visage_frame_wait(queued->pts, clock, reverse);
+  if (wait > 0) {
+    if (speed != 0) *delay = FFMAX((int64_t) (wait / fabs(speed)), 1);
     return NULL;
   }
 
-  // if not, pop a frame off the queue
-  AVFrame* top_frame = av_frame_clone(video->frames->frame);
+  return queued;
+}
+
+/** Returns the frame due ahead milliseconds from now without popping it, or NULL if none is due. */
+VisageVideoFrames* visage_due_video(VisageVideo* video, int64_t ahead, int64_t* delay) {
+  return visage_sync_video(video, ahead, delay);
+}
+
+/** Requests a seek to the target. */
+void visage_seek_video(VisageVideo* video, int64_t target, int mode) {
+  atomic_store(&video->seek_target, target > 0 ? target : 0);
+  atomic_store(&video->seek_mode, mode);
+  atomic_store(&video->seek_request, 1);
+}
+
+/** Moves the paused clock to the next queued frame. Returns 1 if there is one, 0 otherwise. */
+int visage_next_frame(VisageVideo* video) {
+  VisageVideoFrames* queued = visage_current_video(video);
+  if (!queued) return 0;
+
+  visage_set_clock(video->clock, queued->pts);
+  return 1;
+}
+
+/** Sets the window size adaptive mode scales frames to. */
+void visage_resize_video(VisageVideo* video, int width, int height) {
+  atomic_store(&video->window_width, width);
+  atomic_store(&video->window_height, height);
+}
+
+/** Returns the pending seek target or the playback clock, in milliseconds. */
+int64_t visage_video_position(VisageVideo* video) {
+  if (atomic_load(&video->seek_request)) return atomic_load(&video->seek_target);
+  int64_t clock = visage_get_clock(video->clock);
+  return clock != VISAGE_CLOCK_UNSET ? clock : 0;
+}
+
+/** Returns 1 once the whole video has been presented, 0 otherwise. */
+int visage_video_finished(VisageVideo* video) {
+  if (visage_count_video(video) > 0) return 0;
+  int finished = atomic_load(&video->finished_serial);
+  if (finished == VISAGE_VIDEO_STOPPED) return 1;
+
+  // the request is cleared only after the serial has moved on
+  if (atomic_load(&video->seek_request)) return 0;
+  return finished == visage_packet_queue_serial(video->packets);
+}
+
+/** Returns the number of frames in the queue. */
+unsigned int visage_count_video(VisageVideo* video) {
+  unsigned int head = atomic_load_explicit(&video->frames_head, memory_order_acquire);
+  unsigned int tail = atomic_load_explicit(&video->frames_tail, memory_order_acquire);
+  return head - tail;
+}
+
+/** Waits for a free slot at the head of the queue. Returns NULL if aborted. */
+static VisageVideoFrames* visage_acquire_video(VisageVideo* video) {
+  unsigned int head = atomic_load_explicit(&video->frames_head, memory_order_relaxed);
+
+  // back off while the queue is full, sleeping longer the longer it stays full
+  unsigned int delay = VISAGE_VIDEO_MIN_BACKOFF;
+  while (head - atomic_load_explicit(&video->frames_tail, memory_order_acquire)
+         >= video->frames_capacity) {
+    if (atomic_load(&video->abort)) return NULL;
+    av_usleep(delay);
+    if (delay < VISAGE_VIDEO_MAX_BACKOFF) delay *= 2;
+  }
+
+  return &video->frames[head & (video->frames_capacity - 1)];
+}
+
+/** Wakes up a rendering thread waiting for events. */
+static void visage_wake_video(VisageVideo* video) {
+  if (!video->frame_event) return;
+  SDL_Event event = {.type = video->frame_event};
+  SDL_PushEvent(&event);
+}
+
+/** Publishes the slot returned by visage_acquire_video() to the consumer. */
+static void visage_publish_video(VisageVideo* video) {
+  unsigned int head = atomic_load_explicit(&video->frames_head, memory_order_relaxed);
+  atomic_store_explicit(&video->frames_head, head + 1, memory_order_release);
+
+  // the rendering thread only waits for events while the queue is empty
+  if (head == atomic_load_explicit(&video->frames_tail, memory_order_acquire)) {
+    visage_wake_video(video);
+  }
+}
+
+/** Returns the SDL colorspace matching the color properties of the frame. */
+SDL_Colorspace visage_video_colorspace(const AVFrame* frame) {
+  int full = frame->color_range == AVCOL_RANGE_JPEG;
+  switch (frame->colorspace) {
+  case AVCOL_SPC_BT709:
+    return full ? SDL_COLORSPACE_BT709_FULL : SDL_COLORSPACE_BT709_LIMITED;
+  case AVCOL_SPC_BT2020_NCL:
+  case AVCOL_SPC_BT2020_CL:
+    return full ? SDL_COLORSPACE_BT2020_FULL : SDL_COLORSPACE_BT2020_LIMITED;
+  default:
+    return full ? SDL_COLORSPACE_BT601_FULL : SDL_COLORSPACE_BT601_LIMITED;
+  }
+}
 
-  // free the video frame
-  VisageVideoFrames* next_frames = video->frames->next;
-  visage_free_frames(video->frames);
+/** Returns the SDL texture format with the same layout as the pixel format, or SDL_PIXELFORMAT_UNKNOWN. */
+SDL_PixelFormat visage_texture_format(enum AVPixelFormat format) {
+  switch (format) {
+  case AV_PIX_FMT_YUV420P:
+  case AV_PIX_FMT_YUVJ420P:
+    return SDL_PIXELFORMAT_IYUV;
+  case AV_PIX_FMT_NV12:
+    return SDL_PIXELFORMAT_NV12;
+  case AV_PIX_FMT_NV21:
+    return SDL_PIXELFORMAT_NV21;
+  case AV_PIX_FMT_P010:
+    return SDL_PIXELFORMAT_P010;
+  default:
+    return SDL_PIXELFORMAT_UNKNOWN;
+  }
+}
+
+/** Uploads the frame, recreating the texture if the frame no longer fits. Outputs 0 on success, -1 on error. */
+int visage_upload_video(SDL_Renderer* renderer, SDL_Texture** texture, const AVFrame* frame) {
+  SDL_PixelFormat format = visage_texture_format(frame->format);
+  if (format == SDL_PIXELFORMAT_UNKNOWN) return -1;
 
-  // update the top frame in the video context
-  video->frames = next_frames;
-  pthread_mutex_unlock(&video->frame_mutex);
+  // create a texture matching the frame format and size
+  if (!*texture || (*texture)->format != format || (*texture)->w != frame->width
+      || (*texture)->h != frame->height) {
+    SDL_DestroyTexture(*texture);
+    SDL_PropertiesID props = SDL_CreateProperties();
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_FORMAT_NUMBER, format);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_ACCESS_NUMBER,
+                          SDL_TEXTUREACCESS_STREAMING);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_WIDTH_NUMBER, frame->width);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_HEIGHT_NUMBER, frame->height);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_COLORSPACE_NUMBER,
+                          visage_video_colorspace(frame));
+    *texture = SDL_CreateTextureWithProperties(renderer, props);
+    SDL_DestroyProperties(props);
+    if (!*texture) {
+      printf("Error: %s\n", SDL_GetError());
+      return -1;
+    }
+  }
 
-  return top_frame;
+  // write into the texture memory, where the chroma planes follow the luma plane
+  void* pixels;
+  int pitch;
+  if (!SDL_LockTexture(*texture, NULL, &pixels, &pitch)) {
+    printf("Error: %s\n", SDL_GetError());
+    return -1;
+  }
+  int bytes = format == SDL_PIXELFORMAT_P010 ? 2 : 1;
+  int chroma_width = (frame->width + 1) / 2;
+  int chroma_height = (frame->height + 1) / 2;
+  uint8_t* plane = pixels;
+  av_image_copy_plane(plane, pitch, frame->data[0], frame->linesize[0],
+                      frame->width * bytes, frame->height);
+  plane += (ptrdiff_t) pitch * frame->height;
+  if (format == SDL_PIXELFORMAT_IYUV) {
+    int chroma_pitch = (pitch + 1) / 2;
+    av_image_copy_plane(plane, chroma_pitch, frame->data[1], frame->linesize[1],
+                        chroma_width, chroma_height);
+    plane += (ptrdiff_t) chroma_pitch * chroma_height;
+    av_image_copy_plane(plane, chroma_pitch, frame->data[2], frame->linesize[2],
+                        chroma_width, chroma_height);
+  } else {
+    av_image_copy_plane(plane, 2 * ((pitch + 1) / 2), frame->data[1], frame->linesize[1],
+                        chroma_width * 2 * bytes, chroma_height);
+  }
+  SDL_UnlockTexture(*texture);
+
+  return 0;
+}
+
+/** Returns the refresh interval of the display in microseconds, or 0 without vsync. */
+int64_t visage_refresh_interval(SDL_Renderer* renderer) {
+  int vsync = 0;
+  if (!SDL_GetRenderVSync(renderer, &vsync) || vsync == 0) return 0;
+
+  // assume the most common rate when the display does not report one
+  SDL_DisplayID display = SDL_GetDisplayForWindow(SDL_GetRenderWindow(renderer));
+  const SDL_DisplayMode* mode = SDL_GetCurrentDisplayMode(display);
+  float rate = mode && mode->refresh_rate > 0 ? mode->refresh_rate : VISAGE_VIDEO_REFRESH_RATE;
+  return (int64_t) (1000000 / rate);
+}
+
+/** Turns the frame into a texture, in hardware if possible. Returns NULL on failure. */
+static SDL_Texture* visage_frame_texture(SDL_Renderer* renderer, VisageVideo* video,
+                                         const AVFrame* frame) {
+  if (!frame->hw_frames_ctx) {
+    // upload to the texture drawn longest ago
+    SDL_Texture** texture = &video->textures[video->texture_idx];
+    video->texture_idx = (video->texture_idx + 1) % VISAGE_VIDEO_TEXTURES;
+    return visage_upload_video(renderer, texture, frame) == 0 ? *texture : NULL;
+  }
+
+  // hardware surfaces become textures of their own
+  SDL_Texture* hw_texture = video->gpu ? visage_gpu_texture(video->gpu, frame) : NULL;
+  if (!hw_texture) {
+    printf("Warning: failed to import hardware frame, downloading frames instead\n");
+    atomic_store(&video->zero_copy, 0);
+  }
+  return hw_texture;
+}
+
+/** Uploads the frame due ahead milliseconds from now. Returns 1 if a new frame was taken from the queue, 0 otherwise. */
+int visage_update_video(SDL_Renderer* renderer, VisageVideo* video, int64_t ahead,
+                        int64_t* delay) {
+  VisageVideoFrames* queued = visage_sync_video(video, ahead, delay);
+  if (!queued) return 0;
+
+  // keep up with the clock without uploading anything while hidden
+  if (atomic_load(&video->hidden)) {
+    visage_pop_video(video);
+    return 0;
+  }
+
+  int64_t start = av_gettime_relative();
+  video->shown_texture = visage_frame_texture(renderer, video, queued->frame);
+  visage_record_stage(video->stats, VISAGE_STAGE_UPLOAD, start);
+
+  // compare the frame with the clock at the vblank it shows up on
+  if (video->stats) video->stats->drift = queued->pts - (visage_get_clock(video->clock) + ahead);
+  if (queued->captured != AV_NOPTS_VALUE) {
+    visage_record_latency(video->stats, av_gettime() + ahead * 1000 - queued->captured);
+  }
+  visage_pop_video(video);
+
+  return 1;
+}
+
+/** Presents the frame due at the next vblank. Returns the milliseconds to wait before calling again. */
+int visage_display_frame(SDL_Renderer* renderer, VisageVideo* video) {
+  if (video->refresh_interval < 0) video->refresh_interval = visage_refresh_interval(renderer);
+
+  // the presented frame shows up at the next vblank, half an interval from now on average
+  int64_t delay;
+  if (visage_update_video(renderer, video, video->refresh_interval / 2000, &delay)) {
+    // a new frame to present
+  } else if ((!video->refresh_interval && !video->redraw) || !video->shown_texture) {
+    // without vsync there is nothing to present until the next frame is due
+    if (delay > 0) return (int) delay;
+    return video->frame_event ? VISAGE_VIDEO_IDLE_MS : 1;
+  } else if (video->stats && !video->redraw) {
+    video->stats->frames_repeated++;
+  }
+  video->redraw = 0;
+  if (!video->shown_texture) return 0;
+
+  // present once per vblank, repeating the shown frame until the next one is due
+  int64_t start = av_gettime_relative();
+  SDL_RenderClear(renderer);
+  SDL_RenderTexture(renderer, video->shown_texture, NULL, NULL);
+  visage_draw_stats(video->stats, renderer);
+  SDL_RenderPresent(renderer);
+  visage_record_stage(video->stats, VISAGE_STAGE_PRESENT, start);
+
+  return 0;
+}
+
+/** Returns the presentation time of the frame in milliseconds. */
+static int64_t visage_frame_pts(VisageVideo* video, const AVFrame* frame) {
+  int64_t pts = frame->best_effort_timestamp;
+  if (pts == AV_NOPTS_VALUE) return 0;
+  return pts * av_q2d(video->format_ctx->streams[video->stream_idx]->time_base) * 1000;
+}
+
+/** Returns the wall clock time the frame was captured at in microseconds, or AV_NOPTS_VALUE if the source does not report it. */
+static int64_t visage_capture_time(VisageVideo* video, const AVFrame* frame) {
+  int64_t realtime_start = atomic_load(&video->realtime_start);
+  if (realtime_start == AV_NOPTS_VALUE || frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+    return AV_NOPTS_VALUE;
+  }
+  AVStream* stream = video->format_ctx->streams[video->stream_idx];
+  int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+  return realtime_start + av_rescale_q(frame->best_effort_timestamp - start, stream->time_base,
+                                       AV_TIME_BASE_Q);
+}
+
+/** Picks the size frames are uploaded at, smaller than the frame in adaptive mode. */
+static void visage_output_size(VisageVideo* video, const AVFrame* frame, int* width, int* height) {
+  *width = frame->width;
+  *height = frame->height;
+
+  // fit into the requested size exactly, keeping the aspect ratio
+  if (video->fit_width > 0 || video->fit_height > 0) {
+    double scale = 1.0;
+    if (video->fit_width > 0) scale = FFMIN(scale, (double) video->fit_width / frame->width);
+    if (video->fit_height > 0) scale = FFMIN(scale, (double) video->fit_height / frame->height);
+    if (scale < 1.0) {
+      *width = FFMAX((int) (frame->width * scale) & ~1, 2);
+      *height = FFMAX((int) (frame->height * scale) & ~1, 2);
+    }
+    return;
+  }
+
+  int window_width = atomic_load(&video->window_width);
+  int window_height = atomic_load(&video->window_height);
+  if (!video->adaptive || window_width <= 0 || window_height <= 0) return;
+
+  // take the step that covers the window in both directions
+  int steps = VISAGE_VIDEO_SCALE_STEPS;
+  int step_w = (int) (((int64_t) window_width * steps + frame->width - 1) / frame->width);
+  int step_h = (int) (((int64_t) window_height * steps + frame->height - 1) / frame->height);
+  int step = FFMAX(step_w, step_h);
+  if (step >= steps) return;
+
+  // keep the chroma planes of 4:2:0 whole
+  *width = FFMAX((frame->width * step / steps) & ~1, 2);
+  *height = FFMAX((frame->height * step / steps) & ~1, 2);
+}
+
+/** Turns the decoded frame into one SDL can upload, by reference or converted into a pooled buffer, releasing the decoded frame. Outputs 0 on success, -1 on error. */
+static int visage_output_video(VisageVideo* video, AVFrame* frame, AVFrame* sw_frame,
+                               AVFrame* output) {
+  // download hardware surfaces into system memory
+  int64_t start = av_gettime_relative();
+  AVFrame* source = frame;
+  if (visage_is_hw_frame(video, frame)) {
+    if (visage_download_video(video, frame, sw_frame) < 0) {
+      av_frame_unref(frame);
+      return -1;
+    }
+    source = sw_frame;
+  }
+
+  // take frames SDL can display as they are, without converting them
+  int width, height;
+  visage_output_size(video, source, &width, &height);
+  int scaled = width != source->width || height != source->height;
+  if (!scaled && visage_texture_format(source->format) != SDL_PIXELFORMAT_UNKNOWN) {
+    int ret = av_frame_ref(output, source);
+    output->pts = frame->pts;
+    av_frame_unref(sw_frame);
+    av_frame_unref(frame);
+    return ret < 0 ? -1 : 0;
+  }
+
+  // size the conversion pool for a full queue and the frame being converted
+  VisageFramePool* pool = video->frame_pool;
+  if (pool->width != width || pool->height != height) {
+    if (visage_init_frame_pool(pool, AV_PIX_FMT_YUV420P, width, height,
+                               video->frames_capacity + 1) < 0) {
+      av_frame_unref(sw_frame);
+      av_frame_unref(frame);
+      return -1;
+    }
+  }
+
+  // pick a conversion context for the actual format of the frame, unless the kernels handle it,
+  // averaging over whole areas when fitting into small sizes such as thumbnails
+  int kernels = !scaled && visage_can_convert(source->format);
+  if (!kernels) {
+    int flags = video->fit_width > 0 || video->fit_height > 0 ? SWS_AREA : SWS_BILINEAR;
+    video->sws_ctx = sws_getCachedContext(video->sws_ctx, source->width, source->height,
+                                          source->format, video->frame_pool->width,
+                                          video->frame_pool->height, video->frame_pool->format,
+                                          flags, NULL, NULL, NULL);
+    if (!video->sws_ctx) {
+      printf("Error: failed to create SWS conversion context\n");
+      av_frame_unref(sw_frame);
+      av_frame_unref(frame);
+      return -1;
+    }
+  }
+
+  // give the output its own picture buffer from the pool
+  if (visage_get_pool_frame(video->frame_pool, output) < 0) {
+    printf("Error: failed to allocate memory for scaled frames\n");
+    av_frame_unref(sw_frame);
+    av_frame_unref(frame);
+    return -1;
+  }
+
+  // convert the frame into YUV420P at the upload size directly into the output
+  if (kernels) {
+    visage_convert_frame(source, output->data, output->linesize);
+  } else {
+    sws_scale(video->sws_ctx, (const uint8_t *const *) source->data, source->linesize,
+              0, source->height, output->data, output->linesize);
+  }
+  visage_record_stage(video->stats, VISAGE_STAGE_CONVERT, start);
+
+  // keep the color properties for the texture, and set PTS for video
+  av_frame_copy_props(output, source);
+  output->pts = frame->pts;
+  av_frame_unref(sw_frame);
+  av_frame_unref(frame);
+
+  return 0;
+}
+
+/** Drops the frames kept of the GOP being played backwards. */
+static void visage_clear_gop(VisageVideo* video) {
+  for (unsigned int i = 0; i < video->gop_count; i++) {
+    av_frame_unref(video->gop[i].frame);
+  }
+  video->gop_count = 0;
+}
+
+/** Keeps a decoded frame of the GOP played backwards in presentation order, releasing the decoded frame. Outputs 0 on success, -1 on error. */
+static int visage_cache_video(VisageVideo* video, AVFrame* frame, AVFrame* sw_frame,
+                              int64_t pts) {
+  // frames from the target on are not played, or were queued with the GOP after
+  if (pts >= video->gop_end) {
+    av_frame_unref(frame);
+    return 0;
+  }
+
+  // make room in a full cache by dropping the earliest frame, which would be played last
+  if (video->gop_count == video->gop_capacity) {
+    atomic_fetch_add(&video->frames_dropped, 1);
+    if (pts < video->gop[0].pts) {
+      av_frame_unref(frame);
+      return 0;
+    }
+    AVFrame* spare = video->gop[0].frame;
+    av_frame_unref(spare);
+    memmove(&video->gop[0], &video->gop[1], (video->gop_count - 1) * sizeof(VisageVideoFrames));
+    video->gop[video->gop_count - 1].frame = spare;
+    video->gop_count--;
+  }
+
+  // convert into the spare slot at the end
+  AVFrame* output = video->gop[video->gop_count].frame;
+  if (visage_output_video(video, frame, sw_frame, output) < 0) return -1;
+
+  // move it into presentation order, which decoders usually output frames in already
+  unsigned int idx = video->gop_count;
+  while (idx > 0 && video->gop[idx - 1].pts > pts) {
+    video->gop[idx] = video->gop[idx - 1];
+    idx--;
+  }
+  video->gop[idx].frame = output;
+  video->gop[idx].pts = pts;
+  video->gop[idx].serial = video->serial;
+  video->gop[idx].captured = AV_NOPTS_VALUE;
+  video->gop_count++;
+
+  return 0;
+}
+
+/** Queues the frames kept of the GOP played backwards, latest first. Returns 0 on success, -1 on error. */
+static int visage_queue_gop(VisageVideo* video) {
+  for (unsigned int i = video->gop_count; i-- > 0;) {
+    VisageVideoFrames* cached = &video->gop[i];
+
+    // the rest of the GOP is stale once the next seek has been carried out
+    if (visage_packet_queue_serial(video->packets) != video->serial) break;
+
+    // drop frames the clock has run past already
+    int64_t clock = visage_get_clock(video->clock);
+    if (clock != VISAGE_CLOCK_UNSET && cached->pts > clock + VISAGE_VIDEO_LATE_MS) {
+      av_frame_unref(cached->frame);
+      atomic_fetch_add(&video->frames_dropped, 1);
+      continue;
+    }
+
+    // hand the frame over as soon as a slot is free, so stepping back costs no decoding
+    VisageVideoFrames* new_frame = visage_acquire_video(video);
+    if (!new_frame) return -1;
+    av_frame_move_ref(new_frame->frame, cached->frame);
+    new_frame->pts = cached->pts;
+    new_frame->serial = video->serial;
+    new_frame->captured = AV_NOPTS_VALUE;
+    visage_publish_video(video);
+  }
+
+  // the GOP before ends where this one starts
+  if (video->gop_count > 0) video->gop_end = video->gop[0].pts;
+  visage_clear_gop(video);
+
+  return 0;
+}
+
+/** Queues the cached frames following on from a seek, up to the timestamp, waiting for room only if asked to. Returns 0 on success, -1 on error. */
+static int visage_serve_cache(VisageVideo* video, int64_t until, int wait) {
+  while (video->cache_next != INT64_MIN && video->cache_next <= until) {
+    if (!wait && visage_count_video(video) >= video->frames_capacity) break;
+
+    // the rest of the run is stale once the next seek has been carried out
+    if (visage_packet_queue_serial(video->packets) != video->serial) break;
+
+    // stop where the run ends, or where a frame of it has been dropped in the meantime
+    VisageCachedFrame* cached = visage_find_cached_frame(video->cache, video->cache_next);
+    if (!cached || cached->pts != video->cache_next) {
+      video->cache_next = INT64_MIN;
+      break;
+    }
+
+    // queue another reference to the frame, which is converted already
+    VisageVideoFrames* new_frame = visage_acquire_video(video);
+    if (!new_frame || av_frame_ref(new_frame->frame, cached->frame) < 0) return -1;
+    new_frame->pts = cached->pts;
+    new_frame->serial = video->serial;
+    new_frame->captured = AV_NOPTS_VALUE;
+    visage_publish_video(video);
+    video->cache_pts = cached->pts;
+
+    VisageCachedFrame* next = visage_next_cached_frame(video->cache, cached->pts);
+    video->cache_next = next ? next->pts : INT64_MIN;
+  }
+
+  return 0;
+}
+
+/** Keeps the queued frame in the frame cache, if there is one. */
+static void visage_keep_video(VisageVideo* video, const AVFrame* frame, int64_t pts) {
+  if (!video->cache) return;
+  int64_t duration = frame->duration
+    * av_q2d(video->format_ctx->streams[video->stream_idx]->time_base) * 1000;
+  if (visage_put_cached_frame(video->cache, frame, pts, duration) < 0) {
+    visage_break_frame_cache(video->cache);
+  }
+}
+
+/** Receives all pending frames from the decoder into the queue. Returns 0 on success, -1 on error. */
+static int visage_receive_video(VisageVideo* video, AVFrame* frame, AVFrame* sw_frame) {
+  // receive frame from the decoder
+  while (1) {
+    int64_t start = av_gettime_relative();
+    int ret = avcodec_receive_frame(video->codec_ctx, frame);
+    if (ret < 0) break;
+    visage_record_stage(video->stats, VISAGE_STAGE_DECODE, start);
+
+    // skip frames before the target of an accurate seek
+    int64_t pts = visage_frame_pts(video, frame);
+    if (pts < atomic_load(&video->seek_pts)) {
+      av_frame_unref(frame);
+      continue;
+    }
+
+    // keep the frames of a GOP played backwards until all of them are decoded
+    if (video->reversing) {
+      if (visage_cache_video(video, frame, sw_frame, pts) < 0) return -1;
+      continue;
+    }
+
+    // the cache presents what it has of the frames up to this one
+    if (visage_serve_cache(video, pts, 1) < 0) {
+      av_frame_unref(frame);
+      return -1;
+    }
+    if (pts <= video->cache_pts) {
+      av_frame_unref(frame);
+      continue;
+    }
+
+    // drop frames that are late already before spending time on them, unless showing the newest one anyway
+    int64_t clock = visage_get_clock(video->clock);
+    if (!video->low_latency && clock != VISAGE_CLOCK_UNSET
+        && pts < clock - VISAGE_VIDEO_LATE_MS) {
+      av_frame_unref(frame);
+      atomic_fetch_add(&video->frames_dropped, 1);
+      if (video->cache) visage_break_frame_cache(video->cache);
+      continue;
+    }
+
+    // queue hardware surfaces as they are when the renderer can present them
+    if (atomic_load(&video->zero_copy) && visage_is_hw_frame(video, frame)) {
+      if (video->cache) visage_break_frame_cache(video->cache);
+      VisageVideoFrames* new_frame = visage_acquire_video(video);
+      if (!new_frame) {
+        av_frame_unref(frame);
+        return -1;
+      }
+      new_frame->pts = pts;
+      new_frame->serial = video->serial;
+      new_frame->captured = visage_capture_time(video, frame);
+      av_frame_move_ref(new_frame->frame, frame);
+      visage_publish_video(video);
+      continue;
+    }
+
+    // wait for a free slot in the queue and fill it with the frame as SDL uploads it
+    VisageVideoFrames* new_frame = visage_acquire_video(video);
+    if (!new_frame) {
+      av_frame_unref(frame);
+      return -1;
+    }
+    new_frame->captured = visage_capture_time(video, frame);
+    if (visage_output_video(video, frame, sw_frame, new_frame->frame) < 0) return -1;
+    new_frame->pts = pts;
+    new_frame->serial = video->serial;
+    visage_keep_video(video, new_frame->frame, pts);
+
+    // add to the queue
+    visage_publish_video(video);
+  }
+
+  return 0;
+}
+
+/** Marks the decoder as stopped for good, waking up the rendering thread. */
+static void visage_stop_video(VisageVideo* video) {
+  atomic_store(&video->finished_serial, VISAGE_VIDEO_STOPPED);
+  visage_wake_video(video);
+}
+
+/** Returns the presentation time of the packet in milliseconds, or INT64_MIN without timestamps. */
+static int64_t visage_packet_pts(VisageVideo* video, const AVPacket* packet) {
+  int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+  if (ts == AV_NOPTS_VALUE) return INT64_MIN;
+  return ts * av_q2d(video->format_ctx->streams[video->stream_idx]->time_base) * 1000;
+}
+
+/** Lets the decoder skip work nobody gets to see, while hidden and the more the faster the video plays. */
+static void visage_discard_video(VisageVideo* video) {
+  double speed = visage_get_clock_speed(video->clock);
+  struct AVCodecContext* codec_ctx = video->codec_ctx;
+
+  // frames no other frame refers to can go without a trace
+  codec_ctx->skip_frame = AVDISCARD_DEFAULT;
+  if (atomic_load(&video->hidden) || speed >= VISAGE_SPEED_SKIP_FRAMES) {
+    codec_ctx->skip_frame = AVDISCARD_NONREF;
+  }
+  if (video->keyframes_only) codec_ctx->skip_frame = AVDISCARD_NONKEY;
+
+  // skipping the loop filter of reference frames leaves artifacts until the next keyframe
+  codec_ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+  if (speed >= VISAGE_SPEED_SKIP_FRAMES) {
+    codec_ctx->skip_loop_filter = AVDISCARD_NONKEY;
+  } else if (speed >= VISAGE_SPEED_SKIP_FILTER) {
+    codec_ctx->skip_loop_filter = AVDISCARD_NONREF;
+  }
+}
+
+/** Drains the frames still buffered in the decoder, queueing them latest first when playing backwards. Returns 0 on success, -1 on error. */
+static int visage_drain_video(VisageVideo* video, AVFrame* frame, AVFrame* sw_frame) {
+  avcodec_send_packet(video->codec_ctx, NULL);
+  if (visage_receive_video(video, frame, sw_frame) < 0) return -1;
+  avcodec_flush_buffers(video->codec_ctx);
+
+  return video->reversing ? visage_queue_gop(video) : 0;
+}
+
+/** Decodes a packet taken from the queue, draining the decoder at the end of the stream. Returns 0 on success, -1 on error. */
+static int visage_decode_packet(VisageVideo* video, AVPacket* packet, int ret, int serial,
+                                AVFrame* frame, AVFrame* sw_frame) {
+  // start over from the new position after a seek, in the direction it plays
+  if (serial != video->serial) {
+    avcodec_flush_buffers(video->codec_ctx);
+    visage_clear_gop(video);
+    video->serial = serial;
+    video->reversing = atomic_load(&video->reverse);
+    video->gop_start = INT64_MAX;
+    video->gop_end = video->reversing ? atomic_load(&video->resume_pts) : INT64_MAX;
+
+    // a seek into frames queued lately presents them from the cache, ahead of the decoder
+    video->cache_next = INT64_MIN;
+    video->cache_pts = INT64_MIN;
+    if (video->cache && !video->reversing) {
+      visage_break_frame_cache(video->cache);
+      VisageCachedFrame* cached = visage_find_cached_frame(video->cache,
+                                                           atomic_load(&video->resume_pts));
+      if (cached) {
+        video->cache_next = cached->pts;
+        video->cache_pts = cached->pts - 1;
+      }
+    }
+  }
+
+  // queue cached frames as far as there is room before decoding anything, and all of them at the end
+  if (visage_serve_cache(video, INT64_MAX, ret == 0) < 0) {
+    av_packet_unref(packet);
+    return -1;
+  }
+
+  // drain the frames still buffered in the decoder at the end of the stream
+  if (ret == 0) {
+    if (visage_drain_video(video, frame, sw_frame) < 0) return -1;
+    atomic_store(&video->finished_serial, serial);
+    visage_wake_video(video);
+    return 0;
+  }
+
+  // a keyframe before the GOP played backwards starts the next one, after this one is queued
+  if (video->reversing && (packet->flags & AV_PKT_FLAG_KEY)) {
+    int64_t pts = visage_packet_pts(video, packet);
+    if (pts < video->gop_start) {
+      if (video->gop_start != INT64_MAX && visage_drain_video(video, frame, sw_frame) < 0) {
+        av_packet_unref(packet);
+        return -1;
+      }
+      video->gop_start = pts;
+    }
+  }
+
+  // send packet to the decoder
+  visage_discard_video(video);
+  int64_t start = av_gettime_relative();
+  int send_ret = avcodec_send_packet(video->codec_ctx, packet);
+  visage_record_stage(video->stats, VISAGE_STAGE_DECODE, start);
+  av_packet_unref(packet);
+  if (send_ret < 0) {
+    printf("Error: %s\n", av_err2str(send_ret));
+    return -1;
+  }
+
+  return visage_receive_video(video, frame, sw_frame);
 }
 
 /** Processes the video frames into the queue. */
 int visage_process_video(VisageVideo* video) {
   // check if context is initialized
-  if (!video) {
+  if (!video || !video->clock) {
     printf("Error: visage video context is not initialized\n");
     return -1;
   }
+  int status = -1;
+  int ret;
+  AVFrame* frame = NULL;
+  AVFrame* sw_frame = NULL;
   
   // allocate memory for packets
   AVPacket* packet = av_packet_alloc();
   if (!packet) {
     printf("Error: failed to allocate memory for packets\n");
-    return -1;
+    goto cleanup;
   }
 
   // allocate memory for frames
-  AVFrame* frame = av_frame_alloc();
-  if (!frame) {
+  frame = av_frame_alloc();
+  sw_frame = av_frame_alloc();
+  if (!frame || !sw_frame) {
     printf("Error: failed to allocate memory for frames\n");
-    return -1;
-  }
-  
-  // allocate memory for scaled frame
-  AVFrame* scaled_frame = av_frame_alloc();
-  if (!scaled_frame) {
-    printf("Error: failed to allocate memory for scaled frames\n");
-    return -1;
-  }
-  
-  // set scaled frame parameters for YUV format
-  scaled_frame->format = AV_PIX_FMT_YUV420P;
-  scaled_frame->width = video->codecpar->width;
-  scaled_frame->height = video->codecpar->height;
-
-  // allocate new buffer for scaled frames
-  int ret = av_frame_get_buffer(scaled_frame, 0);
-  if (ret < 0) {
-    printf("Error: %s\n", av_err2str(ret));
-    return -1;
+    goto cleanup;
   }
 
-  // read frames from the stream
-  while (av_read_frame(video->format_ctx, packet) >= 0) {
-    // ensure it is an audio or video fram
-    if (packet->stream_index != video->stream_idx) continue;
-
-    // send packet to the decoder
-    int send_ret = avcodec_send_packet(video->codec_ctx, packet);
-    av_packet_unref(packet);
-    if (send_ret < 0) {
-      printf("Error: %s\n", av_err2str(send_ret));
-      goto cleanup;
-    }
-    
-    // receive frame from the decoder
-    while (avcodec_receive_frame(video->codec_ctx, frame) >= 0) {
-      // convert the frame into the YUV format
-      sws_scale(video->sws_ctx, (const uint8_t *const *) frame->data, frame->linesize,
-                0, frame->height, scaled_frame->data, scaled_frame->linesize);
-
-      // create new frame in the queue
-      VisageVideoFrames* new_frame = visage_alloc_frames();
-
-      // copy the video frame into the queue
-      new_frame->frame = av_frame_clone(scaled_frame);
-
-      // set PTS for video
-      new_frame->pts = (frame->pts)
-        * av_q2d(video->format_ctx->streams[video->stream_idx]->time_base) * 1000;
-
-      // add to the queue
-      pthread_mutex_lock(&video->frame_mutex);
-      if (!video->frames) {
-        video->frames = new_frame;
-      } else {
-        VisageVideoFrames *cur = video->frames;
-        while (cur->next) cur = cur->next;
-        cur->next = new_frame;
-      }
-      pthread_mutex_unlock(&video->frame_mutex);
-    }
+  // take packets from the demuxer until the queue is aborted
+  int serial;
+  while ((ret = visage_get_packet(video->packets, packet, &serial)) >= 0) {
+    if (visage_decode_packet(video, packet, ret, serial, frame, sw_frame) < 0) goto cleanup;
   }
+  status = 0;
     
   // cleanup everything
  cleanup:
-  av_frame_free(&scaled_frame);
+  av_frame_free(&sw_frame);
   av_frame_free(&frame);
   av_packet_free(&packet);
+  visage_stop_video(video);
   
-  return 0;
- }
+  return status;
+}
+
+/** Decodes the next queued packet, if there is one and room for its frame. Returns 1 if it did, 0 if there was nothing to do, -1 once decoding has stopped. */
+int visage_step_video(VisageVideo* video) {
+  if (atomic_load(&video->abort)) {
+    visage_stop_video(video);
+    return -1;
+  }
+
+  // allocate the packet and frames kept from one step to the next
+  if (!video->task_packet) {
+    video->task_packet = av_packet_alloc();
+    video->task_frame = av_frame_alloc();
+    video->task_sw_frame = av_frame_alloc();
+    if (!video->task_packet || !video->task_frame || !video->task_sw_frame) {
+      printf("Error: failed to allocate memory for frames\n");
+      visage_stop_video(video);
+      return -1;
+    }
+  }
+
+  // leave the worker to other streams while the frame queue is full
+  if (visage_count_video(video) >= video->frames_capacity) return 0;
+
+  int serial;
+  int ret = visage_poll_packet(video->packets, video->task_packet, &serial);
+  if (ret == VISAGE_PACKET_EMPTY) return 0;
+  if (ret < 0 || visage_decode_packet(video, video->task_packet, ret, serial, video->task_frame,
+                                      video->task_sw_frame) < 0) {
+    visage_stop_video(video);
+    return -1;
+  }
+
+  return 1;
+}
+
+/** Aborts the video processing. */
+void visage_abort_video(VisageVideo* video) {
+  atomic_store(&video->abort, 1);
+  visage_abort_packet_queue(video->packets);
+}
 
 /** Frees the video context. */
 void visage_free_video(VisageVideo** video) {
     if (!*video) return;
     
     avcodec_free_context(&(*video)->codec_ctx);
+    visage_uninit_hwaccel(*video);
     sws_freeContext((*video)->sws_ctx);
-    visage_free_all_frames((*video)->frames);
-    pthread_mutex_destroy(&(*video)->frame_mutex);
+    for (int i = 0; i < VISAGE_VIDEO_TEXTURES; i++) SDL_DestroyTexture((*video)->textures[i]);
+    visage_free_frame_pool(&(*video)->frame_pool);
+    visage_free_frame_pool(&(*video)->hw_frame_pool);
+    visage_free_frames(&(*video)->frames, (*video)->frames_capacity);
+    visage_free_frames(&(*video)->gop, (*video)->gop_capacity);
+    visage_free_frame_cache(&(*video)->cache);
+    visage_free_packet_queue(&(*video)->packets);
+    av_packet_free(&(*video)->task_packet);
+    av_frame_free(&(*video)->task_frame);
+    av_frame_free(&(*video)->task_sw_frame);
     av_free(*video);
     *video = NULL;
 } 
@@ -215,13 +959,112 @@ VisageVideo* visage_alloc_video() {
     video->codec = NULL;
     video->codecpar = NULL;
     video->sws_ctx = NULL;
+    video->frame_pool = NULL;
     video->codec_ctx = NULL;
+    video->hwaccel = NULL;
+    video->adaptive = 0;
+    video->fit_width = 0;
+    video->fit_height = 0;
+    video->keyframes_only = 0;
+    atomic_init(&video->window_width, 0);
+    atomic_init(&video->window_height, 0);
+    video->thread_count = VISAGE_THREADS_AUTO;
+    video->thread_type = VISAGE_THREADS_AUTO;
+    video->low_latency = 0;
+    video->hw_device_ctx = NULL;
+    video->hw_pix_fmt = AV_PIX_FMT_NONE;
+    video->hw_frame_pool = NULL;
     video->frames = NULL;
-    pthread_mutex_init(&video->frame_mutex, NULL);
+    video->frames_capacity = VISAGE_VIDEO_FRAMES;
+    atomic_init(&video->frames_head, 0);
+    atomic_init(&video->frames_tail, 0);
+    video->packets = NULL;
+    video->clock = NULL;
+    video->gpu = NULL;
+    video->stats = NULL;
+    atomic_init(&video->realtime_start, AV_NOPTS_VALUE);
+    video->refresh_interval = -1;
+    for (int i = 0; i < VISAGE_VIDEO_TEXTURES; i++) video->textures[i] = NULL;
+    video->texture_idx = 0;
+    video->shown_texture = NULL;
+    video->redraw = 0;
+    video->frame_event = 0;
+    atomic_init(&video->frames_dropped, 0);
+    atomic_init(&video->finished_serial, -1);
+    video->serial = 0;
+    atomic_init(&video->seek_request, 0);
+    atomic_init(&video->seek_target, 0);
+    atomic_init(&video->seek_mode, VISAGE_SEEK_FAST);
+    atomic_init(&video->seek_pts, INT64_MIN);
+    atomic_init(&video->reverse, 0);
+    atomic_init(&video->resume_pts, 0);
+    video->gop = NULL;
+    video->gop_count = 0;
+    video->gop_capacity = VISAGE_VIDEO_GOP_FRAMES;
+    video->gop_start = INT64_MAX;
+    video->gop_end = INT64_MAX;
+    video->reversing = 0;
+    video->cache = NULL;
+    video->cache_size = VISAGE_FRAME_CACHE_SIZE;
+    video->cache_next = INT64_MIN;
+    video->cache_pts = INT64_MIN;
+    atomic_init(&video->abort, 0);
+    atomic_init(&video->zero_copy, 0);
+    atomic_init(&video->hidden, 0);
+    video->task_packet = NULL;
+    video->task_frame = NULL;
+    video->task_sw_frame = NULL;
     
     return video;
 }
 
+/** Allocates and opens the video codec context, optionally with hardware acceleration. */
+static int visage_open_codec(VisageVideo* video, int hwaccel) {
+  // allocate memory for the video codec context
+  avcodec_free_context(&video->codec_ctx);
+  video->codec_ctx = avcodec_alloc_context3(video->codec);
+  if (!video->codec_ctx) {
+    printf("Error: failed to allocate memory for video codec context\n");
+    return -1;
+  }
+
+  // copy codec parameters to the video context
+  if (avcodec_parameters_to_context(video->codec_ctx, video->codecpar) < 0) {
+    printf("Error: failed to copy codec parameters to the video context\n");
+    return -1;
+  }
+
+  // decode on several threads, without the delay of a frame per thread when latency matters
+  int thread_type = video->low_latency ? FF_THREAD_SLICE : video->thread_type;
+  visage_init_threads(video->codec_ctx, video->thread_count, thread_type);
+  if (video->low_latency) video->codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+  // attach a hardware device to the decoder
+  if (hwaccel && visage_init_hwaccel(video) < 0) return -1;
+
+  // queued surfaces stay with the decoder, so it needs enough of them for a full queue
+  if (hwaccel && video->hw_device_ctx && atomic_load(&video->zero_copy)) {
+    video->codec_ctx->extra_hw_frames = video->frames_capacity + 2;
+  }
+
+  // initialize the video codec context to use the given decoder
+  return avcodec_open2(video->codec_ctx, video->codec, NULL) < 0 ? -2 : 0;
+}
+
+/** Opens the video decoder, falling back to software. Outputs 0 on success, -1 on error. */
+static int visage_open_video(VisageVideo* video) {
+  int ret = visage_open_codec(video, 1);
+  if (ret == -2 && video->hw_device_ctx) {
+    printf("Warning: failed to open hardware decoder, using software\n");
+    visage_uninit_hwaccel(video);
+    atomic_store(&video->zero_copy, 0);
+    ret = visage_open_codec(video, 0);
+  }
+  if (ret == -2) printf("Error: failed to initialize video codec context\n");
+
+  return ret < 0 ? -1 : 0;
+}
+
 /** Initializes the video context for Visage. Outputs 0 on success, -1 on error. */
 int visage_init_video(AVFormatContext* format_ctx, VisageVideo* video) {
   // set the format context
@@ -259,37 +1102,80 @@ int visage_init_video(AVFormatContext* format_ctx, VisageVideo* video) {
   video->codecpar = video_codecpar;
   video->stream_idx = video_idx;
 
-  // initialize SWS conversion context
-  video->sws_ctx = sws_getContext(video_codecpar->width, video_codecpar->height,
-                                              video_codecpar->format, video_codecpar->width,
-                                              video_codecpar->height, AV_PIX_FMT_YUV420P,
-                                              SWS_BILINEAR, NULL, NULL, NULL);
-  if (!video->sws_ctx) {
-    printf("Error: failed to create SWS conversion context\n");
+  // round the queue capacity up to a power of two so indices can wrap freely
+  if (video->low_latency) {
+    video->frames_capacity = FFMIN(video->frames_capacity, VISAGE_VIDEO_LIVE_FRAMES);
+  }
+  unsigned int capacity = 1;
+  while (capacity < video->frames_capacity) capacity *= 2;
+  video->frames_capacity = capacity;
+
+  // open the decoder, in hardware if possible
+  if (visage_open_video(video) < 0) return -1;
+  if (video->hw_device_ctx) {
+    AVHWDeviceContext* device_ctx = (AVHWDeviceContext*) video->hw_device_ctx->data;
+    printf("Video decoder: %s (%s%s)\n", video_codec->name,
+           av_hwdevice_get_type_name(device_ctx->type),
+           atomic_load(&video->zero_copy) ? ", zero-copy" : "");
+  } else {
+    printf("Video decoder: %s (software)\n", video_codec->name);
+  }
+  printf("Video threads: %d (%s)\n", video->codec_ctx->thread_count,
+         visage_thread_type_name(video->codec_ctx));
+
+  // allocate the pool hardware surfaces are downloaded into
+  video->hw_frame_pool = visage_alloc_frame_pool();
+  if (!video->hw_frame_pool) {
+    printf("Error: failed to allocate memory for the frame pool\n");
     return -1;
   }
 
-  // allocate memory for the video codec context
-  video->codec_ctx = avcodec_alloc_context3(video_codec);
-  if (!video->codec_ctx) {
-    printf("Error: failed to allocate memory for video codec context\n");
+  // allocate the queue of packets fed by the demuxer
+  video->packets = visage_alloc_packet_queue();
+  if (!video->packets) {
+    printf("Error: failed to allocate memory for the video packet queue\n");
     return -1;
   }
+  video->packets->time_base = format_ctx->streams[video_idx]->time_base;
 
-  // copy codec parameters to the video context
-  if (avcodec_parameters_to_context(video->codec_ctx, video_codecpar) < 0) {
-    printf("Error: failed to copy codec parameters to the video context\n");
+  // allocate the slots of the frame queue
+  video->frames = visage_alloc_frames(video->frames_capacity);
+  if (!video->frames) {
+    printf("Error: failed to allocate memory for the video frame queue\n");
     return -1;
   }
 
-  // initialize the video codec context to use the given decoder
-  if (avcodec_open2(video->codec_ctx, video_codec, NULL) < 0) {
-    printf("Error: failed to initialize video codec context\n");
+  // allocate the slots of the GOP cache for playing backwards
+  video->gop_capacity = FFMAX(video->gop_capacity, 1);
+  video->gop = visage_alloc_frames(video->gop_capacity);
+  if (!video->gop) {
+    printf("Error: failed to allocate memory for the video GOP cache\n");
+    return -1;
+  }
+
+  // allocate the cache of frames to seek back into, which live sources have no use for
+  if (video->cache_size > 0 && !video->low_latency) {
+    video->cache = visage_alloc_frame_cache();
+    if (!video->cache) {
+      printf("Error: failed to allocate memory for the frame cache\n");
+      return -1;
+    }
+    video->cache->max_size = video->cache_size;
+  }
+
+  // allocate the pool converted frames are stored in, sized by the first frame needing it
+  video->frame_pool = visage_alloc_frame_pool();
+  if (!video->frame_pool) {
+    printf("Error: failed to allocate memory for the frame pool\n");
     return -1;
   }
 
-  // initialize frames to null
-  video->frames = NULL;
+  // only frames SDL cannot display as they are get converted
+  if (visage_texture_format(video_codecpar->format) == SDL_PIXELFORMAT_UNKNOWN
+      && !video->hw_device_ctx) {
+    printf("Video format: %s (converted to yuv420p)\n",
+           av_get_pix_fmt_name(video_codecpar->format));
+  }
 
   return 0;
 }
@@ -0,0 +1,272 @@
+#include <SDL3/SDL_rect.h>
+#include <SDL3/SDL_render.h>
+#include <libavformat/avformat.h>
+#include <libavutil/macros.h>
+#include <libavutil/mem.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "visage_clock.h"
+#include "visage_demux.h"
+#include "visage_gpu.h"
+#include "visage_threads.h"
+#include "visage_video.h"
+#include "visage_wall.h"
+#include "visage_workers.h"
+
+/** Allocates the wall. Returns NULL on failure. */
+VisageWall* visage_alloc_wall() {
+  VisageWall* wall = av_mallocz(sizeof(VisageWall));
+  if (!wall) return NULL;
+
+  // initialize properties to empty
+  wall->tiles = NULL;
+  wall->nb_tiles = 0;
+  wall->workers = NULL;
+  wall->hwaccel = NULL;
+  wall->thread_count = VISAGE_THREADS_AUTO;
+  wall->thread_type = VISAGE_THREADS_AUTO;
+  wall->adaptive = 0;
+  wall->zero_copy = 0;
+  wall->frame_event = 0;
+  wall->focus = -1;
+  wall->minimized = 0;
+  wall->width = 0;
+  wall->height = 0;
+  wall->refresh_interval = -1;
+  wall->redraw = 0;
+
+  return wall;
+}
+
+/** Thread entry point for reading the packets of a tile. */
+static void* visage_tile_thread(void* arg) {
+  visage_process_demux(arg);
+  return NULL;
+}
+
+/** Task decoding the video of a tile. */
+static int visage_tile_task(void* arg) {
+  return visage_step_video(arg);
+}
+
+/** Opens the file of a tile and sets up its contexts. Outputs 0 on success, -1 on error. */
+static int visage_open_tile(SDL_Renderer* renderer, VisageWall* wall, VisageTile* tile,
+                            const char* file, int thread_count) {
+  // open the file
+  int ret = avformat_open_input(&tile->format_ctx, file, NULL, NULL);
+  if (ret != 0) {
+    printf("Error: failed to open %s: %s\n", file, av_err2str(ret));
+    return -1;
+  }
+  avformat_find_stream_info(tile->format_ctx, NULL);
+
+  // set up the video pipeline, without audio
+  tile->video = visage_alloc_video();
+  tile->clock = visage_alloc_clock();
+  tile->demuxer = visage_alloc_demuxer();
+  tile->gpu = visage_alloc_gpu();
+  if (!tile->video || !tile->clock || !tile->demuxer || !tile->gpu) {
+    printf("Error: failed to allocate memory for the tile of %s\n", file);
+    return -1;
+  }
+  VisageVideo* video = tile->video;
+  video->hwaccel = wall->hwaccel;
+  video->adaptive = wall->adaptive;
+  video->thread_count = thread_count;
+  video->thread_type = wall->thread_type;
+  video->frame_event = wall->frame_event;
+  video->cache_size = 0;
+  if (wall->zero_copy && visage_init_gpu(renderer, video, tile->gpu) < 0) return -1;
+  if (visage_init_video(tile->format_ctx, video) < 0) return -1;
+  video->clock = tile->clock;
+
+  return visage_init_demuxer(tile->format_ctx, video, NULL, tile->demuxer);
+}
+
+/** Opens the files and starts playing them. Outputs 0 on success, -1 on error. */
+int visage_init_wall(SDL_Renderer* renderer, char** files, int nb_files, VisageWall* wall) {
+  wall->tiles = av_calloc(nb_files, sizeof(VisageTile));
+  if (!wall->tiles) {
+    printf("Error: failed to allocate memory for tiles\n");
+    return -1;
+  }
+  wall->nb_tiles = nb_files;
+
+  // share the cores out between the decoders, which already run side by side
+  int thread_count = wall->thread_count;
+  if (thread_count == VISAGE_THREADS_AUTO) {
+    thread_count = FFMAX(visage_physical_cores() / nb_files, 1);
+  }
+  avformat_network_init();
+  for (int i = 0; i < nb_files; i++) {
+    if (visage_open_tile(renderer, wall, &wall->tiles[i], files[i], thread_count) < 0) return -1;
+  }
+
+  // decode every video on the shared pool, and read each file on a thread of its own
+  wall->workers = visage_alloc_workers();
+  if (!wall->workers) {
+    printf("Error: failed to allocate memory for workers\n");
+    return -1;
+  }
+  if (visage_init_workers(wall->workers, 0) < 0) return -1;
+  for (int i = 0; i < nb_files; i++) {
+    VisageTile* tile = &wall->tiles[i];
+    tile->task = visage_add_task(wall->workers, visage_tile_task, tile->video,
+                                 VISAGE_PRIORITY_HIGH);
+    if (!tile->task) return -1;
+    if (pthread_create(&tile->demux_thread, NULL, visage_tile_thread, tile->demuxer) != 0) {
+      printf("Error: failed to start the demuxer of %s\n", files[i]);
+      return -1;
+    }
+    tile->demux_started = 1;
+  }
+
+  return 0;
+}
+
+/** Marks the tiles that cannot be seen as hidden, giving the others priority. */
+static void visage_prioritize_wall(VisageWall* wall) {
+  for (int i = 0; i < wall->nb_tiles; i++) {
+    VisageTile* tile = &wall->tiles[i];
+    int hidden = wall->minimized || tile->rect.w <= 0 || tile->rect.h <= 0;
+    atomic_store(&tile->video->hidden, hidden);
+    visage_set_task_priority(tile->task, hidden ? VISAGE_PRIORITY_LOW : VISAGE_PRIORITY_HIGH);
+  }
+}
+
+/** Places the tiles in a window of the size. */
+void visage_layout_wall(VisageWall* wall, int width, int height) {
+  wall->width = width;
+  wall->height = height;
+
+  // use the grid with the fewest empty cells, wider than high
+  int cols = 1;
+  while (cols * cols < wall->nb_tiles) cols++;
+  int rows = (wall->nb_tiles + cols - 1) / cols;
+
+  for (int i = 0; i < wall->nb_tiles; i++) {
+    VisageTile* tile = &wall->tiles[i];
+    if (wall->focus >= 0) {
+      // the focused tile takes the window, moving the others off-screen
+      tile->rect = (SDL_FRect) {0, 0, 0, 0};
+      if (i == wall->focus) tile->rect = (SDL_FRect) {0, 0, width, height};
+    } else {
+      int col = i % cols;
+      int row = i / cols;
+      float x = (float) col * width / cols;
+      float y = (float) row * height / rows;
+      tile->rect = (SDL_FRect) {x, y, (float) (col + 1) * width / cols - x,
+                                (float) (row + 1) * height / rows - y};
+    }
+
+    // off-screen tiles keep their upload size, to avoid recreating textures
+    if (tile->rect.w > 0 && tile->rect.h > 0) {
+      visage_resize_video(tile->video, (int) tile->rect.w, (int) tile->rect.h);
+    }
+  }
+
+  visage_prioritize_wall(wall);
+  wall->redraw = 1;
+}
+
+/** Focuses the tile at the point, or goes back to the grid. */
+void visage_focus_wall(VisageWall* wall, float x, float y) {
+  if (wall->focus >= 0) {
+    wall->focus = -1;
+  } else {
+    SDL_FPoint point = {x, y};
+    for (int i = 0; i < wall->nb_tiles; i++) {
+      if (SDL_PointInRectFloat(&point, &wall->tiles[i].rect)) wall->focus = i;
+    }
+  }
+  visage_layout_wall(wall, wall->width, wall->height);
+}
+
+/** Hides or shows all tiles with the window. */
+void visage_minimize_wall(VisageWall* wall, int minimized) {
+  if (wall->minimized == minimized) return;
+  wall->minimized = minimized;
+  visage_prioritize_wall(wall);
+  wall->redraw = 1;
+}
+
+/** Returns the largest area of the tile showing the texture at its aspect ratio. */
+static SDL_FRect visage_fit_rect(const SDL_FRect* tile, SDL_Texture* texture) {
+  float w, h;
+  if (!SDL_GetTextureSize(texture, &w, &h) || w <= 0 || h <= 0) return *tile;
+
+  float scale = FFMIN(tile->w / w, tile->h / h);
+  SDL_FRect rect = {0, 0, w * scale, h * scale};
+  rect.x = tile->x + (tile->w - rect.w) / 2;
+  rect.y = tile->y + (tile->h - rect.h) / 2;
+  return rect;
+}
+
+/** Presents the frames due at the next vblank. Returns the milliseconds to wait before calling again. */
+int visage_display_wall(SDL_Renderer* renderer, VisageWall* wall) {
+  if (wall->refresh_interval < 0) wall->refresh_interval = visage_refresh_interval(renderer);
+
+  // upload the frames due at the next vblank, and find when the next one is due otherwise
+  int64_t ahead = wall->refresh_interval / 2000;
+  int changed = wall->redraw;
+  int64_t wait = 0;
+  for (int i = 0; i < wall->nb_tiles; i++) {
+    int64_t delay;
+    if (visage_update_video(renderer, wall->tiles[i].video, ahead, &delay)) changed = 1;
+    if (delay > 0 && (wait == 0 || delay < wait)) wait = delay;
+  }
+
+  // nothing to present without vsync until a frame is due, or while nobody watches
+  if (wall->minimized || (!wall->refresh_interval && !changed)) {
+    if (wait > 0) return (int) wait;
+    return wall->frame_event ? VISAGE_VIDEO_IDLE_MS : 1;
+  }
+  wall->redraw = 0;
+
+  // present once per vblank, repeating the shown frames until the next ones are due
+  SDL_RenderClear(renderer);
+  for (int i = 0; i < wall->nb_tiles; i++) {
+    VisageTile* tile = &wall->tiles[i];
+    SDL_Texture* texture = tile->video->shown_texture;
+    if (!texture || tile->rect.w <= 0 || tile->rect.h <= 0) continue;
+    SDL_FRect rect = visage_fit_rect(&tile->rect, texture);
+    SDL_RenderTexture(renderer, texture, NULL, &rect);
+  }
+  SDL_RenderPresent(renderer);
+
+  return 0;
+}
+
+/** Returns 1 once every video has been presented, 0 otherwise. */
+int visage_wall_finished(VisageWall* wall) {
+  for (int i = 0; i < wall->nb_tiles; i++) {
+    if (!visage_video_finished(wall->tiles[i].video)) return 0;
+  }
+  return 1;
+}
+
+/** Stops playback and frees the wall. */
+void visage_free_wall(VisageWall** wall) {
+  if (!*wall) return;
+
+  // stop the decoding tasks and the demuxers before freeing what they use
+  VisageTile* tiles = (*wall)->tiles;
+  for (int i = 0; i < (*wall)->nb_tiles; i++) {
+    if (tiles[i].video && tiles[i].video->packets) visage_abort_video(tiles[i].video);
+  }
+  visage_free_workers(&(*wall)->workers);
+  for (int i = 0; i < (*wall)->nb_tiles; i++) {
+    VisageTile* tile = &tiles[i];
+    if (tile->demux_started) pthread_join(tile->demux_thread, NULL);
+    visage_free_demuxer(&tile->demuxer);
+    visage_free_video(&tile->video);
+    visage_free_gpu(&tile->gpu);
+    visage_free_clock(&tile->clock);
+    avformat_close_input(&tile->format_ctx);
+  }
+
+  av_free(tiles);
+  av_free(*wall);
+  *wall = NULL;
+}
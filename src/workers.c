@@ -0,0 +1,257 @@
+#include <libavutil/macros.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "visage_threads.h"
+#include "visage_workers.h"
+
+/** Longest time in microseconds an idle worker sleeps without being woken up. */
+#define VISAGE_WORKERS_MAX_WAIT 100000
+
+/** Allocates the worker pool. Returns NULL on failure. */
+VisageWorkers* visage_alloc_workers() {
+  VisageWorkers* workers = av_mallocz(sizeof(VisageWorkers));
+  if (!workers) return NULL;
+
+  // initialize properties to empty
+  workers->workers = NULL;
+  workers->nb_workers = 0;
+  workers->nb_started = 0;
+  workers->nb_tasks = 0;
+  workers->nb_parked = 0;
+  atomic_init(&workers->next_wake, INT64_MAX);
+  atomic_init(&workers->nb_queued, 0);
+  atomic_init(&workers->abort, 0);
+  pthread_mutex_init(&workers->mutex, NULL);
+  pthread_cond_init(&workers->cond, NULL);
+
+  return workers;
+}
+
+/** Wakes up one idle worker, or all of them. */
+static void visage_wake_workers(VisageWorkers* workers, int all) {
+  pthread_mutex_lock(&workers->mutex);
+  if (all) {
+    pthread_cond_broadcast(&workers->cond);
+  } else {
+    pthread_cond_signal(&workers->cond);
+  }
+  pthread_mutex_unlock(&workers->mutex);
+}
+
+/** Adds the task to the end of the worker's ring of its priority. Returns the number of tasks queued on the worker. */
+static unsigned int visage_queue_task(VisageWorker* worker, VisageTask* task) {
+  int priority = atomic_load(&task->priority);
+  pthread_mutex_lock(&worker->mutex);
+  worker->queues[priority][worker->tails[priority]++ % VISAGE_WORKERS_MAX_TASKS] = task;
+  atomic_fetch_add(&worker->workers->nb_queued, 1);
+  unsigned int queued = 0;
+  for (int i = 0; i < VISAGE_PRIORITIES; i++) queued += worker->tails[i] - worker->heads[i];
+  pthread_mutex_unlock(&worker->mutex);
+
+  return queued;
+}
+
+/** Takes the task at the front of the worker's ring, or at the end when stealing. Returns NULL if the ring is empty. */
+static VisageTask* visage_take_task(VisageWorker* worker, int priority, int steal) {
+  VisageTask* task = NULL;
+  pthread_mutex_lock(&worker->mutex);
+  if (worker->heads[priority] != worker->tails[priority]) {
+    unsigned int idx = steal ? --worker->tails[priority] : worker->heads[priority]++;
+    task = worker->queues[priority][idx % VISAGE_WORKERS_MAX_TASKS];
+    atomic_fetch_sub(&worker->workers->nb_queued, 1);
+  }
+  pthread_mutex_unlock(&worker->mutex);
+  return task;
+}
+
+/** Takes the next task to run, high priority first, stealing from other workers when out of tasks. Returns NULL if there is none. */
+static VisageTask* visage_next_task(VisageWorker* worker) {
+  VisageWorkers* workers = worker->workers;
+  if (atomic_load(&workers->nb_queued) == 0) return NULL;
+
+  for (int priority = 0; priority < VISAGE_PRIORITIES; priority++) {
+    VisageTask* task = visage_take_task(worker, priority, 0);
+    for (int i = 1; !task && i < workers->nb_workers; i++) {
+      task = visage_take_task(&workers->workers[(worker->idx + i) % workers->nb_workers],
+                              priority, 1);
+    }
+    if (task) return task;
+  }
+  return NULL;
+}
+
+/** Parks the task until it is due to run again. */
+static void visage_park_task(VisageWorkers* workers, VisageTask* task, int64_t now) {
+  pthread_mutex_lock(&workers->mutex);
+  task->wake_time = now + VISAGE_WORKERS_IDLE_US;
+  workers->parked[workers->nb_parked++] = task;
+  if (task->wake_time < atomic_load(&workers->next_wake)) {
+    atomic_store(&workers->next_wake, task->wake_time);
+  }
+  pthread_mutex_unlock(&workers->mutex);
+}
+
+/** Queues the parked tasks that are due on the worker. */
+static void visage_unpark_tasks(VisageWorker* worker, int64_t now) {
+  VisageWorkers* workers = worker->workers;
+  if (now < atomic_load(&workers->next_wake)) return;
+
+  // move the due tasks over, and find when the next one is due
+  int queued = 0;
+  int64_t next_wake = INT64_MAX;
+  pthread_mutex_lock(&workers->mutex);
+  for (int i = 0; i < workers->nb_parked;) {
+    VisageTask* task = workers->parked[i];
+    if (task->wake_time > now) {
+      next_wake = FFMIN(next_wake, task->wake_time);
+      i++;
+      continue;
+    }
+    workers->parked[i] = workers->parked[--workers->nb_parked];
+    visage_queue_task(worker, task);
+    queued++;
+  }
+  atomic_store(&workers->next_wake, next_wake);
+
+  // let idle workers steal what this one cannot run right away
+  if (queued > 1) pthread_cond_broadcast(&workers->cond);
+  pthread_mutex_unlock(&workers->mutex);
+}
+
+/** Sleeps until a task is queued or the timeout in microseconds has passed. */
+static void visage_wait_workers(VisageWorkers* workers, int64_t timeout) {
+  timeout = FFMAX(FFMIN(timeout, VISAGE_WORKERS_MAX_WAIT), 0);
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  int64_t nsec = deadline.tv_nsec + timeout * 1000;
+  deadline.tv_sec += nsec / 1000000000;
+  deadline.tv_nsec = nsec % 1000000000;
+
+  pthread_mutex_lock(&workers->mutex);
+  if (atomic_load(&workers->nb_queued) == 0 && !atomic_load(&workers->abort)) {
+    pthread_cond_timedwait(&workers->cond, &workers->mutex, &deadline);
+  }
+  pthread_mutex_unlock(&workers->mutex);
+}
+
+/** Runs tasks until the pool is aborted. */
+static void* visage_worker_thread(void* arg) {
+  VisageWorker* worker = arg;
+  VisageWorkers* workers = worker->workers;
+
+  while (!atomic_load(&workers->abort)) {
+    int64_t now = av_gettime_relative();
+    visage_unpark_tasks(worker, now);
+
+    // sleep until there is something to run
+    VisageTask* task = visage_next_task(worker);
+    if (!task) {
+      visage_wait_workers(workers, atomic_load(&workers->next_wake) - now);
+      continue;
+    }
+
+    // keep tasks with more work on this worker, and let the others steal if it has several
+    int ret = task->run(task->arg);
+    if (ret > 0) {
+      if (visage_queue_task(worker, task) > 1) visage_wake_workers(workers, 0);
+    } else if (ret == 0) {
+      visage_park_task(workers, task, av_gettime_relative());
+    }
+  }
+
+  return NULL;
+}
+
+/** Starts the worker threads. Outputs 0 on success, -1 on error. */
+int visage_init_workers(VisageWorkers* workers, int count) {
+  workers->nb_workers = count > 0 ? count : visage_physical_cores();
+  workers->workers = av_calloc(workers->nb_workers, sizeof(VisageWorker));
+  if (!workers->workers) {
+    printf("Error: failed to allocate memory for workers\n");
+    return -1;
+  }
+  for (int i = 0; i < workers->nb_workers; i++) {
+    VisageWorker* worker = &workers->workers[i];
+    worker->workers = workers;
+    worker->idx = i;
+    pthread_mutex_init(&worker->mutex, NULL);
+  }
+
+  // start the threads once every worker can be stolen from
+  for (int i = 0; i < workers->nb_workers; i++) {
+    VisageWorker* worker = &workers->workers[i];
+    if (pthread_create(&worker->thread, NULL, visage_worker_thread, worker) != 0) {
+      printf("Error: failed to start the worker threads\n");
+      return -1;
+    }
+    workers->nb_started++;
+  }
+
+  return 0;
+}
+
+/** Adds a task to the pool. Returns NULL on failure. */
+VisageTask* visage_add_task(VisageWorkers* workers, VisageTaskFunc run, void* arg, int priority) {
+  VisageTask* task = av_mallocz(sizeof(VisageTask));
+  if (!task) {
+    printf("Error: failed to allocate memory for task\n");
+    return NULL;
+  }
+  task->run = run;
+  task->arg = arg;
+  atomic_init(&task->priority, priority);
+  task->wake_time = 0;
+
+  // spread the tasks over the workers to begin with
+  pthread_mutex_lock(&workers->mutex);
+  if (workers->nb_tasks == VISAGE_WORKERS_MAX_TASKS) {
+    pthread_mutex_unlock(&workers->mutex);
+    printf("Error: too many tasks, at most %d are supported\n", VISAGE_WORKERS_MAX_TASKS);
+    av_free(task);
+    return NULL;
+  }
+  int idx = workers->nb_tasks;
+  workers->tasks[workers->nb_tasks++] = task;
+  pthread_mutex_unlock(&workers->mutex);
+
+  visage_queue_task(&workers->workers[idx % workers->nb_workers], task);
+  visage_wake_workers(workers, 1);
+
+  return task;
+}
+
+/** Changes the priority of the task. */
+void visage_set_task_priority(VisageTask* task, int priority) {
+  atomic_store(&task->priority, priority);
+}
+
+/** Stops the worker threads. */
+void visage_abort_workers(VisageWorkers* workers) {
+  atomic_store(&workers->abort, 1);
+  visage_wake_workers(workers, 1);
+  for (int i = 0; i < workers->nb_started; i++) pthread_join(workers->workers[i].thread, NULL);
+  workers->nb_started = 0;
+}
+
+/** Frees the worker pool and its tasks. */
+void visage_free_workers(VisageWorkers** workers) {
+  if (!*workers) return;
+
+  visage_abort_workers(*workers);
+  if ((*workers)->workers) {
+    for (int i = 0; i < (*workers)->nb_workers; i++) {
+      pthread_mutex_destroy(&(*workers)->workers[i].mutex);
+    }
+  }
+  for (int i = 0; i < (*workers)->nb_tasks; i++) av_free((*workers)->tasks[i]);
+  av_free((*workers)->workers);
+  pthread_cond_destroy(&(*workers)->cond);
+  pthread_mutex_destroy(&(*workers)->mutex);
+  av_free(*workers);
+  *workers = NULL;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+
+# generate the synthetic files the playback checks run on, each with the
+# timestamps its frames are expected at next to it, one per line in milliseconds
+FFMPEG="${1:-ffmpeg}"
+CORPUS="${2:-corpus}"
+set -e
+mkdir -p "$CORPUS"
+cd "$CORPUS"
+
+# print the timestamps of count frames at a rate, keeping the frames i the condition holds for
+timeline() {
+  awk -v count="$1" -v rate="$2" "BEGIN {
+    for (i = 0; i < count; i++) if ($3) printf \"%d\\n\", int(i * 1000 / rate + 0.5)
+  }"
+}
+
+# encode the test pattern at a size and rate, with the options and output that follow
+encode() {
+  size="$1"
+  rate="$2"
+  shift 2
+  "$FFMPEG" -v error -y -f lavfi -i "testsrc2=size=$size:rate=$rate" "$@"
+}
+
+# constant frame rate with B-frames reordered, and planar float audio
+encode 640x360 30 -f lavfi -i sine -t 5 -c:v mpeg4 -bf 2 -g 30 -c:a aac cfr.mkv
+timeline 150 30 1 > cfr.mkv.pts
+
+# variable frame rate, leaving out the last third of every second, and MPEG audio
+encode 640x360 30 -f lavfi -i sine -t 5 -vf "select='lt(mod(n,30),20)'" -fps_mode passthrough \
+       -c:v mpeg4 -c:a mp2 vfr.mkv
+timeline 150 30 "i % 30 < 20" > vfr.mkv.pts
+
+# odd frame size with packed s16 PCM
+encode 321x241 24 -f lavfi -i sine -t 5 -c:v mjpeg -pix_fmt yuvj420p -c:a pcm_s16le odd.mkv
+timeline 120 24 1 > odd.mkv.pts
+
+# MPEG-TS with B-frames, whose timestamps do not start at zero
+encode 1280x720 25 -f lavfi -i sine -t 5 -c:v mpeg2video -bf 2 -c:a mp2 ts.ts
+timeline 125 25 1 > ts.ts.pts
+
+# raw stream without timestamps, which the demuxer derives from the frame rate
+encode 320x240 25 -t 5 -c:v mjpeg -f mjpeg nopts.mjpeg
+timeline 125 25 1 > nopts.mjpeg.pts